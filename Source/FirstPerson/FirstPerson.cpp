@@ -1,7 +1,45 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "FirstPerson.h"
+#include "FireShot.h"
+#include "FirstPersonReplicationGraph.h"
+#include "FirstPersonStats.h"
+#include "NetStats.h"
+#include "Engine/NetDriver.h"
+#include "Engine/ReplicationDriver.h"
+#include "Engine/World.h"
 #include "Modules/ModuleManager.h"
 
-IMPLEMENT_PRIMARY_GAME_MODULE( FDefaultGameModuleImpl, FirstPerson, "FirstPerson" );
- 
\ No newline at end of file
+CSV_DEFINE_CATEGORY(FirstPerson, true);
+
+class FFirstPersonModule : public FDefaultGameModuleImpl
+{
+	virtual void StartupModule() override
+	{
+		// The game net driver replicates through the graph unless fp.Net.ReplicationGraph is 0
+		UReplicationDriver::CreateReplicationDriverDelegate().BindLambda([](UNetDriver* ForNetDriver, const FURL& URL, UWorld* World) -> UReplicationDriver*
+		{
+			if (ForNetDriver->NetDriverName != NAME_GameNetDriver || !UFirstPersonReplicationGraph::IsEnabled()) return nullptr;
+			return NewObject<UFirstPersonReplicationGraph>(GetTransientPackage());
+		});
+
+		// The end of a match, on the server and on every client
+		WorldTearDownHandle = FWorldDelegates::OnWorldBeginTearDown.AddLambda([](UWorld* World)
+		{
+			if (World->IsGameWorld()) FFireLatencyStats::Dump(*GLog);
+		});
+
+		FFirstPersonNetStats::StartupModule();
+	}
+
+	virtual void ShutdownModule() override
+	{
+		UReplicationDriver::CreateReplicationDriverDelegate().Unbind();
+		FWorldDelegates::OnWorldBeginTearDown.Remove(WorldTearDownHandle);
+		FFirstPersonNetStats::ShutdownModule();
+	}
+
+	FDelegateHandle WorldTearDownHandle;
+};
+
+IMPLEMENT_PRIMARY_GAME_MODULE( FFirstPersonModule, FirstPerson, "FirstPerson" );
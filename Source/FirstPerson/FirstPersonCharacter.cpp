@@ -1,7 +1,22 @@
 // Copyright Epic Games, Inc. All Rights Reserved.
 
 #include "FirstPersonCharacter.h"
+#include "CharacterSignificance.h"
 #include "FirstPersonProjectile.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonStats.h"
+#include "FirstPersonMovementComponent.h"
+#include "FirstPersonReplicationGraph.h"
+#include "DamageQueue.h"
+#include "FireRelay.h"
+#include "LagCompensation.h"
+#include "MatchReplay.h"
+#include "NetStats.h"
+#include "ProjectilePool.h"
+#include "ProjectileSimulation.h"
+#include "Telemetry.h"
+#include "TraceQueue.h"
+#include "WeaponPickupSubsystem.h"
 #include "Animation/AnimInstance.h"
 #include "Camera/CameraComponent.h"
 #include "Components/CapsuleComponent.h"
@@ -11,18 +26,98 @@
 #include "Kismet/GameplayStatics.h"
 #include "Net/UnrealNetwork.h"
 #include "GameFramework/CharacterMovementComponent.h"
+#include "GameFramework/GameModeBase.h"
+#include "GameFramework/GameStateBase.h"
+#include "GameFramework/PlayerController.h"
+#include "GameFramework/PlayerState.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "Misc/App.h"
+#include "UObject/CoreNet.h"
+#include "EngineUtils.h"
+#include "Engine/DemoNetDriver.h"
+#include "Engine/Engine.h"
+#include "Engine/NetDriver.h"
+#include "Serialization/ArchiveCountMem.h"
 
 DEFINE_LOG_CATEGORY_STATIC(LogFPChar, Warning, All);
 
+// Fraction of MeleeSwingInterval a client's swings may arrive apart
+static const float MeleeSwingJitter = 0.8f;
+
+DECLARE_CYCLE_STAT(TEXT("Fire"), STAT_FirstPerson_Fire, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Spawn Projectiles"), STAT_FirstPerson_SpawnProjectiles, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Resolve Shot"), STAT_FirstPerson_ResolveShot, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Resolve Melee"), STAT_FirstPerson_ResolveMelee, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Pickup"), STAT_FirstPerson_Pickup, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Reload"), STAT_FirstPerson_Reload, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Equip"), STAT_FirstPerson_Equip, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Server_OnFire"), STAT_FirstPerson_Server_OnFire, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Multi_OnFire"), STAT_FirstPerson_Multi_OnFire, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Client_ConfirmShot"), STAT_FirstPerson_Client_ConfirmShot, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Replay_OnFire"), STAT_FirstPerson_Replay_OnFire, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Client_ReceiveShots"), STAT_FirstPerson_Client_ReceiveShots, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Server_SwingKnife"), STAT_FirstPerson_Server_SwingKnife, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Server_UpdateAim"), STAT_FirstPerson_Server_UpdateAim, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Server_EquipWeapon"), STAT_FirstPerson_Server_EquipWeapon, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Server_Reload"), STAT_FirstPerson_Server_Reload, STATGROUP_FirstPerson);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Shots"), STAT_FirstPerson_NumShots, STATGROUP_FirstPerson);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Projectiles"), STAT_FirstPerson_NumProjectiles, STATGROUP_FirstPerson);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Pickups"), STAT_FirstPerson_NumPickups, STATGROUP_FirstPerson);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Reloads"), STAT_FirstPerson_NumReloads, STATGROUP_FirstPerson);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Equips"), STAT_FirstPerson_NumEquips, STATGROUP_FirstPerson);
+DECLARE_DWORD_COUNTER_STAT(TEXT("RPCs"), STAT_FirstPerson_NumRPCs, STATGROUP_FirstPerson);
+
+static TAutoConsoleVariable<int32> CVarPredictProjectiles(
+	TEXT("fp.Projectile.Predicted"),
+	1,
+	TEXT("The shooter's client fires its projectiles on the spot and reconciles them with the server's shot. Needs fp.Projectile.BatchedSimulation."));
+
+static TAutoConsoleVariable<float> CVarMaxFastForward(
+	TEXT("fp.Projectile.MaxFastForward"),
+	0.25f,
+	TEXT("Longest time, in seconds, remote clients start a predicted shot's projectiles into their flight to make up for the latency."));
+
+static TAutoConsoleVariable<float> CVarMaxShotOriginError(
+	TEXT("fp.Shot.MaxOriginError"),
+	20.f,
+	TEXT("Distance a client's shot can start beyond the muzzle's reach from the shooter's eyes and the ground it covers in the longest rewind, on the server. Shots from farther start at the eyes."));
+
+// Time after which a shot the server did not confirm is considered rejected, in seconds
+static const double PendingShotTimeout = 2.0;
+
+// Server time, as estimated by clients, that shots are timestamped with
+static double GetServerTime(const UWorld* World)
+{
+	const AGameStateBase* GameState = World->GetGameState();
+	return GameState != nullptr ? GameState->GetServerWorldTimeSeconds() : World->GetTimeSeconds();
+}
+
+// Half a player's round trip, how far behind the server's clock its estimate of it is. Others' players
+// only have the replicated ping, in steps of 4 ms
+static double GetServerTimeLag(const APlayerState* PlayerState)
+{
+	if (PlayerState == nullptr) return 0.0;
+	const float PingMs = PlayerState->ExactPing > 0.f ? PlayerState->ExactPing : PlayerState->GetPing() * 4.f;
+	return PingMs * 0.0005;
+}
+
+static bool ArePredictedProjectilesEnabled()
+{
+	return CVarPredictProjectiles.GetValueOnGameThread() != 0 && UProjectileSimulationSubsystem::IsBatched();
+}
+
 //////////////////////////////////////////////////////////////////////////
 // AFirstPersonCharacter
 
-AFirstPersonCharacter::AFirstPersonCharacter()
+AFirstPersonCharacter::AFirstPersonCharacter(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer.SetDefaultSubobjectClass<UFirstPersonMovementComponent>(ACharacter::CharacterMovementComponentName))
 {
 	// Set size for collision capsule
 	GetCapsuleComponent()->InitCapsuleSize(55.f, 96.0f);
 
-	GetCapsuleComponent()->OnComponentBeginOverlap.AddDynamic(this, &AFirstPersonCharacter::OnOverLapBegin);
+	// Pickups are found by UWeaponPickupSubsystem, nothing else needs the capsule's overlaps
+	GetCapsuleComponent()->SetGenerateOverlapEvents(false);
 
 	// set our turn rates for input
 	BaseTurnRate = 45.f;
@@ -50,12 +145,37 @@ AFirstPersonCharacter::AFirstPersonCharacter()
 	FP_Gun->CastShadow = false;
 	FP_Gun->SetupAttachment(RootComponent);
 
+	// One mesh component per view for whichever gun is equipped
+	FP_WeaponMesh = CreateDefaultSubobject<UStaticMeshComponent>(TEXT("FP_WeaponMesh"));
+	FP_WeaponMesh->SetOnlyOwnerSee(true);
+	FP_WeaponMesh->bCastDynamicShadow = false;
+	FP_WeaponMesh->CastShadow = false;
+	FP_WeaponMesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	FP_WeaponMesh->SetGenerateOverlapEvents(false);
+	FP_WeaponMesh->SetupAttachment(Mesh1P);
+
+	TP_WeaponMesh = CreateDefaultSubobject<UStaticMeshComponent>(TEXT("TP_WeaponMesh"));
+	TP_WeaponMesh->SetOwnerNoSee(true);
+	TP_WeaponMesh->SetCollisionEnabled(ECollisionEnabled::NoCollision);
+	TP_WeaponMesh->SetGenerateOverlapEvents(false);
+	TP_WeaponMesh->SetupAttachment(RootComponent);
+
 	FP_MuzzleLocation = CreateDefaultSubobject<USceneComponent>(TEXT("MuzzleLocation"));
 	FP_MuzzleLocation->SetupAttachment(FP_Gun);
 	FP_MuzzleLocation->SetRelativeLocation(FVector(0.2f, 48.4f, -10.6f));
 
 	// Default offset from the character location for projectiles to spawn
 	GunOffset = FVector(100.0f, 0.0f, 10.0f);
+
+	ReplicatedAim = 0;
+	LastSentAim = 0;
+	TimeSinceAimSent = 0.f;
+	LastRecordedAim = 0;
+	ShotSeed = 0;
+	Significance = ECharacterSignificance::High;
+	DefaultAnimTickOption = EVisibilityBasedAnimTickOption::AlwaysTickPose;
+	ReplicatedHealth = uint8(FMath::Clamp(FMath::CeilToInt(health), 0, 255));
+	LastRecordedHealth = ReplicatedHealth;
 }
 
 void AFirstPersonCharacter::BeginPlay()
@@ -78,94 +198,210 @@ void AFirstPersonCharacter::BeginPlay()
 	*/
 
 	// Get the mesh component that will be used when being viewed from a networked view (when not controlling this pawn)
-	TArray<USkeletalMeshComponent*> comps;
-	GetComponents(comps);
-	for (auto SkeletalMeshComponent : comps)
+	const FCharacterComponentLayout& Layout = FCharacterComponentLayout::Get(this);
+	Mesh3P = Layout.Mesh3P != NAME_None ? FindObjectFast<USkeletalMeshComponent>(this, Layout.Mesh3P) : nullptr;
+
+	AdoptLegacyGunMeshes(Layout);
+
+	// Nothing is rendered on a dedicated server
+	if (GetNetMode() == NM_DedicatedServer) StripCosmeticComponents();
+
+	// The body's update rate follows the character's significance
+	if (Mesh3P != nullptr && GetNetMode() != NM_DedicatedServer)
 	{
-		if (SkeletalMeshComponent->GetName() == TP_MeshName)
+		DefaultAnimTickOption = Mesh3P->VisibilityBasedAnimTickOption;
+		if (!Mesh3P->bEnableUpdateRateOptimizations)
 		{
-			Mesh3P = SkeletalMeshComponent;
-			break;
+			Mesh3P->bEnableUpdateRateOptimizations = true;
+			Mesh3P->ReregisterComponent();
 		}
 	}
+	GetWorld()->GetSubsystem<UCharacterSignificanceSubsystem>()->RegisterCharacter(this);
+
+	// Guns start out in the inventory's defaults, or what the server replicated already
+	if (IsLocallyControlled() || HasAuthority()) EquippedGun = Inventory.Equipped;
+	UpdateGunMeshes();
+
+	// Have projectiles ready before the first shot
+	if (ProjectileClass != nullptr) GetWorld()->GetSubsystem<UProjectilePoolSubsystem>()->Prewarm(ProjectileClass);
+
+	// Record poses for lag compensated hits
+	if (HasAuthority()) GetWorld()->GetSubsystem<ULagCompensationSubsystem>()->RegisterCharacter(this);
+
+	// Pick up weapons walked over
+	if (HasAuthority()) GetWorld()->GetSubsystem<UWeaponPickupSubsystem>()->RegisterCharacter(this);
+}
+
+void AFirstPersonCharacter::StripCosmeticComponents()
+{
+	if (FP_WeaponMesh != nullptr) FP_WeaponMesh->DestroyComponent();
+	if (TP_WeaponMesh != nullptr) TP_WeaponMesh->DestroyComponent();
+	FP_WeaponMesh = nullptr;
+	TP_WeaponMesh = nullptr;
 
-	TArray<UStaticMeshComponent*> guns;
-	GetComponents(guns);
-	for (auto StaticMeshComponent : guns)
+	if (Mesh1P != nullptr)
 	{
-		if (StaticMeshComponent->GetName() == TEXT("FP_Revolver"))
-		{
-			FP_GunMeshes[Revolver] = StaticMeshComponent;
-		}
-		else if (StaticMeshComponent->GetName() == TEXT("FP_Shotgun"))
-		{
-			FP_GunMeshes[Shotgun] = StaticMeshComponent;
-		}
-		else if (StaticMeshComponent->GetName() == TEXT("FP_Rifle"))
-		{
-			FP_GunMeshes[Rifle] = StaticMeshComponent;
-		}
-		else if (StaticMeshComponent->GetName() == TEXT("TP_Revolver"))
-		{
-			TP_GunMeshes[Revolver] = StaticMeshComponent;
-		}
-		else if (StaticMeshComponent->GetName() == TEXT("TP_Shotgun"))
+		Mesh1P->DestroyComponent();
+		Mesh1P = nullptr;
+	}
+
+	// The gun is only kept for its muzzle location
+	FP_Gun->SetComponentTickEnabled(false);
+	FP_Gun->bNoSkeletonUpdate = true;
+
+	// The body is only needed for its capsule, not its pose
+	if (Mesh3P != nullptr) Mesh3P->VisibilityBasedAnimTickOption = EVisibilityBasedAnimTickOption::OnlyTickPoseWhenRendered;
+}
+
+void AFirstPersonCharacter::SetSignificance(ECharacterSignificance Level)
+{
+	if (Level == Significance) return;
+	Significance = Level;
+	const FCharacterSignificanceSettings& Settings = UCharacterSignificanceSubsystem::GetSettings(Level);
+
+	// Only characters that are simulated here, or idle, tick less: the authority moves players and bots in their ticks
+	if (GetLocalRole() == ROLE_SimulatedProxy || GetController() == nullptr)
+	{
+		SetActorTickInterval(Settings.TickInterval);
+		GetCharacterMovement()->SetComponentTickInterval(Settings.TickInterval);
+	}
+
+	// Sent less often when no player is close or looking
+	if (HasAuthority() && GetNetMode() != NM_Standalone)
+	{
+		NetUpdateFrequency = GetClass()->GetDefaultObject<AFirstPersonCharacter>()->NetUpdateFrequency * Settings.NetUpdateScale;
+
+		// The graph keeps its own copy of the frequency
+		const UNetDriver* NetDriver = GetNetDriver();
+		if (UFirstPersonReplicationGraph* Graph = NetDriver != nullptr ? Cast<UFirstPersonReplicationGraph>(NetDriver->GetReplicationDriver()) : nullptr)
 		{
-			TP_GunMeshes[Shotgun] = StaticMeshComponent;
+			Graph->SetUpdateFrequency(this, NetUpdateFrequency);
 		}
-		else if (StaticMeshComponent->GetName() == TEXT("TP_Rifle"))
+	}
+
+	if (GetNetMode() == NM_DedicatedServer) return;
+
+	if (Mesh3P != nullptr)
+	{
+		Mesh3P->VisibilityBasedAnimTickOption = Level == ECharacterSignificance::Hidden ? EVisibilityBasedAnimTickOption::OnlyTickMontagesWhenNotRendered : DefaultAnimTickOption;
+		Mesh3P->SetCastShadow(Settings.bCastShadows);
+
+		// Every LOD skips the same frames, the level decides rather than the screen size
+		if (FAnimUpdateRateParameters* RateParams = Mesh3P->AnimUpdateRateParams)
 		{
-			TP_GunMeshes[Rifle] = StaticMeshComponent;
+			RateParams->bShouldUseLodMap = true;
+			RateParams->LODToFrameSkipMap.Reset();
+			for (int32 LOD = 0; LOD < MAX_SKELETAL_MESH_LODS; LOD++) RateParams->LODToFrameSkipMap.Add(LOD, Settings.AnimFrameSkip);
 		}
 	}
+	if (TP_WeaponMesh != nullptr) TP_WeaponMesh->SetCastShadow(Settings.bCastShadows);
+}
 
-	// Initializing guns
-	weapons[Melee].Initialize(Melee);
-	weapons[Revolver].Initialize(Revolver);
-	OnEquipWeapon(Revolver);
+void AFirstPersonCharacter::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (ULagCompensationSubsystem* LagCompensation = GetWorld()->GetSubsystem<ULagCompensationSubsystem>())
+	{
+		LagCompensation->UnregisterCharacter(this);
+	}
+	if (UWeaponPickupSubsystem* Pickups = GetWorld()->GetSubsystem<UWeaponPickupSubsystem>())
+	{
+		Pickups->UnregisterCharacter(this);
+	}
+	if (UCharacterSignificanceSubsystem* Significances = GetWorld()->GetSubsystem<UCharacterSignificanceSubsystem>())
+	{
+		Significances->UnregisterCharacter(this);
+	}
+
+	Super::EndPlay(EndPlayReason);
 }
 
 void AFirstPersonCharacter::GetLifetimeReplicatedProps(TArray<FLifetimeProperty> &OutLifetimeProps) const
 {
 	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
 
-	DOREPLIFETIME(AFirstPersonCharacter, LookRotation);
-	DOREPLIFETIME(AFirstPersonCharacter, isCrouched);
+	DOREPLIFETIME_CONDITION(AFirstPersonCharacter, ReplicatedAim, COND_SkipOwner);
+	DOREPLIFETIME_CONDITION(AFirstPersonCharacter, Inventory, COND_OwnerOnly);
+	DOREPLIFETIME_CONDITION(AFirstPersonCharacter, EquippedGun, COND_SkipOwner);
+	DOREPLIFETIME(AFirstPersonCharacter, ReplicatedHealth);
 }
 
-void AFirstPersonCharacter::OnOverLapBegin(UPrimitiveComponent* OverLappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIntdex, bool bFromSweep, const FHitResult& SweepResult)
+void AFirstPersonCharacter::PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker)
 {
-	//Pickup Gun
-	if (OtherActor->IsA(AWeapon::StaticClass()))
-	{
-		AWeapon* gun = Cast<AWeapon>(OtherActor);
-		gun->OnWeaponPickup();
+	Super::PreReplication(ChangedPropertyTracker);
 
-		if (IsLocallyControlled())
-		{
-			EWeaponType type = gun->weaponType;
-			if (weapons[type].active == false)
-			{
-				weapons[type].clipAmmo = gun->clipAmmo;
-				weapons[type].maxClipAmmo = gun->maxClipAmmo;
-				weapons[type].reloadTime = gun->reloadTime;
-				weapons[type].damage = gun->damage;
-				weapons[type].active = true;
-				OnEquipWeapon(type);
-			}
-			else if (totalAmmo[type] <= 0)
-			{
-				totalAmmo[type] = gun->clipAmmo;
-			}
-			else if (totalAmmo[type] + gun->clipAmmo > maxTotalAmmo[type])
-			{
-				totalAmmo[type] = maxTotalAmmo[type];
-			}
-			else totalAmmo[type] += gun->clipAmmo;
-		}
+	// Account property updates the same way as RPCs, Inventory is accounted by its NetDeltaSerialize
+	if (ReplicatedAim != LastRecordedAim)
+	{
+		FFirstPersonNetStats::RecordProperty(this, GET_MEMBER_NAME_CHECKED(AFirstPersonCharacter, ReplicatedAim), true);
+		LastRecordedAim = ReplicatedAim;
+	}
+	if (ReplicatedHealth != LastRecordedHealth)
+	{
+		FFirstPersonNetStats::RecordProperty(this, GET_MEMBER_NAME_CHECKED(AFirstPersonCharacter, ReplicatedHealth), false);
+		LastRecordedHealth = ReplicatedHealth;
+	}
+	if (EquippedGun != LastRecordedEquippedGun)
+	{
+		FFirstPersonNetStats::RecordProperty(this, GET_MEMBER_NAME_CHECKED(AFirstPersonCharacter, EquippedGun), true);
+		LastRecordedEquippedGun = EquippedGun;
 	}
 }
 
+void AFirstPersonCharacter::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	if (IsLocallyControlled()) UpdateAim(DeltaSeconds);
+	if (PendingShots.Num() > 0) ExpirePendingShots();
+}
+
+bool AFirstPersonCharacter::ApplyDamage(int32 Damage)
+{
+	if (IsDead()) return false;
+
+	health = FMath::Max(health - Damage, 0.f);
+	ReplicatedHealth = uint8(FMath::Clamp(FMath::CeilToInt(health), 0, 255));
+	return true;
+}
+
+void AFirstPersonCharacter::Die(AFirstPersonCharacter* Killer)
+{
+	UE_LOG(LogFPChar, Log, TEXT("%s killed %s"), Killer != nullptr ? *Killer->GetName() : TEXT("Nobody"), *GetName());
+	FGameplayTelemetry::Record(ETelemetryEvent::Death, FGameplayTelemetry::GetSubjectId(this), FGameplayTelemetry::GetSubjectId(Killer), GetActorLocation(), uint8(Inventory.Equipped));
+
+	AController* DeadController = GetController();
+	DetachFromControllerPendingDestroy();
+	Destroy();
+
+	// Back in the game as a new character
+	AGameModeBase* GameMode = GetWorld()->GetAuthGameMode();
+	if (DeadController != nullptr && GameMode != nullptr) GameMode->RestartPlayer(DeadController);
+}
+
+void AFirstPersonCharacter::OnRep_ReplicatedHealth()
+{
+	health = ReplicatedHealth;
+}
+
+void AFirstPersonCharacter::PickUp(AWeapon* gun)
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Pickup);
+
+	// The server owns pickups and the inventory, clients get both replicated
+	if (!HasAuthority() || !gun->IsAvailable()) return;
+
+	gun->OnWeaponPickup();
+	FIRSTPERSON_INC_COUNTER(Pickups);
+	FGameplayTelemetry::Record(ETelemetryEvent::Pickup, FGameplayTelemetry::GetSubjectId(this), 0, gun->GetActorLocation(), uint8(gun->weaponType), int16(gun->clipAmmo));
+
+	FGun Picked;
+	Picked.clipAmmo = gun->clipAmmo;
+	Picked.maxClipAmmo = gun->maxClipAmmo;
+	Picked.reloadTime = gun->reloadTime;
+	Picked.damage = gun->damage;
+	if (Inventory.AddWeapon(gun->weaponType, Picked)) OnEquipWeapon(gun->weaponType);
+}
+
 //////////////////////////////////////////////////////////////////////////
 // Input
 
@@ -216,12 +452,19 @@ void AFirstPersonCharacter::SetupPlayerInputComponent(class UInputComponent* Pla
 
 void AFirstPersonCharacter::OnFire()
 {
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Fire);
+
 	if (ProjectileClass != nullptr)
 	{
-		if (EquippedGun != Melee)
+		if (Inventory.Equipped != Melee)
 		{
-			if (weapons[EquippedGun].clipAmmo > 0)
+			// Predicted on the owning client, the server takes its own round in Server_OnFire
+			if (Inventory.ConsumeClipAmmo())
 			{
+				FIRSTPERSON_INC_COUNTER(Shots);
+				const double InputTime = FApp::GetCurrentTime();
+				FFireLatencyStats::Record(EFireLatencyStage::Input, FPlatformTime::Seconds() - InputTime);
+
 				UWorld* const World = GetWorld();
 				if (World != nullptr)
 				{
@@ -229,15 +472,42 @@ void AFirstPersonCharacter::OnFire()
 					// MuzzleOffset is in camera space, so transform it to world space before offsetting from the character location to find the final muzzle position
 					const FVector SpawnLocation = ((FP_MuzzleLocation != nullptr) ? FP_MuzzleLocation->GetComponentLocation() : GetActorLocation()) + SpawnRotation.RotateVector(GunOffset);
 
-					// Replicate fire event
-					if (!World->IsServer()) Server_OnFire(SpawnLocation, SpawnRotation);
-					else Multi_OnFire(SpawnLocation, SpawnRotation);
+					// One shot whatever the number of pellets, everyone expands them from the seed
+					FFireShot Shot;
+					Shot.SetMuzzle(SpawnLocation, SpawnRotation);
+					Shot.Seed = ++ShotSeed;
+					Shot.Weapon = Inventory.Equipped;
+					if (const AGameStateBase* GameState = World->GetGameState()) Shot.Timestamp = GameState->GetServerWorldTimeSeconds();
 
-					weapons[EquippedGun].clipAmmo -= 1;
+					// Replicate fire event
+					if (!World->IsServer())
+					{
+						FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_OnFire), Shot);
+						Server_OnFire(Shot);
+
+						// The seed identifies the shot, the server's confirmation of it has the same
+						const double FireTime = FPlatformTime::Seconds();
+						const bool bPredicted = ArePredictedProjectilesEnabled();
+						PendingShots.Add(FPendingFireShot{ Shot, FireTime, InputTime, bPredicted });
+						if (bPredicted)
+						{
+							FireProjectiles(Shot, 0, 0.f);
+							PlayFireSound(Shot.Location);
+							FFireLatencyStats::RecordOnScreen(EFireLatencyStage::ShooterEffect, InputTime);
+						}
+					}
+					else
+					{
+						Shot.Timestamp = World->GetTimeSeconds();
+						FGameplayTelemetry::Record(ETelemetryEvent::Shot, FGameplayTelemetry::GetSubjectId(this), 0, Shot.Location, uint8(Shot.Weapon), 0, Shot.Seed);
+						ServerResolveShot(Shot);
+						BroadcastShot(Shot);
+					}
 				}
 
+#if !UE_SERVER
 				// try and play a firing animation if specified
-				if (FireAnimation != nullptr)
+				if (FireAnimation != nullptr && Mesh1P != nullptr)
 				{
 					// Get the animation object for the arms mesh
 					UAnimInstance* AnimInstance = Mesh1P->GetAnimInstance();
@@ -246,6 +516,7 @@ void AFirstPersonCharacter::OnFire()
 						AnimInstance->Montage_Play(FireAnimation, 1.f);
 					}
 				}
+#endif
 			}
 			else //Not enough ammo in the weapon
 			{
@@ -254,37 +525,378 @@ void AFirstPersonCharacter::OnFire()
 		}
 		else // Melee Weapon Equipped
 		{
-			//TODO
+			SwingKnife();
 		}
 	}
 }
 
-bool AFirstPersonCharacter::Server_OnFire_Validate(FVector Location, FRotator Rotation)
+bool AFirstPersonCharacter::Server_OnFire_Validate(FFireShot Shot)
 {
 	return true;
 }
 
-void AFirstPersonCharacter::Server_OnFire_Implementation(FVector Location, FRotator Rotation)
+void AFirstPersonCharacter::Server_OnFire_Implementation(FFireShot Shot)
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Server_OnFire);
+	FIRSTPERSON_INC_COUNTER(RPCs);
+
+	FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_OnFire), Shot);
+	FFireLatencyStats::Record(EFireLatencyStage::ToServer, GetServerTime(GetWorld()) - (Shot.Timestamp + GetServerTimeLag(GetPlayerState())));
+
+	// Reliable shots arrive in order, so the sequence stays in step with the client's and
+	// a client can't pick seeds with a favorable spread
+	Shot.Seed = ++ShotSeed;
+
+	// Shots the server's inventory has no ammo for are not fired, and always with the gun it has equipped
+	if (!Inventory.ConsumeClipAmmo()) return;
+	Shot.Weapon = Inventory.Equipped;
+
+	// Nor from where the shooter is not: the muzzle is within reach of its eyes, wherever it moved since it fired
+	const FVector EyeLocation = GetPawnViewLocation();
+	if (FVector::DistSquared(Shot.Location, EyeLocation) > FMath::Square(GetMaxShotOriginError()))
+	{
+		UE_LOG(LogFPChar, Warning, TEXT("%s fired from %s, %.0f away from its eyes"), *GetName(), *Shot.Location.ToString(), FVector::Dist(Shot.Location, EyeLocation));
+		Shot.SetMuzzle(EyeLocation, Shot.GetRotation());
+	}
+	FGameplayTelemetry::Record(ETelemetryEvent::Shot, FGameplayTelemetry::GetSubjectId(this), 0, Shot.Location, uint8(Shot.Weapon), 0, Shot.Seed);
+
+	ServerResolveShot(Shot);
+	BroadcastShot(Shot);
+}
+
+float AFirstPersonCharacter::GetMaxShotOriginError() const
 {
-	Multi_OnFire(Location, Rotation);
+	// Each link from the eyes to the muzzle at its longest, whatever the aim: the camera is attached
+	// away from the eye height and the arms turn with it
+	float MuzzleReach = GunOffset.Size();
+	if (FirstPersonCameraComponent != nullptr && FP_MuzzleLocation != nullptr)
+	{
+		const FVector CameraLocation = FirstPersonCameraComponent->GetComponentLocation();
+		MuzzleReach += FVector::Dist(GetPawnViewLocation(), CameraLocation) + FVector::Dist(CameraLocation, FP_MuzzleLocation->GetComponentLocation());
+	}
+
+	const UFirstPersonMovementComponent* Movement = Cast<UFirstPersonMovementComponent>(GetCharacterMovement());
+	const float MaxSpeed = FMath::Max(GetCharacterMovement()->GetMaxSpeed(), Movement != nullptr ? Movement->MaxSprintSpeed : 0.f);
+	return MuzzleReach + MaxSpeed * ULagCompensationSubsystem::GetMaxRewind() + CVarMaxShotOriginError.GetValueOnGameThread();
 }
 
-bool AFirstPersonCharacter::Multi_OnFire_Validate(FVector Location, FRotator Rotation)
+void AFirstPersonCharacter::BroadcastShot(const FFireShot& Shot)
+{
+	if (UMatchReplaySubsystem::IsRecordingShots(GetWorld())) Replay_OnFire(Shot);
+
+	if (!UFireRelaySubsystem::IsEnabled())
+	{
+		FFirstPersonNetStats::RecordMulticast(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Multi_OnFire), Shot);
+		Multi_OnFire(Shot);
+		return;
+	}
+
+	// The server's own projectiles, and the listen server player's view
+	SimulateShot(Shot);
+
+	// The shooter's client must hear back about every shot to reconcile its predicted projectiles
+	if (!IsLocallyControlled() && GetNetConnection() != nullptr)
+	{
+		FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Client_ConfirmShot), Shot);
+		Client_ConfirmShot(Shot);
+	}
+
+	GetWorld()->GetSubsystem<UFireRelaySubsystem>()->QueueShot(this, Shot);
+}
+
+void AFirstPersonCharacter::Client_ConfirmShot_Implementation(FFireShot Shot)
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Client_ConfirmShot);
+	FIRSTPERSON_INC_COUNTER(RPCs);
+
+	ReconcileShot(Shot);
+}
+
+void AFirstPersonCharacter::ReceiveShots(const TArray<FRelayedShots>& Batches)
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Client_ReceiveShots);
+	FIRSTPERSON_INC_COUNTER(RPCs);
+
+	for (const FRelayedShots& Shots : Batches)
+	{
+		// Shooters the client dropped since
+		if (!IsValid(Shots.Shooter)) continue;
+
+		for (const FFireShot& Shot : Shots.Shots) Shots.Shooter->SimulateShot(Shot);
+	}
+}
+
+void AFirstPersonCharacter::GetPelletDirections(const FFireShot& Shot, TArray<FVector>& OutDirections) const
+{
+	if (Shot.Weapon == Shotgun) Shot.GetPelletDirections(ShotgunPellets, ShotgunSpread, OutDirections);
+	else Shot.GetPelletDirections(1, 0.f, OutDirections);
+}
+
+void AFirstPersonCharacter::ServerResolveShot(const FFireShot& Shot)
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(ResolveShot);
+
+	// The projectiles of the shot deal the damage instead
+	if (UDamageQueueSubsystem::ProjectilesDealDamage()) return;
+
+	const ULagCompensationSubsystem* LagCompensation = GetWorld()->GetSubsystem<ULagCompensationSubsystem>();
+
+	TArray<FVector> Directions;
+	GetPelletDirections(Shot, Directions);
+
+	TArray<AFirstPersonCharacter*> Victims;
+	TArray<FVector> HitLocations;
+	LagCompensation->RewindTraceMulti(this, LagCompensation->GetShooterTime(this, Shot.Timestamp), Shot.Location, Directions, HitscanRange, Victims, HitLocations);
+
+	// The history only has characters, pellets that went through a wall are dropped next frame
+	UTraceQueueSubsystem* TraceQueue = GetWorld()->GetSubsystem<UTraceQueueSubsystem>();
+	const int32 Damage = Inventory.Weapons[Shot.Weapon].damage;
+	const uint8 Weapon = Shot.Weapon;
+	for (int32 i = 0; i < Victims.Num(); i++)
+	{
+		if (Victims[i] == nullptr) continue;
+
+		FCollisionQueryParams Params(SCENE_QUERY_STAT(ShotLineOfSight), false, this);
+		Params.AddIgnoredActor(Victims[i]);
+		TWeakObjectPtr<AFirstPersonCharacter> Victim = Victims[i];
+		const FVector HitLocation = HitLocations[i];
+		TraceQueue->LineTrace(this, EAsyncTraceType::Single, Shot.Location, HitLocation, ECC_Visibility, Params, [this, Victim, HitLocation, Damage, Weapon](const TArray<FHitResult>& Hits)
+		{
+			if (Hits.Num() > 0 || !Victim.IsValid()) return;
+
+			UE_LOG(LogFPChar, Log, TEXT("%s hit %s at %s"), *GetName(), *Victim->GetName(), *HitLocation.ToString());
+			GetWorld()->GetSubsystem<UDamageQueueSubsystem>()->AddDamage(Victim.Get(), this, Damage, HitLocation, Weapon);
+		});
+	}
+}
+
+void AFirstPersonCharacter::SwingKnife()
+{
+	if (!Inventory.Owns(Melee)) return;
+
+	// The owner paces its swings, the server allows them a little early for the jitter of their arrival
+	const float Now = GetWorld()->GetTimeSeconds();
+	const float MinInterval = HasAuthority() && !IsLocallyControlled() ? MeleeSwingInterval * MeleeSwingJitter : MeleeSwingInterval;
+	if (LastSwingTime >= 0.f && Now - LastSwingTime < MinInterval)
+	{
+		if (HasAuthority() && !IsLocallyControlled()) UE_LOG(LogFPChar, Log, TEXT("%s swung %.3f s after the last swing, dropped"), *GetName(), Now - LastSwingTime);
+		return;
+	}
+	LastSwingTime = Now;
+
+	if (HasAuthority())
+	{
+		ServerResolveMelee();
+	}
+	else
+	{
+		FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_SwingKnife));
+		Server_SwingKnife();
+	}
+}
+
+bool AFirstPersonCharacter::Server_SwingKnife_Validate()
 {
 	return true;
 }
 
-void AFirstPersonCharacter::Multi_OnFire_Implementation(FVector Location, FRotator Rotation)
+void AFirstPersonCharacter::Server_SwingKnife_Implementation()
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Server_SwingKnife);
+	FIRSTPERSON_INC_COUNTER(RPCs);
+
+	FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_SwingKnife));
+	SwingKnife();
+}
+
+void AFirstPersonCharacter::ServerResolveMelee()
 {
-	//Set Spawn Collision Handling Override
-	FActorSpawnParameters ActorSpawnParams;
-	ActorSpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButDontSpawnIfColliding;
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(ResolveMelee);
+
+	const FVector Start = GetPawnViewLocation();
+	const FVector End = Start + GetBaseAimRotation().Vector() * MeleeRange;
+	FCollisionQueryParams Params(SCENE_QUERY_STAT(MeleeSweep), false, this);
 
-	// spawn the projectile at the muzzle
-	GetWorld()->SpawnActor<AFirstPersonProjectile>(ProjectileClass, Location, Rotation, ActorSpawnParams);
+	GetWorld()->GetSubsystem<UTraceQueueSubsystem>()->Sweep(this, EAsyncTraceType::Multi, Start, End, FQuat::Identity, FCollisionShape::MakeSphere(MeleeRadius), ECC_Pawn, Params,
+		[this](const TArray<FHitResult>& Hits)
+	{
+		// A sweep hits a character once per component, register it once
+		TArray<AFirstPersonCharacter*, TInlineAllocator<4>> Victims;
+		for (const FHitResult& Hit : Hits)
+		{
+			AFirstPersonCharacter* Victim = Cast<AFirstPersonCharacter>(Hit.GetActor());
+			if (Victim == nullptr || Victims.Contains(Victim)) continue;
+
+			Victims.Add(Victim);
+			UE_LOG(LogFPChar, Log, TEXT("%s stabbed %s at %s"), *GetName(), *Victim->GetName(), *Hit.ImpactPoint.ToString());
+			GetWorld()->GetSubsystem<UDamageQueueSubsystem>()->AddDamage(Victim, this, Inventory.Weapons[Melee].damage, Hit.ImpactPoint, uint8(Melee));
+		}
+	});
+}
 
+bool AFirstPersonCharacter::Multi_OnFire_Validate(FFireShot Shot)
+{
+	return true;
+}
+
+void AFirstPersonCharacter::Multi_OnFire_Implementation(FFireShot Shot)
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Multi_OnFire);
+	FIRSTPERSON_INC_COUNTER(RPCs);
+
+	// The shooter's client fired it already or is waiting for it
+	if (IsLocallyControlled() && !HasAuthority())
+	{
+		ReconcileShot(Shot);
+		return;
+	}
+
+	SimulateShot(Shot);
+}
+
+void AFirstPersonCharacter::Replay_OnFire_Implementation(FFireShot Shot)
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Replay_OnFire);
+
+	// Also run on the recording server, which fired the shot already. Shots skipped over by a seek
+	// are not fired, the replay has their damage in the characters' health.
+	const UDemoNetDriver* DemoNetDriver = GetWorld()->GetDemoNetDriver();
+	if (DemoNetDriver == nullptr || !DemoNetDriver->IsPlaying() || DemoNetDriver->IsFastForwarding()) return;
+
+	FireProjectiles(Shot, 0, 0.f);
+	PlayFireSound(Shot.Location);
+}
+
+bool AFirstPersonCharacter::CallRemoteFunction(UFunction* Function, void* Parameters, FOutParmRec* OutParms, FFrame* Stack)
+{
+	// Shots are recorded once, as compact unreliable Replay_OnFire, and never sent to players that way
+	const bool bReplayShot = Function->GetFName() == GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Replay_OnFire);
+	if (!bReplayShot && Function->GetFName() != GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Multi_OnFire))
+	{
+		return Super::CallRemoteFunction(Function, Parameters, OutParms, Stack);
+	}
+
+	// As AActor::CallRemoteFunction, but for each shot's own net drivers
+	bool bProcessed = false;
+	const FWorldContext* Context = GEngine->GetWorldContextFromWorld(GetWorld());
+	if (Context == nullptr) return false;
+
+	const UDemoNetDriver* DemoNetDriver = GetWorld()->GetDemoNetDriver();
+	for (const FNamedNetDriver& Driver : Context->ActiveNetDrivers)
+	{
+		if (Driver.NetDriver == nullptr || (Driver.NetDriver == DemoNetDriver) != bReplayShot) continue;
+		if (!Driver.NetDriver->ShouldReplicateFunction(this, Function)) continue;
+
+		Driver.NetDriver->ProcessRemoteFunction(this, Function, Parameters, OutParms, Stack, nullptr);
+		bProcessed = true;
+	}
+	return bProcessed;
+}
+
+void AFirstPersonCharacter::SimulateShot(const FFireShot& Shot)
+{
+	// Remote clients get the shot about half a round trip after the server fired it, its projectiles start that far into their flight
+	float FastForward = 0.f;
+	if (GetNetMode() == NM_Client && ArePredictedProjectilesEnabled())
+	{
+		const APlayerController* LocalController = GetWorld()->GetFirstPlayerController();
+		const APlayerState* LocalPlayerState = LocalController != nullptr ? LocalController->PlayerState : nullptr;
+		if (LocalPlayerState != nullptr) FastForward = FMath::Min(LocalPlayerState->ExactPing * 0.0005f, CVarMaxFastForward.GetValueOnGameThread());
+	}
+
+	const int32 Damage = HasAuthority() && UDamageQueueSubsystem::ProjectilesDealDamage() ? Inventory.Weapons[Shot.Weapon].damage : 0;
+	FireProjectiles(Shot, Damage, FastForward);
+	PlayFireSound(Shot.Location);
+
+	if (GetNetMode() == NM_Client && !IsLocallyControlled())
+	{
+		// Both clocks are behind the server's, by half their player's round trip
+		const APlayerController* LocalController = GetWorld()->GetFirstPlayerController();
+		const double LocalServerTime = GetServerTime(GetWorld()) + GetServerTimeLag(LocalController != nullptr ? LocalController->PlayerState : nullptr);
+		FFireLatencyStats::Record(EFireLatencyStage::ToRemote, LocalServerTime - (Shot.Timestamp + GetServerTimeLag(GetPlayerState())));
+	}
+}
+
+void AFirstPersonCharacter::FireProjectiles(const FFireShot& Shot, int32 Damage, float FastForward)
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(SpawnProjectiles);
+
+	// spawn a projectile per pellet at the muzzle
+	TArray<FVector> Directions;
+	GetPelletDirections(Shot, Directions);
+	for (const FVector& Direction : Directions)
+	{
+		FIRSTPERSON_INC_COUNTER(Projectiles);
+		UProjectileSimulationSubsystem::Fire(GetWorld(), ProjectileClass, Shot.Location, Direction.Rotation(), this, Damage, Shot.Weapon, Shot.Seed, FastForward);
+	}
+}
+
+void AFirstPersonCharacter::PlayFireSound(const FVector& Location)
+{
+#if !UE_SERVER
 	// try and play the sound if specified
-	if (FireSound != nullptr) UGameplayStatics::PlaySoundAtLocation(this, FireSound, Location);
+	if (FireSound != nullptr && GetNetMode() != NM_DedicatedServer) UGameplayStatics::PlaySoundAtLocation(this, FireSound, Location);
+#endif
+}
+
+void AFirstPersonCharacter::ReconcileShot(const FFireShot& Shot)
+{
+	const int32 Index = PendingShots.IndexOfByPredicate([&Shot](const FPendingFireShot& Pending) { return Pending.Shot.Seed == Shot.Seed; });
+	if (Index == INDEX_NONE)
+	{
+		// Expired already, show it as remote clients do
+		FireProjectiles(Shot, 0, 0.f);
+		PlayFireSound(Shot.Location);
+		return;
+	}
+
+	// Shots and their confirmations are reliable and ordered, the shots before it were rejected by the server
+	UProjectileSimulationSubsystem* Simulation = GetWorld()->GetSubsystem<UProjectileSimulationSubsystem>();
+	for (int32 i = 0; i < Index; i++)
+	{
+		if (PendingShots[i].bPredicted && Simulation != nullptr) Simulation->RemoveShot(this, PendingShots[i].Shot.Seed);
+	}
+	const FPendingFireShot Pending = PendingShots[Index];
+	PendingShots.RemoveAt(0, Index + 1);
+
+	const double Age = FPlatformTime::Seconds() - Pending.FireTime;
+	FFireLatencyStats::Record(EFireLatencyStage::Confirm, Age);
+	if (!Pending.bPredicted)
+	{
+		FireProjectiles(Shot, 0, 0.f);
+		PlayFireSound(Shot.Location);
+		FFireLatencyStats::RecordOnScreen(EFireLatencyStage::ShooterEffect, Pending.InputTime);
+		return;
+	}
+
+	// The server fires what the client predicted unless it changed the weapon
+	if (Pending.Shot.Weapon == Shot.Weapon && Pending.Shot.Location == Shot.Location && Pending.Shot.PackedAim == Shot.PackedAim) return;
+
+	// Replace the predicted projectiles with the server's, as far into their flight as they were
+	if (Simulation != nullptr) Simulation->RemoveShot(this, Pending.Shot.Seed);
+	FireProjectiles(Shot, 0, float(Age));
+}
+
+void AFirstPersonCharacter::ExpirePendingShots()
+{
+	UProjectileSimulationSubsystem* Simulation = GetWorld()->GetSubsystem<UProjectileSimulationSubsystem>();
+	const double Now = FPlatformTime::Seconds();
+	int32 NumExpired = 0;
+	while (NumExpired < PendingShots.Num() && Now - PendingShots[NumExpired].FireTime > PendingShotTimeout)
+	{
+		const FPendingFireShot& Pending = PendingShots[NumExpired];
+		if (Pending.bPredicted && Simulation != nullptr) Simulation->RemoveShot(this, Pending.Shot.Seed);
+		NumExpired++;
+	}
+	if (NumExpired == 0) return;
+	PendingShots.RemoveAt(0, NumExpired);
+
+	// The server rejected the shots, and sent nothing back if that left its inventory unchanged
+	if (!HasAuthority())
+	{
+		Inventory.RestoreServerState();
+		OnRep_Inventory();
+	}
 }
 
 void AFirstPersonCharacter::MoveForward(float Value)
@@ -307,28 +919,14 @@ void AFirstPersonCharacter::MoveRight(float Value)
 
 void AFirstPersonCharacter::Sprint()
 {
-	if (!isCrouched)
-	{
-		if (!GetWorld()->IsServer()) Server_SetMaxWalkSpeed(1500);
-		else GetCharacterMovement()->MaxWalkSpeed = 1500;
-	}
+	// Predicted by the movement component, the server gets it with the next move
+	if (!isCrouched) CastChecked<UFirstPersonMovementComponent>(GetCharacterMovement())->SetSprinting(true);
 	//TODO: stamina system
 }
 
 void AFirstPersonCharacter::Walk()
 {
-	if (!GetWorld()->IsServer()) Server_SetMaxWalkSpeed(600);
-	else GetCharacterMovement()->MaxWalkSpeed = 600;
-}
-
-bool AFirstPersonCharacter::Server_SetMaxWalkSpeed_Validate(float speed)
-{
-	return true;
-}
-
-void AFirstPersonCharacter::Server_SetMaxWalkSpeed_Implementation(float speed)
-{
-	GetCharacterMovement()->MaxWalkSpeed = speed;
+	CastChecked<UFirstPersonMovementComponent>(GetCharacterMovement())->SetSprinting(false);
 }
 
 void AFirstPersonCharacter::TurnAtRate(float Rate)
@@ -341,127 +939,393 @@ void AFirstPersonCharacter::LookUpAtRate(float Rate)
 {
 	// calculate delta for this frame from the rate information
 	AddControllerPitchInput(Rate * BaseLookUpRate * GetWorld()->GetDeltaSeconds());
+}
+
+uint32 AFirstPersonCharacter::PackAim(const FRotator& Rotation)
+{
+	return (uint32(FRotator::CompressAxisToShort(Rotation.Pitch)) << 16) | FRotator::CompressAxisToShort(Rotation.Yaw);
+}
+
+FRotator AFirstPersonCharacter::UnpackAim(uint32 PackedAim)
+{
+	return FRotator(FRotator::DecompressAxisFromShort(PackedAim >> 16), FRotator::DecompressAxisFromShort(PackedAim & 0xFFFF), 0.f);
+}
+
+bool AFirstPersonCharacter::ShouldSendAim(uint32 PackedAim, uint32 LastPackedAim, float TimeSinceSent, float Interval, float Threshold, float SettleTime, float RefreshTime)
+{
+	if (TimeSinceSent < Interval) return false;
+
+	// Updates are unreliable, a settled aim is sent again every RefreshTime in case its last update was lost
+	if (PackedAim == LastPackedAim) return TimeSinceSent >= RefreshTime;
 
-	// replicate LookRotation
-	if (!GetWorld()->IsServer()) Server_LookUp(GetControlRotation());
-	else LookRotation = GetControlRotation();
+	// Wrapping 16 bit difference of each axis, in degrees
+	const float PitchDelta = FMath::Abs(int16((PackedAim >> 16) - (LastPackedAim >> 16))) * (360.f / 65536.f);
+	const float YawDelta = FMath::Abs(int16((PackedAim & 0xFFFF) - (LastPackedAim & 0xFFFF))) * (360.f / 65536.f);
+
+	// Small changes are still sent once the aim settles
+	return FMath::Max(PitchDelta, YawDelta) >= Threshold || TimeSinceSent >= SettleTime;
+}
+
+void AFirstPersonCharacter::UpdateAim(float DeltaSeconds)
+{
+	LookRotation = GetControlRotation();
+	const uint32 PackedAim = PackAim(LookRotation);
+
+	if (GetWorld()->IsServer())
+	{
+		ReplicatedAim = PackedAim;
+		return;
+	}
+
+	TimeSinceAimSent += DeltaSeconds;
+	if (ShouldSendAim(PackedAim, LastSentAim, TimeSinceAimSent, AimSendInterval, AimSendThreshold, AimSettleTime, AimRefreshTime))
+	{
+		FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_UpdateAim), PackedAim);
+		Server_UpdateAim(PackedAim);
+		LastSentAim = PackedAim;
+		TimeSinceAimSent = 0.f;
+	}
 }
 
-bool AFirstPersonCharacter::Server_LookUp_Validate(FRotator Rotation)
+bool AFirstPersonCharacter::Server_UpdateAim_Validate(uint32 PackedAim)
 {
 	return true;
 }
 
-void AFirstPersonCharacter::Server_LookUp_Implementation(FRotator Rotation)
+void AFirstPersonCharacter::Server_UpdateAim_Implementation(uint32 PackedAim)
 {
-	LookRotation = Rotation;
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Server_UpdateAim);
+	FIRSTPERSON_INC_COUNTER(RPCs);
+
+	FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_UpdateAim), PackedAim);
+	ReplicatedAim = PackedAim;
+	LookRotation = UnpackAim(PackedAim);
 }
 
+void AFirstPersonCharacter::OnRep_ReplicatedAim()
+{
+	LookRotation = UnpackAim(ReplicatedAim);
+}
+
+// Simulates a client aiming with bursts of mouse movement and reports the upstream bandwidth
+// of the old per-frame reliable Server_LookUp against the throttled Server_UpdateAim.
+static FAutoConsoleCommand AimBandwidthReportCommand(
+	TEXT("fp.AimBandwidthReport"),
+	TEXT("Reports aim replication bytes/sec per client. Usage: fp.AimBandwidthReport [Seconds=60] [FrameRate=60]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const float Seconds = Args.Num() > 0 ? FCString::Atof(*Args[0]) : 60.f;
+		const float FrameRate = Args.Num() > 1 ? FCString::Atof(*Args[1]) : 60.f;
+		const float DeltaSeconds = 1.f / FMath::Max(FrameRate, 1.f);
+
+		// Approximate bunch and function headers of a single RPC, the same for both paths
+		const int64 RPCHeaderBits = 48;
+
+		const AFirstPersonCharacter* Defaults = GetDefault<AFirstPersonCharacter>();
+		FRandomStream Random(1234);
+		FRotator Aim = FRotator::ZeroRotator;
+		FRotator AimRate = FRotator::ZeroRotator;
+		float SegmentTimeLeft = 0.f;
+		uint32 LastSentAim = 0;
+		float TimeSinceSent = 0.f;
+		int64 OldBits = 0, NewBits = 0, OldRPCs = 0, NewRPCs = 0;
+
+		for (float Time = 0.f; Time < Seconds; Time += DeltaSeconds)
+		{
+			// Alternate between moving the mouse and resting
+			SegmentTimeLeft -= DeltaSeconds;
+			if (SegmentTimeLeft <= 0.f)
+			{
+				const bool bMoving = AimRate.IsZero();
+				AimRate = bMoving ? FRotator(Random.FRandRange(-60.f, 60.f), Random.FRandRange(-180.f, 180.f), 0.f) : FRotator::ZeroRotator;
+				SegmentTimeLeft = bMoving ? Random.FRandRange(0.2f, 1.f) : Random.FRandRange(0.f, 1.f);
+			}
+			Aim += AimRate * DeltaSeconds;
+			Aim.Pitch = FMath::Clamp(Aim.Pitch, -89.f, 89.f);
+			const FRotator ControlRotation = Aim.GetNormalized();
+
+			// Old path: one reliable FRotator every frame
+			{
+				FNetBitWriter Writer(nullptr, 256);
+				bool bSuccess = true;
+				FRotator Rotation = ControlRotation;
+				Rotation.NetSerialize(Writer, nullptr, bSuccess);
+				OldBits += Writer.GetNumBits() + RPCHeaderBits;
+				OldRPCs++;
+			}
+
+			// New path: packed aim, throttled
+			TimeSinceSent += DeltaSeconds;
+			const uint32 PackedAim = AFirstPersonCharacter::PackAim(ControlRotation);
+			if (AFirstPersonCharacter::ShouldSendAim(PackedAim, LastSentAim, TimeSinceSent, Defaults->AimSendInterval, Defaults->AimSendThreshold, Defaults->AimSettleTime, Defaults->AimRefreshTime))
+			{
+				FNetBitWriter Writer(nullptr, 64);
+				uint32 Packed = PackedAim;
+				Writer << Packed;
+				NewBits += Writer.GetNumBits() + RPCHeaderBits;
+				NewRPCs++;
+				LastSentAim = PackedAim;
+				TimeSinceSent = 0.f;
+			}
+		}
+
+		UE_LOG(LogFPBench, Display, TEXT("Aim replication over %.0fs at %.0f fps:"), Seconds, FrameRate);
+		UE_LOG(LogFPBench, Display, TEXT("  Server_LookUp (reliable, every frame): %.1f RPC/s, %.1f bytes/s"), OldRPCs / Seconds, OldBits / 8.f / Seconds);
+		UE_LOG(LogFPBench, Display, TEXT("  Server_UpdateAim (unreliable, throttled): %.1f RPC/s, %.1f bytes/s"), NewRPCs / Seconds, NewBits / 8.f / Seconds);
+	}));
+
 void AFirstPersonCharacter::StartCrouch()
 {
 	//Stop Sprinting if player crouches while sprint
-	if (GetCharacterMovement()->MaxWalkSpeed > 600) Walk();
+	Walk();
 
+	// Crouch state is predicted and replicated by the movement component
 	Crouch();
-
-	//Replicate crouch
-	if (!GetWorld()->IsServer()) Server_isCrouch(true);
-	else isCrouched = true;
 }
 
 void AFirstPersonCharacter::StopCrouch()
 {
 	UnCrouch();
-
-	//Replicate uncrouch
-	if (!GetWorld()->IsServer()) Server_isCrouch(false);
-	else isCrouched = false;
 }
 
-bool AFirstPersonCharacter::Server_isCrouch_Validate(bool val)
+void AFirstPersonCharacter::OnStartCrouch(float HalfHeightAdjust, float ScaledHalfHeightAdjust)
 {
-	return true;
+	Super::OnStartCrouch(HalfHeightAdjust, ScaledHalfHeightAdjust);
+
+	isCrouched = true;
 }
 
-void AFirstPersonCharacter::Server_isCrouch_Implementation(bool val)
+void AFirstPersonCharacter::OnEndCrouch(float HalfHeightAdjust, float ScaledHalfHeightAdjust)
 {
-	isCrouched = val;
+	Super::OnEndCrouch(HalfHeightAdjust, ScaledHalfHeightAdjust);
+
+	isCrouched = false;
 }
 
 void AFirstPersonCharacter::OnMelee()
 {
-	if (EquippedGun != Melee && weapons[Melee].active != false)
-	{
-		//TODO
-	}
+	// Quick swing without putting the gun away
+	if (Inventory.Equipped != Melee) SwingKnife();
 }
 
 void AFirstPersonCharacter::OnRevolver()
 {
-	if (EquippedGun != Revolver && weapons[Revolver].active != false)
-	{
-		CachedGun = EquippedGun;
-		EquippedGun = Revolver;
-	}
+	OnEquipWeapon(Revolver);
 }
 
 void AFirstPersonCharacter::OnShotgun()
 {
-	if (EquippedGun != Shotgun && weapons[Shotgun].active != false)
-	{
-		CachedGun = EquippedGun;
-		EquippedGun = Shotgun;
-	}
+	OnEquipWeapon(Shotgun);
 }
 
 void AFirstPersonCharacter::OnRifle()
 {
-	if (EquippedGun != Rifle && weapons[Rifle].active != false)
-	{
-		CachedGun = EquippedGun;
-		EquippedGun = Rifle;
-	}
+	OnEquipWeapon(Rifle);
 }
 
 void AFirstPersonCharacter::OnSwitchWeapon()
 {
-	auto tmp = EquippedGun;
-	EquippedGun = CachedGun;
-	CachedGun = tmp;
+	OnEquipWeapon(Inventory.Cached);
 }
 
 void AFirstPersonCharacter::OnEquipWeapon(EWeaponType weapontype)
 {
-	FP_GunMeshes[EquippedGun]->SetHiddenInGame(true);
-	TP_GunMeshes[EquippedGun]->SetHiddenInGame(true);
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Equip);
 
-	FP_GunMeshes[weapontype]->SetHiddenInGame(false);
-	TP_GunMeshes[weapontype]->SetHiddenInGame(false);
+	if (!Inventory.Equip(weapontype)) return;
+	FIRSTPERSON_INC_COUNTER(Equips);
 
-	CachedGun = EquippedGun;
+	// Predicted on the owning client
 	EquippedGun = weapontype;
+	UpdateGunMeshes();
+
+	if (HasAuthority())
+	{
+		FGameplayTelemetry::Record(ETelemetryEvent::WeaponSwitch, FGameplayTelemetry::GetSubjectId(this), 0, GetActorLocation(), uint8(weapontype));
+	}
+	else
+	{
+		FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_EquipWeapon), uint8(weapontype));
+		Server_EquipWeapon(weapontype);
+	}
+}
+
+bool AFirstPersonCharacter::Server_EquipWeapon_Validate(TEnumAsByte<EWeaponType> weapontype)
+{
+	return weapontype < MAX_WEAPON_TYPE;
+}
+
+void AFirstPersonCharacter::Server_EquipWeapon_Implementation(TEnumAsByte<EWeaponType> weapontype)
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Server_EquipWeapon);
+	FIRSTPERSON_INC_COUNTER(RPCs);
+
+	FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_EquipWeapon), uint8(weapontype));
+	OnEquipWeapon(weapontype);
 }
 
 void AFirstPersonCharacter::OnReload()
 {
-	if (EquippedGun != Melee)
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Reload);
+
+	if (Inventory.Equipped == Melee) return;
+
+	Inventory.Reload();
+	FIRSTPERSON_INC_COUNTER(Reloads);
+
+	if (HasAuthority())
+	{
+		const uint8 Weapon = Inventory.Equipped;
+		FGameplayTelemetry::Record(ETelemetryEvent::Reload, FGameplayTelemetry::GetSubjectId(this), 0, GetActorLocation(), Weapon, int16(Inventory.Weapons[Weapon].clipAmmo));
+	}
+	else
+	{
+		FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_Reload));
+		Server_Reload();
+	}
+}
+
+bool AFirstPersonCharacter::Server_Reload_Validate()
+{
+	return true;
+}
+
+void AFirstPersonCharacter::Server_Reload_Implementation()
+{
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(Server_Reload);
+	FIRSTPERSON_INC_COUNTER(RPCs);
+
+	FFirstPersonNetStats::RecordRPC(this, GET_FUNCTION_NAME_CHECKED(AFirstPersonCharacter, Server_Reload));
+	OnReload();
+}
+
+void AFirstPersonCharacter::OnRep_Inventory()
+{
+	EquippedGun = Inventory.Equipped;
+	UpdateGunMeshes();
+}
+
+void AFirstPersonCharacter::OnRep_EquippedGun()
+{
+	UpdateGunMeshes();
+}
+
+void AFirstPersonCharacter::UpdateGunMeshes()
+{
+	// Gun meshes don't exist for melee, nor on the dedicated server
+	ShowWeaponMesh(FP_WeaponMesh, FP_WeaponMeshSlots[EquippedGun]);
+	ShowWeaponMesh(TP_WeaponMesh, TP_WeaponMeshSlots[EquippedGun]);
+}
+
+void AFirstPersonCharacter::ShowWeaponMesh(UStaticMeshComponent* Component, const FWeaponMeshSlot& Slot)
+{
+	if (Component == nullptr) return;
+
+	// Hidden until the mesh is loaded, or for good without one
+	Component->SetHiddenInGame(true);
+	if (Slot.Mesh.IsNull()) return;
+
+	USceneComponent* Parent = Slot.Parent != nullptr ? Slot.Parent : Component == FP_WeaponMesh ? (USceneComponent*)Mesh1P : (USceneComponent*)Mesh3P;
+	if (Parent != nullptr && (Component->GetAttachParent() != Parent || Component->GetAttachSocketName() != Slot.Socket))
+	{
+		Component->AttachToComponent(Parent, FAttachmentTransformRules::KeepRelativeTransform, Slot.Socket);
+	}
+	Component->SetRelativeTransform(Slot.RelativeTransform);
+
+	UWeaponMeshCache* Cache = GetGameInstance() != nullptr ? GetGameInstance()->GetSubsystem<UWeaponMeshCache>() : nullptr;
+	if (Cache == nullptr)
+	{
+		Component->SetStaticMesh(Slot.Mesh.LoadSynchronous());
+		Component->SetHiddenInGame(false);
+		return;
+	}
+
+	// The gun may have changed again by the time its mesh is loaded
+	TWeakObjectPtr<AFirstPersonCharacter> WeakThis = this;
+	TWeakObjectPtr<UStaticMeshComponent> WeakComponent = Component;
+	const EWeaponType Weapon = EquippedGun;
+	Cache->Request(Slot.Mesh, [WeakThis, WeakComponent, Weapon](UStaticMesh* Mesh)
+	{
+		if (!WeakThis.IsValid() || !WeakComponent.IsValid() || WeakThis->EquippedGun != Weapon) return;
+
+		WeakComponent->SetStaticMesh(Mesh);
+		WeakComponent->SetHiddenInGame(false);
+	});
+}
+
+void AFirstPersonCharacter::AdoptLegacyGunMeshes(const FCharacterComponentLayout& Layout)
+{
+	FWeaponMeshSlot* ViewSlots[] = { FP_WeaponMeshSlots, TP_WeaponMeshSlots };
+	static_assert(UE_ARRAY_COUNT(ViewSlots) == int32(EWeaponView::Num), "One slot array per view");
+
+	for (int32 View = 0; View < int32(EWeaponView::Num); View++)
 	{
-		int missingAmmoCount = weapons[EquippedGun].maxClipAmmo - weapons[EquippedGun].clipAmmo;
-		if (missingAmmoCount > 0)
+		for (int32 i = 0; i < MAX_WEAPON_TYPE; i++)
 		{
-			for (int i = 0; i < missingAmmoCount; i++)
+			if (Layout.LegacyGuns[View][i] == NAME_None) continue;
+			UStaticMeshComponent* Gun = FindObjectFast<UStaticMeshComponent>(this, Layout.LegacyGuns[View][i]);
+			if (Gun == nullptr) continue;
+
+			// Slots set up in the blueprint win over the old components
+			FWeaponMeshSlot& Slot = ViewSlots[View][i];
+			if (Slot.Mesh.IsNull())
 			{
-				if (totalAmmo[EquippedGun] > 0)
-				{
-					weapons[EquippedGun].clipAmmo++;
-					totalAmmo[EquippedGun]--;
-				}
-				else break; // out of ammo
+				Slot.Mesh = Gun->GetStaticMesh();
+				Slot.RelativeTransform = Gun->GetRelativeTransform();
+				Slot.Socket = Gun->GetAttachSocketName();
+				Slot.Parent = Gun->GetAttachParent();
 			}
+			Gun->DestroyComponent();
 		}
 	}
 }
 
 void AFirstPersonCharacter::OnDropWeapon()
 {
-}
\ No newline at end of file
+}
+
+// Reports what each character costs on this machine, run on a server with bots to compare builds
+static FAutoConsoleCommand CharacterFootprintCommand(
+	TEXT("fp.CharacterFootprint"),
+	TEXT("Reports per-character components, memory, transform update cost and frame time. Usage: fp.CharacterFootprint [Frames=300]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (World == nullptr) return;
+
+		const int32 NumFrames = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 300;
+
+		int32 NumCharacters = 0, NumComponents = 0;
+		SIZE_T Bytes = 0;
+		for (TActorIterator<AFirstPersonCharacter> It(World); It; ++It)
+		{
+			NumCharacters++;
+			Bytes += FArchiveCountMem(*It).GetMax();
+
+			TInlineComponentArray<UActorComponent*> Components(*It);
+			NumComponents += Components.Num();
+			for (UActorComponent* Component : Components) Bytes += FArchiveCountMem(Component).GetMax();
+		}
+		if (NumCharacters == 0) return;
+
+		UE_LOG(LogFPBench, Display, TEXT("%d characters (%s): %.1f components, %.1f KB each"),
+			NumCharacters, IsRunningDedicatedServer() ? TEXT("dedicated server") : TEXT("client"), float(NumComponents) / NumCharacters, Bytes / 1024.f / NumCharacters);
+
+		// Moving an actor updates the transform of every attached component, as movement does each frame
+		static const int32 NumMoves = 100;
+		const double MoveStart = FPlatformTime::Seconds();
+		for (TActorIterator<AFirstPersonCharacter> It(World); It; ++It)
+		{
+			const FVector Location = It->GetActorLocation();
+			for (int32 i = 0; i < NumMoves; i++)
+			{
+				It->SetActorLocation(Location + FVector(0.f, 0.f, (i & 1) ? 0.f : 1.f));
+			}
+			It->SetActorLocation(Location);
+		}
+		UE_LOG(LogFPBench, Display, TEXT("  transform update %.2f us per character move"), (FPlatformTime::Seconds() - MoveStart) * 1000000.0 / (NumCharacters * (NumMoves + 1)));
+
+		FirstPersonBenchmark::RunFrames(NumFrames, [](float) {}, [NumCharacters](const FirstPersonBenchmark::FFrameStats& Stats)
+		{
+			UE_LOG(LogFPBench, Display, TEXT("  frame %.3f ms avg, %.3f ms max, %.1f us per character"), Stats.AverageMs(), Stats.MaxBusyMs, Stats.AverageMs() * 1000.0 / NumCharacters);
+		});
+	}));
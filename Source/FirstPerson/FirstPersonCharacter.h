@@ -2,8 +2,13 @@
 
 #pragma once
 
+#include "FireShot.h"
+#include "Inventory.h"
+#include "CharacterComponentLayout.h"
 #include "Weapon.h"
+#include "WeaponMeshCache.h"
 #include "CoreMinimal.h"
+#include "Components/SkinnedMeshComponent.h"
 #include "GameFramework/Character.h"
 #include "FirstPersonCharacter.generated.h"
 
@@ -13,61 +18,38 @@ class USceneComponent;
 class UCameraComponent;
 class UAnimMontage;
 class USoundBase;
+enum class ECharacterSignificance : uint8;
 
-USTRUCT()
-struct FGun
+// Shot of the local player on a remote client, until the server confirms it
+struct FPendingFireShot
 {
-	GENERATED_BODY()
-
-	// Total amount of ammo that can be in the weapon
-	//UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
-	int maxClipAmmo;
-
-	// Total amount of ammo in the weapon
-	//UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
-	int clipAmmo;
-
-	// Time it takes to reload the weapon
-	//UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
-	int reloadTime;
-
-	// Weapon damage
-	//UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
-	int damage;
-
-	bool active;
-
-	void Initialize(EWeaponType type)
-	{
-		switch (type)
-		{
-			case Revolver:
-			{
-				clipAmmo = 6;
-				maxClipAmmo = 6;
-				reloadTime = 7;
-				damage = 25;
-				active = true;
-				break;
-			}
-			case Melee: // Melee/Knife
-			{
-				clipAmmo = 0;
-				maxClipAmmo = 0;
-				reloadTime = 0;
-				damage = 35;
-				active = true;
-				break;
-			}
-		}
-	}
+	FFireShot Shot;
+	double FireTime;
+	// Start of the frame the trigger was read in
+	double InputTime;
+	bool bPredicted;
 };
 
 UCLASS(config=Game)
-class AFirstPersonCharacter : public ACharacter
+class FIRSTPERSON_API AFirstPersonCharacter : public ACharacter
 {
 	GENERATED_BODY()
 
+	// Bots play through the same input handlers as players
+	friend struct FFirstPersonBotBrain;
+
+	// Sends the shots of other characters to the clients
+	friend class UFireRelaySubsystem;
+
+	// Plays the shots relayed to its client
+	friend class AFirstPersonPlayerController;
+
+	// Keeps the class's layout on its default object
+	friend struct FCharacterComponentLayout;
+
+	// Plays the input handlers in the automation tests and the perf suite of FirstPersonTests
+	friend struct FFirstPersonTestAccess;
+
 	/** Character mesh: Network view (entire body; seen only by others) */
 	UPROPERTY(VisibleDefaultsOnly, Category = Mesh)
 	USkeletalMeshComponent* Mesh3P;
@@ -88,23 +70,95 @@ class AFirstPersonCharacter : public ACharacter
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Camera, meta = (AllowPrivateAccess = "true"))
 	UCameraComponent* FirstPersonCameraComponent;
 
-	/** Gun meshes: 1st person view (seen only by self) */
+	/** Equipped gun: 1st person view (seen only by self), its mesh is swapped on equip */
 	UPROPERTY(VisibleDefaultsOnly, Category = Mesh)
-	UStaticMeshComponent* FP_GunMeshes[MAX_WEAPON_TYPE];
+	UStaticMeshComponent* FP_WeaponMesh;
 
-	/** Gun meshes: 3rd person view (seen only by others) */
+	/** Equipped gun: 3rd person view (seen only by others) */
 	UPROPERTY(VisibleDefaultsOnly, Category = Mesh)
-	UStaticMeshComponent* TP_GunMeshes[MAX_WEAPON_TYPE];
+	UStaticMeshComponent* TP_WeaponMesh;
+
+	/** Gun meshes shown by FP_WeaponMesh, per weapon */
+	UPROPERTY(EditDefaultsOnly, Category = Mesh)
+	FWeaponMeshSlot FP_WeaponMeshSlots[MAX_WEAPON_TYPE];
+
+	/** Gun meshes shown by TP_WeaponMesh, per weapon */
+	UPROPERTY(EditDefaultsOnly, Category = Mesh)
+	FWeaponMeshSlot TP_WeaponMeshSlots[MAX_WEAPON_TYPE];
 
-	// Player's health
+	// Player's health, changed by UDamageQueueSubsystem on the server
 	UPROPERTY(VisibleDefaultsOnly, Category = Gameplay)
 	float health = 100;
 
+	/** Health rounded up to whole points and clamped to a byte, replicated to everyone when the damage of a tick is applied */
+	UPROPERTY(ReplicatedUsing = OnRep_ReplicatedHealth)
+	uint8 ReplicatedHealth;
+
+	/** ReplicatedHealth at the last PreReplication, to account its updates in FFirstPersonNetStats */
+	uint8 LastRecordedHealth;
+
+	/** Pitch and yaw of LookRotation quantized to 16 bits each, replicated to non-owners */
+	UPROPERTY(ReplicatedUsing = OnRep_ReplicatedAim)
+	uint32 ReplicatedAim;
+
+	/** World time of the last knife swing, sent to the server or resolved on it */
+	float LastSwingTime = -1.f;
+
+	/** Last aim sent to the server and time since it was sent */
+	uint32 LastSentAim;
+	float TimeSinceAimSent;
+
+	/** ReplicatedAim at the last PreReplication, to account its updates in FFirstPersonNetStats */
+	uint32 LastRecordedAim;
+
+	/** EquippedGun at the last PreReplication, to account its updates in FFirstPersonNetStats */
+	TEnumAsByte<EWeaponType> LastRecordedEquippedGun = Revolver;
+
+	/** Sequence number of the last shot, the spread seed of the next one */
+	uint16 ShotSeed;
+
+	/** Shots sent to the server and not confirmed yet, oldest first */
+	TArray<FPendingFireShot> PendingShots;
+
+	/** Level last applied by SetSignificance */
+	ECharacterSignificance Significance;
+
+	/** Mesh3P's animation tick option before significance changed it */
+	EVisibilityBasedAnimTickOption DefaultAnimTickOption;
+
 public:
-	AFirstPersonCharacter();
+	AFirstPersonCharacter(const FObjectInitializer& ObjectInitializer);
 
-	UFUNCTION()
-	void OnOverLapBegin(UPrimitiveComponent* OverLappedComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIntdex, bool bFromSweep, const FHitResult& SweepResult);
+	virtual void Tick(float DeltaSeconds) override;
+
+	/** Packs pitch and yaw into 16 bits each */
+	static uint32 PackAim(const FRotator& Rotation);
+
+	/** Unpacks an aim created by PackAim */
+	static FRotator UnpackAim(uint32 PackedAim);
+
+	/** Returns true if the packed aim should be sent given the last one sent and the time since */
+	static bool ShouldSendAim(uint32 PackedAim, uint32 LastPackedAim, float TimeSinceSent, float Interval, float Threshold, float SettleTime, float RefreshTime);
+
+	/** Expands a shot into the directions of the pellets its weapon fires */
+	void GetPelletDirections(const FFireShot& Shot, TArray<FVector>& OutDirections) const;
+
+	/** Takes the damage of all hits of a tick, on the server. Returns true if health changed */
+	bool ApplyDamage(int32 Damage);
+
+	bool IsDead() const { return health <= 0.f; }
+
+	/** Removes the character and restarts its controller, on the server */
+	void Die(AFirstPersonCharacter* Killer);
+
+	/** Takes a weapon pickup the character stands on, on the server */
+	void PickUp(AWeapon* gun);
+
+	/** Adjusts ticking, animation, shadows and replication to how much the character matters to the players */
+	void SetSignificance(ECharacterSignificance Level);
+
+	/** Returns the third person body, found in BeginPlay **/
+	USkeletalMeshComponent* GetMesh3P() const { return Mesh3P; }
 
 	/** Returns Mesh1P subobject **/
 	USkeletalMeshComponent* GetMesh1P() const { return Mesh1P; }
@@ -112,14 +166,9 @@ public:
 	/** Returns FirstPersonCameraComponent subobject **/
 	UCameraComponent* GetFirstPersonCameraComponent() const { return FirstPersonCameraComponent; }
 
-	//Weapons that the player is carring
-	FGun weapons[MAX_WEAPON_TYPE];
-
-	// Total amount of ammo that can be carried foreach weapon type
-	int maxTotalAmmo[MAX_WEAPON_TYPE] = { 0, 200, 100, 300 };
-
-	// Total amount of ammo being carried foreach weapon type
-	int totalAmmo[MAX_WEAPON_TYPE] = { 0, 20, 10, 30 };
+	/** Weapons and ammo, changed by the server and replicated to the owner only */
+	UPROPERTY(ReplicatedUsing = OnRep_Inventory)
+	FFirstPersonInventory Inventory;
 
 	/** Base turn rate, in deg/sec. Other scaling may affect final turn rate. */
 	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = Mesh)
@@ -133,13 +182,53 @@ public:
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Camera)
 	float BaseLookUpRate;
 
-	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite)
+	/** Aim of the character, replicated to other players through ReplicatedAim */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	FRotator LookRotation;
 
+	/** Minimum time between aim updates sent to the server, in seconds */
+	UPROPERTY(EditDefaultsOnly, Category = Network)
+	float AimSendInterval = 1.f / 30.f;
+
+	/** Minimum aim change, in degrees, before an update is sent before AimSettleTime */
+	UPROPERTY(EditDefaultsOnly, Category = Network)
+	float AimSendThreshold = 0.5f;
+
+	/** Time after which any remaining aim change is sent, in seconds */
+	UPROPERTY(EditDefaultsOnly, Category = Network)
+	float AimSettleTime = 0.25f;
+
+	/** Time after which an unchanged aim is sent again, in case the unreliable update that carried it was lost */
+	UPROPERTY(EditDefaultsOnly, Category = Network)
+	float AimRefreshTime = 1.f;
+
 	/** Gun muzzle's offset from the characters location */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
 	FVector GunOffset;
 
+	/** Range of shots resolved on the server */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
+	float HitscanRange = 20000.f;
+
+	/** Reach and radius of a knife swing, swept on the server */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
+	float MeleeRange = 150.f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
+	float MeleeRadius = 30.f;
+
+	/** Shortest time between two knife swings, the server drops swings that come sooner */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
+	float MeleeSwingInterval = 0.5f;
+
+	/** Number of pellets in a shotgun shell */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = Gameplay)
+	int32 ShotgunPellets = 8;
+
+	/** Half angle of the cone shotgun pellets spread in, in degrees */
+	UPROPERTY(EditDefaultsOnly, BlueprintReadOnly, Category = Gameplay)
+	float ShotgunSpread = 4.f;
+
 	/** Projectile class to spawn */
 	UPROPERTY(EditDefaultsOnly, Category = Projectile)
 	TSubclassOf<class AFirstPersonProjectile> ProjectileClass;
@@ -152,39 +241,91 @@ public:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
 	UAnimMontage* FireAnimation;
 
-	/** Animation state to change each time we crouch */
-	UPROPERTY(Replicated, EditAnywhere, BlueprintReadWrite)
+	/** Animation state to change each time we crouch, follows the movement component's crouch state */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite)
 	bool isCrouched;
 
-	// Weapon index of the player is currently using
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
+	// Weapon index of the player is currently using, follows Inventory.Equipped and is replicated to other players
+	UPROPERTY(ReplicatedUsing = OnRep_EquippedGun, EditAnywhere, BlueprintReadOnly, Category = Gameplay)
 	TEnumAsByte<EWeaponType> EquippedGun = Revolver;
 
-	// Weapon index of the player is cached for switch
-	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = Gameplay)
-	TEnumAsByte<EWeaponType> CachedGun = Melee;
-
 protected:
 	virtual void BeginPlay();
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
+
+	/** Removes or stops the components that are only there to be seen, on the dedicated server */
+	void StripCosmeticComponents();
 
 	// APawn interface
 	virtual void SetupPlayerInputComponent(UInputComponent* InputComponent) override;
 	// End of APawn interface
 
 	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const;
+	virtual void PreReplication(IRepChangedPropertyTracker& ChangedPropertyTracker) override;
 
 	/** Fires a projectile. */
 	void OnFire();
 
 	UFUNCTION(Server, Reliable, WithValidation)
-	void Server_OnFire(FVector Location, FRotator Rotation);
-	bool Server_OnFire_Validate(FVector Location, FRotator Rotation);
-	void Server_OnFire_Implementation(FVector Location, FRotator Rotation);
+	void Server_OnFire(FFireShot Shot);
+	bool Server_OnFire_Validate(FFireShot Shot);
+	void Server_OnFire_Implementation(FFireShot Shot);
 
+	/** Shot sent reliably to every client, when fp.FireRelay.Enabled is 0 */
 	UFUNCTION(NetMulticast, Reliable, WithValidation)
-	void Multi_OnFire(FVector Location, FRotator Rotation);
-	bool Multi_OnFire_Validate(FVector Location, FRotator Rotation);
-	void Multi_OnFire_Implementation(FVector Location, FRotator Rotation);
+	void Multi_OnFire(FFireShot Shot);
+	bool Multi_OnFire_Validate(FFireShot Shot);
+	void Multi_OnFire_Implementation(FFireShot Shot);
+
+	/** Shot recorded in the replay being recorded, sent to no game connection */
+	UFUNCTION(NetMulticast, Unreliable)
+	void Replay_OnFire(FFireShot Shot);
+	void Replay_OnFire_Implementation(FFireShot Shot);
+
+	/** Sends Replay_OnFire to the demo net driver only, and Multi_OnFire to every net driver but it */
+	virtual bool CallRemoteFunction(UFunction* Function, void* Parameters, FOutParmRec* OutParms, FFrame* Stack) override;
+
+	/** Farthest a client's shot may start from the eyes on the server: the muzzle's reach, the ground covered in the longest rewind and fp.Shot.MaxOriginError */
+	float GetMaxShotOriginError() const;
+
+	/** Sends a shot the server fired to the clients, through UFireRelaySubsystem or Multi_OnFire, and to the replay */
+	void BroadcastShot(const FFireShot& Shot);
+
+	/** Confirms a shot to the shooter's client */
+	UFUNCTION(Client, Reliable)
+	void Client_ConfirmShot(FFireShot Shot);
+	void Client_ConfirmShot_Implementation(FFireShot Shot);
+
+	/** Plays the shots of other characters relayed to this client's AFirstPersonPlayerController */
+	static void ReceiveShots(const TArray<FRelayedShots>& Batches);
+
+	/** Fires the projectiles of another character's shot and plays its sound */
+	void SimulateShot(const FFireShot& Shot);
+
+	/** Registers the hits of all pellets of a shot on the server, rewinding the other characters once to what the shooter saw */
+	void ServerResolveShot(const FFireShot& Shot);
+
+	/** Fires a projectile per pellet of a shot, tagged with the shot's seed and started FastForward seconds into their flight */
+	void FireProjectiles(const FFireShot& Shot, int32 Damage, float FastForward);
+
+	void PlayFireSound(const FVector& Location);
+
+	/** Matches the server's shot with the one the local player fired, replacing the predicted projectiles if they differ */
+	void ReconcileShot(const FFireShot& Shot);
+
+	/** Drops shots the server never confirmed, with their predicted projectiles */
+	void ExpirePendingShots();
+
+	/** Swings the knife, the server sweeps in front of the character */
+	void SwingKnife();
+
+	UFUNCTION(Server, Reliable, WithValidation)
+	void Server_SwingKnife();
+	bool Server_SwingKnife_Validate();
+	void Server_SwingKnife_Implementation();
+
+	/** Queues the sweep of a knife swing on the server, hits are registered next frame */
+	void ServerResolveMelee();
 
 	/** Handles moving forward/backward */
 	void MoveForward(float Val);
@@ -195,11 +336,6 @@ protected:
 	void Sprint();
 	void Walk();
 
-	UFUNCTION(Server, Reliable, WithValidation)
-	void Server_SetMaxWalkSpeed(float speed);
-	bool Server_SetMaxWalkSpeed_Validate(float speed);
-	void Server_SetMaxWalkSpeed_Implementation(float speed);
-
 	/**
 	 * Called via input to turn at a given rate.
 	 * @param Rate	This is a normalized rate, i.e. 1.0 means 100% of desired turn rate
@@ -212,18 +348,27 @@ protected:
 	 */
 	void LookUpAtRate(float Rate);
 
-	UFUNCTION(Server, Reliable, WithValidation)
-	void Server_LookUp(FRotator Rotation);
-	bool Server_LookUp_Validate(FRotator Rotation);
-	void Server_LookUp_Implementation(FRotator Rotation);
+	/** Sends the local aim to the server when it changed enough, at most every AimSendInterval */
+	void UpdateAim(float DeltaSeconds);
+
+	UFUNCTION(Server, Unreliable, WithValidation)
+	void Server_UpdateAim(uint32 PackedAim);
+	bool Server_UpdateAim_Validate(uint32 PackedAim);
+	void Server_UpdateAim_Implementation(uint32 PackedAim);
+
+	UFUNCTION()
+	void OnRep_ReplicatedAim();
+
+	UFUNCTION()
+	void OnRep_ReplicatedHealth();
 
 	void StartCrouch();
 	void StopCrouch();
 
-	UFUNCTION(Server, Reliable, WithValidation)
-	void Server_isCrouch(bool val);
-	bool Server_isCrouch_Validate(bool val);
-	void Server_isCrouch_Implementation(bool val);
+	// ACharacter interface
+	virtual void OnStartCrouch(float HalfHeightAdjust, float ScaledHalfHeightAdjust) override;
+	virtual void OnEndCrouch(float HalfHeightAdjust, float ScaledHalfHeightAdjust) override;
+	// End of ACharacter interface
 
 	// Weapon events
 	void OnMelee();
@@ -235,4 +380,32 @@ protected:
 	void OnDropWeapon();
 	void OnEquipWeapon(EWeaponType weapontype);
 
+	UFUNCTION(Server, Reliable, WithValidation)
+	void Server_EquipWeapon(TEnumAsByte<EWeaponType> weapontype);
+	bool Server_EquipWeapon_Validate(TEnumAsByte<EWeaponType> weapontype);
+	void Server_EquipWeapon_Implementation(TEnumAsByte<EWeaponType> weapontype);
+
+	UFUNCTION(Server, Reliable, WithValidation)
+	void Server_Reload();
+	bool Server_Reload_Validate();
+	void Server_Reload_Implementation();
+
+	UFUNCTION()
+	void OnRep_Inventory();
+
+	UFUNCTION()
+	void OnRep_EquippedGun();
+
+	/** Shows the meshes of the equipped gun, loading them if needed */
+	void UpdateGunMeshes();
+
+	/** Puts a weapon's mesh on one of the weapon mesh components */
+	void ShowWeaponMesh(UStaticMeshComponent* Component, const FWeaponMeshSlot& Slot);
+
+	/** Moves the meshes of the per gun static mesh components older blueprints have to the weapon slots, and removes them */
+	void AdoptLegacyGunMeshes(const FCharacterComponentLayout& Layout);
+
+	/** Blueprint components of the class, only set on the class default object */
+	FCharacterComponentLayout ComponentLayout;
+
 };
@@ -3,6 +3,7 @@
 #include "FirstPersonGameMode.h"
 #include "FirstPersonHUD.h"
 #include "FirstPersonCharacter.h"
+#include "FirstPersonPlayerController.h"
 #include "UObject/ConstructorHelpers.h"
 
 AFirstPersonGameMode::AFirstPersonGameMode() : Super()
@@ -13,4 +14,7 @@ AFirstPersonGameMode::AFirstPersonGameMode() : Super()
 
 	// use our custom HUD class
 	HUDClass = AFirstPersonHUD::StaticClass();
+
+	// receives the relayed shots, with or without a character
+	PlayerControllerClass = AFirstPersonPlayerController::StaticClass();
 }
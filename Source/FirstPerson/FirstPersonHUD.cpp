@@ -9,9 +9,13 @@
 
 AFirstPersonHUD::AFirstPersonHUD()
 {
+#if !UE_SERVER
 	// Set the crosshair texture
 	static ConstructorHelpers::FObjectFinder<UTexture2D> CrosshairTexObj(TEXT("/Game/FirstPerson/Textures/FirstPersonCrosshair"));
 	CrosshairTex = CrosshairTexObj.Object;
+#else
+	CrosshairTex = nullptr;
+#endif
 }
 
 
@@ -19,6 +23,8 @@ void AFirstPersonHUD::DrawHUD()
 {
 	Super::DrawHUD();
 
+	if (CrosshairTex == nullptr) return;
+
 	// Draw very simple crosshair
 
 	// find center of the Canvas
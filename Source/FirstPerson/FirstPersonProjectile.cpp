@@ -3,6 +3,15 @@
 #include "FirstPersonProjectile.h"
 #include "GameFramework/ProjectileMovementComponent.h"
 #include "Components/SphereComponent.h"
+#include "DamageQueue.h"
+#include "FireShot.h"
+#include "FirstPersonCharacter.h"
+#include "FirstPersonStats.h"
+#include "ProjectilePool.h"
+#include "TimerManager.h"
+
+DECLARE_CYCLE_STAT(TEXT("Projectile Hit"), STAT_FirstPerson_ProjectileHit, STATGROUP_FirstPerson);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Hits"), STAT_FirstPerson_NumHits, STATGROUP_FirstPerson);
 
 AFirstPersonProjectile::AFirstPersonProjectile() 
 {
@@ -33,11 +42,77 @@ AFirstPersonProjectile::AFirstPersonProjectile()
 
 void AFirstPersonProjectile::OnHit(UPrimitiveComponent* HitComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit)
 {
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(ProjectileHit);
+	FIRSTPERSON_INC_COUNTER(Hits);
+
+	// Damage is dealt by the server's projectile, clients' only bounce
+	AFirstPersonCharacter* Victim = Cast<AFirstPersonCharacter>(OtherActor);
+	const bool bHitCharacter = Victim != nullptr && Victim != GetInstigator();
+	if (bHitCharacter) FFireLatencyStats::Record(EFireLatencyStage::Flight, bPooled ? GetWorldTimerManager().GetTimerElapsed(LifeSpanTimer) : GetGameTimeSinceCreation());
+	if (Damage > 0 && HasAuthority() && bHitCharacter)
+	{
+		GetWorld()->GetSubsystem<UDamageQueueSubsystem>()->AddDamage(Victim, Cast<AFirstPersonCharacter>(GetInstigator()), Damage, Hit.ImpactPoint, Weapon);
+		Expire();
+		return;
+	}
+
 	// Only add impulse and destroy projectile if we hit a physics
-	if ((OtherActor != nullptr) && (OtherActor != this) && (OtherComp != nullptr) && OtherComp->IsSimulatingPhysics())
+	if ((OtherActor != this) && ApplyHitImpulse(OtherActor, OtherComp, GetVelocity(), GetActorLocation()))
 	{
-		OtherComp->AddImpulseAtLocation(GetVelocity() * 100.0f, GetActorLocation());
+		Expire();
+	}
+}
 
-		Destroy();
+bool AFirstPersonProjectile::ApplyHitImpulse(AActor* OtherActor, UPrimitiveComponent* OtherComp, const FVector& Velocity, const FVector& Location)
+{
+	if ((OtherActor != nullptr) && (OtherComp != nullptr) && OtherComp->IsSimulatingPhysics())
+	{
+		OtherComp->AddImpulseAtLocation(Velocity * 100.0f, Location);
+		return true;
 	}
+	return false;
+}
+
+void AFirstPersonProjectile::OnAcquired(const FVector& Location, const FRotator& Rotation)
+{
+	SetActorLocationAndRotation(Location, Rotation, false, nullptr, ETeleportType::ResetPhysics);
+	SetActorHiddenInGame(false);
+	SetActorEnableCollision(true);
+
+	// Restart the movement the same way a freshly spawned projectile starts
+	ProjectileMovement->SetUpdatedComponent(CollisionComp);
+	ProjectileMovement->Velocity = Rotation.Vector() * ProjectileMovement->InitialSpeed;
+	ProjectileMovement->UpdateComponentVelocity();
+	ProjectileMovement->SetComponentTickEnabled(true);
+
+	GetWorldTimerManager().SetTimer(LifeSpanTimer, this, &AFirstPersonProjectile::Expire, InitialLifeSpan);
+}
+
+void AFirstPersonProjectile::OnReleased()
+{
+	GetWorldTimerManager().ClearTimer(LifeSpanTimer);
+	Damage = 0;
+	Weapon = Melee;
+
+	ProjectileMovement->StopMovementImmediately();
+	ProjectileMovement->SetComponentTickEnabled(false);
+
+	SetActorHiddenInGame(true);
+	SetActorEnableCollision(false);
+}
+
+void AFirstPersonProjectile::MakeCosmetic()
+{
+	GetWorldTimerManager().ClearTimer(LifeSpanTimer);
+
+	ProjectileMovement->StopMovementImmediately();
+	ProjectileMovement->SetComponentTickEnabled(false);
+
+	SetActorEnableCollision(false);
+}
+
+void AFirstPersonProjectile::Expire()
+{
+	if (bPooled) GetWorld()->GetSubsystem<UProjectilePoolSubsystem>()->Release(this);
+	else Destroy();
 }
\ No newline at end of file
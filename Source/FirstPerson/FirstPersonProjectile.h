@@ -4,6 +4,7 @@
 
 #include "CoreMinimal.h"
 #include "GameFramework/Actor.h"
+#include "Weapon.h"
 #include "FirstPersonProjectile.generated.h"
 
 class USphereComponent;
@@ -22,6 +23,9 @@ class AFirstPersonProjectile : public AActor
 	UPROPERTY(VisibleAnywhere, BlueprintReadOnly, Category = Movement, meta = (AllowPrivateAccess = "true"))
 	UProjectileMovementComponent* ProjectileMovement;
 
+	/** Ends the flight of pooled projectiles after InitialLifeSpan */
+	FTimerHandle LifeSpanTimer;
+
 public:
 	AFirstPersonProjectile();
 
@@ -29,6 +33,40 @@ public:
 	UFUNCTION()
 	void OnHit(UPrimitiveComponent* HitComp, AActor* OtherActor, UPrimitiveComponent* OtherComp, FVector NormalImpulse, const FHitResult& Hit);
 
+	/** Puts a pooled projectile back in flight from Location */
+	void OnAcquired(const FVector& Location, const FRotator& Rotation);
+
+	/** Stops and hides a pooled projectile */
+	void OnReleased();
+
+	/** Ends the flight, returning the projectile to its pool if it came from one */
+	void Expire();
+
+	/** Turns a flying projectile into a visual moved by UProjectileSimulationSubsystem */
+	void MakeCosmetic();
+
+	/** Pushes a physics object hit by a projectile. Returns true if the projectile should stop. */
+	static bool ApplyHitImpulse(AActor* OtherActor, UPrimitiveComponent* OtherComp, const FVector& Velocity, const FVector& Location);
+
+	/** Set when the projectile is owned by UProjectilePoolSubsystem */
+	bool bPooled = false;
+
+	/** Set while a pooled projectile is in flight, between Acquire and Release */
+	bool bPoolActive = false;
+
+	/** Neighbors in its pool's list of projectiles in flight, oldest first */
+	AFirstPersonProjectile* PoolPrev = nullptr;
+	AFirstPersonProjectile* PoolNext = nullptr;
+
+	/** Incremented each time the pool hands the projectile out, whoever kept an older value no longer owns it */
+	uint32 PoolGeneration = 0;
+
+	/** Damage queued on the server when it hits a character other than its instigator */
+	int32 Damage = 0;
+
+	/** Weapon of the shot that fired it, recorded with its hit */
+	TEnumAsByte<EWeaponType> Weapon = Melee;
+
 	/** Returns CollisionComp subobject **/
 	USphereComponent* GetCollisionComp() const { return CollisionComp; }
 	/** Returns ProjectileMovement subobject **/
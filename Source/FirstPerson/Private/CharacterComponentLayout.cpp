@@ -0,0 +1,121 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CharacterComponentLayout.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonCharacter.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "Components/StaticMeshComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/GameModeBase.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarCacheComponentLayout(
+	TEXT("fp.Character.CacheComponentLayout"),
+	1,
+	TEXT("Resolve the blueprint components of each character class once. 0 looks through every spawned character's components."));
+
+// Indexed by EWeaponView and EWeaponType, melee has no gun
+static const FName LegacyGunNames[int32(EWeaponView::Num)][MAX_WEAPON_TYPE] =
+{
+	{ NAME_None, TEXT("FP_Revolver"), TEXT("FP_Shotgun"), TEXT("FP_Rifle") },
+	{ NAME_None, TEXT("TP_Revolver"), TEXT("TP_Shotgun"), TEXT("TP_Rifle") },
+};
+
+const FCharacterComponentLayout& FCharacterComponentLayout::Get(const AFirstPersonCharacter* Character)
+{
+	// Only read and written on the game thread, as characters begin play
+	FCharacterComponentLayout& Layout = Character->GetClass()->GetDefaultObject<AFirstPersonCharacter>()->ComponentLayout;
+	if (!Layout.bResolved || CVarCacheComponentLayout.GetValueOnGameThread() == 0)
+	{
+		Layout = Resolve(Character);
+	}
+	return Layout;
+}
+
+FCharacterComponentLayout FCharacterComponentLayout::Resolve(const AFirstPersonCharacter* Character)
+{
+	FCharacterComponentLayout Layout;
+	Layout.bResolved = true;
+
+	const FName Mesh3PName = Character->TP_MeshName.IsEmpty() ? NAME_None : FName(*Character->TP_MeshName);
+
+	TInlineComponentArray<UActorComponent*> Components(Character);
+	for (const UActorComponent* Component : Components)
+	{
+		const FName Name = Component->GetFName();
+		if (Name == Mesh3PName && Component->IsA<USkeletalMeshComponent>())
+		{
+			Layout.Mesh3P = Name;
+			continue;
+		}
+
+		if (!Component->IsA<UStaticMeshComponent>()) continue;
+		for (int32 View = 0; View < int32(EWeaponView::Num); View++)
+		{
+			for (int32 i = 0; i < MAX_WEAPON_TYPE; i++)
+			{
+				if (Name == LegacyGunNames[View][i] && Name != NAME_None) Layout.LegacyGuns[View][i] = Name;
+			}
+		}
+	}
+
+	return Layout;
+}
+
+// Spawns rows of characters without controllers in one frame, as a server respawning a full
+// match would, and destroys them again between rounds. Run it headless on a dedicated server
+// (-server -nullrhi), where spawning a character is mostly creating and registering components.
+static FAutoConsoleCommand SpawnBenchmarkCommand(
+	TEXT("fp.Bench.Spawn"),
+	TEXT("Reports characters spawned per second, with the component layout cached per class and resolved per character. Usage: fp.Bench.Spawn [Characters=256] [Rounds=5]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		const AGameModeBase* GameMode = World != nullptr ? World->GetAuthGameMode() : nullptr;
+		if (GameMode == nullptr || GameMode->DefaultPawnClass == nullptr) return;
+
+		const int32 NumCharacters = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 256, 1);
+		const int32 NumRounds = FMath::Max(Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 5, 1);
+		const int32 PreviousCache = CVarCacheComponentLayout.GetValueOnGameThread();
+
+		FActorSpawnParameters SpawnParams;
+		SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+		UE_LOG(LogFPBench, Display, TEXT("Character spawns: %d characters, %d rounds per mode"), NumCharacters, NumRounds);
+
+		for (int32 Cache = 1; Cache >= 0; Cache--)
+		{
+			CVarCacheComponentLayout->Set(Cache);
+
+			double Seconds = 0.0, BestSeconds = DBL_MAX;
+			for (int32 Round = 0; Round < NumRounds; Round++)
+			{
+				TArray<AActor*> Characters;
+				Characters.Reserve(NumCharacters);
+
+				const double Start = FPlatformTime::Seconds();
+				for (int32 i = 0; i < NumCharacters; i++)
+				{
+					const FVector Location(500.f + (i / 16) * 300.f, (i % 16 - 7.5f) * 300.f, 200.f);
+					Characters.Add(World->SpawnActor<AFirstPersonCharacter>(GameMode->DefaultPawnClass, Location, FRotator::ZeroRotator, SpawnParams));
+				}
+				const double RoundSeconds = FPlatformTime::Seconds() - Start;
+				Seconds += RoundSeconds;
+				BestSeconds = FMath::Min(BestSeconds, RoundSeconds);
+
+				for (AActor* Character : Characters)
+				{
+					if (Character != nullptr) Character->Destroy();
+				}
+
+				// Each round starts from the same memory state
+				CollectGarbage(GARBAGE_COLLECTION_KEEPFLAGS);
+			}
+
+			UE_LOG(LogFPBench, Display, TEXT("  %s: %.0f characters/s avg, %.0f best, %.1f us per character"),
+				Cache ? TEXT("cached per class") : TEXT("resolved per character"), NumCharacters * NumRounds / Seconds, NumCharacters / BestSeconds,
+				Seconds * 1000000.0 / (NumCharacters * NumRounds));
+		}
+
+		CVarCacheComponentLayout->Set(PreviousCache);
+	}));
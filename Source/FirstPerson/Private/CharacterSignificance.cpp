@@ -0,0 +1,230 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "CharacterSignificance.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonCharacter.h"
+#include "SignificanceManager.h"
+#include "Components/SkeletalMeshComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/GameModeBase.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarSignificance(
+	TEXT("fp.Significance.Enabled"),
+	1,
+	TEXT("Throttle characters by their significance to the players. Read when a character begins play."));
+
+static TAutoConsoleVariable<int32> CVarSignificanceForceLevel(
+	TEXT("fp.Significance.ForceLevel"),
+	-1,
+	TEXT("Puts every character at one significance level, 0 hidden to 3 high. -1 scores them."));
+
+static TAutoConsoleVariable<float> CVarNearDistance(
+	TEXT("fp.Significance.NearDistance"),
+	1500.f,
+	TEXT("Distance within which characters are fully updated whichever way the player looks."));
+
+static TAutoConsoleVariable<float> CVarFarDistance(
+	TEXT("fp.Significance.FarDistance"),
+	6000.f,
+	TEXT("Distance beyond which characters in view are at low significance."));
+
+static const FName CharacterTag(TEXT("Character"));
+
+// Indexed by ECharacterSignificance
+static const FCharacterSignificanceSettings SignificanceSettings[] =
+{
+	{ 0.25f, 7, 0.1f, false },
+	{ 0.1f, 3, 0.25f, false },
+	{ 1.f / 30.f, 1, 0.5f, true },
+	{ 0.f, 0, 1.f, true },
+};
+static_assert(UE_ARRAY_COUNT(SignificanceSettings) == int32(ECharacterSignificance::Num), "One entry per significance level");
+
+const FCharacterSignificanceSettings& UCharacterSignificanceSubsystem::GetSettings(ECharacterSignificance Level)
+{
+	return SignificanceSettings[FMath::Clamp(int32(Level), 0, int32(ECharacterSignificance::Num) - 1)];
+}
+
+ECharacterSignificance UCharacterSignificanceSubsystem::Evaluate(const AFirstPersonCharacter* Character, const FTransform& Viewpoint)
+{
+	// Called from worker threads by the significance manager
+	const int32 ForcedLevel = CVarSignificanceForceLevel.GetValueOnAnyThread();
+	if (ForcedLevel >= 0) return ECharacterSignificance(FMath::Min(ForcedLevel, int32(ECharacterSignificance::High)));
+
+	if (Character->IsLocallyControlled()) return ECharacterSignificance::High;
+
+	const FVector ToCharacter = Character->GetActorLocation() - Viewpoint.GetLocation();
+	const float DistanceSquared = ToCharacter.SizeSquared();
+	if (DistanceSquared <= FMath::Square(CVarNearDistance.GetValueOnAnyThread())) return ECharacterSignificance::High;
+
+	// Within 60 degrees of the view direction, wider than the screen to cover turning
+	if (FVector::DotProduct(ToCharacter.GetSafeNormal(), Viewpoint.GetRotation().GetForwardVector()) < 0.5f) return ECharacterSignificance::Hidden;
+
+	return DistanceSquared <= FMath::Square(CVarFarDistance.GetValueOnAnyThread()) ? ECharacterSignificance::Medium : ECharacterSignificance::Low;
+}
+
+void UCharacterSignificanceSubsystem::Deinitialize()
+{
+	NumCharacters = 0;
+
+	Super::Deinitialize();
+}
+
+ETickableTickType UCharacterSignificanceSubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool UCharacterSignificanceSubsystem::IsTickable() const
+{
+	return NumCharacters > 0;
+}
+
+TStatId UCharacterSignificanceSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UCharacterSignificanceSubsystem, STATGROUP_Tickables);
+}
+
+void UCharacterSignificanceSubsystem::RegisterCharacter(AFirstPersonCharacter* Character)
+{
+	USignificanceManager* Manager = USignificanceManager::Get(GetWorld());
+	if (Manager == nullptr || CVarSignificance.GetValueOnGameThread() == 0) return;
+
+	// Levels are applied on the game thread once all characters are scored
+	Manager->RegisterObject(Character, CharacterTag,
+		[](USignificanceManager::FManagedObjectInfo* Info, const FTransform& Viewpoint)
+		{
+			return float(Evaluate(CastChecked<AFirstPersonCharacter>(Info->GetObject()), Viewpoint));
+		},
+		USignificanceManager::EPostSignificanceType::Sequential,
+		[](USignificanceManager::FManagedObjectInfo* Info, float OldSignificance, float Significance, bool bFinal)
+		{
+			CastChecked<AFirstPersonCharacter>(Info->GetObject())->SetSignificance(ECharacterSignificance(int32(Significance)));
+		});
+	NumCharacters++;
+}
+
+void UCharacterSignificanceSubsystem::UnregisterCharacter(AFirstPersonCharacter* Character)
+{
+	USignificanceManager* Manager = USignificanceManager::Get(GetWorld());
+	if (Manager == nullptr || Manager->GetManagedObject(Character) == nullptr) return;
+
+	Manager->UnregisterObject(Character);
+	NumCharacters--;
+}
+
+void UCharacterSignificanceSubsystem::Tick(float DeltaTime)
+{
+	USignificanceManager* Manager = USignificanceManager::Get(GetWorld());
+	if (Manager == nullptr) return;
+
+	// Local players on clients, every player on the server; the highest level of all counts
+	Viewpoints.Reset();
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		const APlayerController* Controller = It->Get();
+		if (Controller == nullptr) continue;
+
+		FVector Location;
+		FRotator Rotation;
+		Controller->GetPlayerViewPoint(Location, Rotation);
+		Viewpoints.Add(FTransform(Rotation, Location));
+	}
+
+	Manager->Update(Viewpoints);
+}
+
+// Spawns characters without controllers in front of the origin, as a client sees remote players,
+// and measures them with every character forced to each significance level in turn. Animation
+// only runs where something could be rendered: run it in a headless game (-game -nullrhi), not
+// on a dedicated server.
+static FAutoConsoleCommand SignificanceBenchmarkCommand(
+	TEXT("fp.Bench.Significance"),
+	TEXT("Reports frame time and animation updates per character at each significance level. Usage: fp.Bench.Significance [Characters=64] [Frames=300]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		const AGameModeBase* GameMode = World != nullptr ? World->GetAuthGameMode() : nullptr;
+		if (GameMode == nullptr || GameMode->DefaultPawnClass == nullptr) return;
+
+		const int32 NumCharacters = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 64, 1);
+		const int32 NumFrames = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 300;
+		const int32 PreviousForceLevel = CVarSignificanceForceLevel.GetValueOnGameThread();
+		TWeakObjectPtr<UWorld> WeakWorld = World;
+		TSubclassOf<APawn> PawnClass = GameMode->DefaultPawnClass;
+
+		TSharedRef<TArray<TWeakObjectPtr<AFirstPersonCharacter>>> Characters = MakeShared<TArray<TWeakObjectPtr<AFirstPersonCharacter>>>();
+		TSharedRef<int64> PoseUpdates = MakeShared<int64>(0);
+		TSharedRef<double> EmptyMs = MakeShared<double>(0.0);
+
+		// Counts the frames each body's pose was ticked in since the previous call
+		TSharedRef<TArray<uint32>> LastPoseTickFrames = MakeShared<TArray<uint32>>();
+		auto CountPoseUpdates = [=](float DeltaSeconds)
+		{
+			LastPoseTickFrames->SetNumZeroed(Characters->Num());
+			for (int32 i = 0; i < Characters->Num(); i++)
+			{
+				const USkeletalMeshComponent* Mesh = (*Characters)[i].IsValid() ? (*Characters)[i]->GetMesh3P() : nullptr;
+				if (Mesh == nullptr) continue;
+
+				if (Mesh->LastPoseTickFrame != (*LastPoseTickFrames)[i]) (*PoseUpdates)++;
+				(*LastPoseTickFrames)[i] = Mesh->LastPoseTickFrame;
+			}
+		};
+
+		// Highest level first, then down to hidden. Each level's callback keeps the function alive for the next one
+		TSharedRef<TFunction<void(int32)>> RunLevel = MakeShared<TFunction<void(int32)>>();
+		TWeakPtr<TFunction<void(int32)>> WeakRunLevel = RunLevel;
+		*RunLevel = [=](int32 Level)
+		{
+			if (Level < 0)
+			{
+				for (const TWeakObjectPtr<AFirstPersonCharacter>& Character : *Characters)
+				{
+					if (Character.IsValid()) Character->Destroy();
+				}
+				CVarSignificanceForceLevel->Set(PreviousForceLevel);
+				return;
+			}
+
+			TSharedPtr<TFunction<void(int32)>> NextLevel = WeakRunLevel.Pin();
+			CVarSignificanceForceLevel->Set(Level);
+			*PoseUpdates = 0;
+			FirstPersonBenchmark::RunFrames(NumFrames, CountPoseUpdates, [=](const FirstPersonBenchmark::FFrameStats& Stats)
+			{
+				static const TCHAR* LevelNames[] = { TEXT("Hidden"), TEXT("Low"), TEXT("Medium"), TEXT("High") };
+				UE_LOG(LogFPBench, Display, TEXT("  %s: frame %.3f ms avg, %.2f us per character, %.2f animation updates per character per frame"),
+					LevelNames[Level], Stats.AverageMs(), (Stats.AverageMs() - *EmptyMs) * 1000.0 / NumCharacters,
+					double(*PoseUpdates) / (FMath::Max(Stats.Frames, 1) * NumCharacters));
+				(*NextLevel)(Level - 1);
+			});
+		};
+
+		UE_LOG(LogFPBench, Display, TEXT("Character significance: %d characters over %d frames per level"), NumCharacters, NumFrames);
+
+		// The frame without the characters, subtracted to get their own cost
+		FirstPersonBenchmark::RunFrames(NumFrames, [](float) {}, [=](const FirstPersonBenchmark::FFrameStats& EmptyStats)
+		{
+			UWorld* BenchWorld = WeakWorld.Get();
+			if (BenchWorld == nullptr) return;
+
+			*EmptyMs = EmptyStats.AverageMs();
+			UE_LOG(LogFPBench, Display, TEXT("  No characters: frame %.3f ms avg"), *EmptyMs);
+
+			// Rows of characters spreading out from 5 m to well past the far distance, all facing +X
+			FActorSpawnParameters SpawnParams;
+			SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+			for (int32 i = 0; i < NumCharacters; i++)
+			{
+				const FVector Location(500.f + (i / 8) * 1000.f, (i % 8 - 3.5f) * 300.f, 200.f);
+				if (AFirstPersonCharacter* Character = BenchWorld->SpawnActor<AFirstPersonCharacter>(PawnClass, Location, FRotator::ZeroRotator, SpawnParams))
+				{
+					Characters->Add(Character);
+				}
+			}
+
+			(*RunLevel)(int32(ECharacterSignificance::High));
+		});
+	}));
@@ -0,0 +1,112 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "DamageQueue.h"
+#include "FirstPersonCharacter.h"
+#include "Telemetry.h"
+#include "Engine/World.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarProjectileDamage(
+	TEXT("fp.Damage.FromProjectiles"),
+	0,
+	TEXT("Projectile hits deal the damage on the server instead of the lag compensated hitscan of the shot."));
+
+static FAutoConsoleCommand DamageStatsCommand(
+	TEXT("fp.Damage.Stats"),
+	TEXT("Prints queued hits against the health changes they were coalesced into. Usage: fp.Damage.Stats [reset]"),
+	FConsoleCommandWithWorldArgsAndOutputDeviceDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World, FOutputDevice& Ar)
+	{
+		UDamageQueueSubsystem* Queue = World != nullptr ? World->GetSubsystem<UDamageQueueSubsystem>() : nullptr;
+		if (Queue == nullptr) return;
+
+		if (Args.Num() > 0 && Args[0] == TEXT("reset"))
+		{
+			Queue->NumEvents = Queue->NumHealthChanges = Queue->NumDeaths = 0;
+			return;
+		}
+		Ar.Logf(TEXT("Damage: %lld hits, %lld health changes (%.2f hits each), %lld deaths"),
+			Queue->NumEvents, Queue->NumHealthChanges, Queue->NumHealthChanges > 0 ? double(Queue->NumEvents) / Queue->NumHealthChanges : 0.0, Queue->NumDeaths);
+	}));
+
+bool UDamageQueueSubsystem::ProjectilesDealDamage()
+{
+	return CVarProjectileDamage.GetValueOnGameThread() != 0;
+}
+
+void UDamageQueueSubsystem::Deinitialize()
+{
+	Events.Reset();
+
+	Super::Deinitialize();
+}
+
+ETickableTickType UDamageQueueSubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool UDamageQueueSubsystem::IsTickable() const
+{
+	return Events.Num() > 0;
+}
+
+TStatId UDamageQueueSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UDamageQueueSubsystem, STATGROUP_Tickables);
+}
+
+void UDamageQueueSubsystem::Tick(float DeltaTime)
+{
+	Flush();
+}
+
+void UDamageQueueSubsystem::AddDamage(AFirstPersonCharacter* Victim, AFirstPersonCharacter* Instigator, int32 Damage, const FVector& Location, uint8 Weapon)
+{
+	if (Victim == nullptr || Damage <= 0 || !Victim->HasAuthority()) return;
+
+	Events.Add(FQueuedDamageEvent{ Victim, Instigator, Damage });
+	FGameplayTelemetry::Record(ETelemetryEvent::Hit, FGameplayTelemetry::GetSubjectId(Instigator), FGameplayTelemetry::GetSubjectId(Victim), Location, Weapon, int16(Damage));
+}
+
+void UDamageQueueSubsystem::Flush()
+{
+	NumEvents += Events.Num();
+
+	// Add up the hits of each victim, in the order they first got hit
+	for (const FQueuedDamageEvent& Event : Events)
+	{
+		AFirstPersonCharacter* Victim = Event.Victim.Get();
+		if (Victim == nullptr) continue;
+
+		if (const int32* Index = CoalescedIndex.Find(Victim))
+		{
+			FCoalescedDamage& Damage = Coalesced[*Index];
+			Damage.Damage += Event.Damage;
+			if (Event.Instigator.IsValid()) Damage.Instigator = Event.Instigator.Get();
+		}
+		else
+		{
+			CoalescedIndex.Add(Victim, Coalesced.Num());
+			Coalesced.Add(FCoalescedDamage{ Victim, Event.Instigator.Get(), Event.Damage });
+		}
+	}
+	Events.Reset();
+
+	// Deaths come last, a victim killed here may still be the instigator of someone else's damage
+	for (const FCoalescedDamage& Damage : Coalesced)
+	{
+		if (Damage.Victim->ApplyDamage(Damage.Damage)) NumHealthChanges++;
+	}
+	for (const FCoalescedDamage& Damage : Coalesced)
+	{
+		if (Damage.Victim->IsDead() && !Damage.Victim->IsPendingKillPending())
+		{
+			Damage.Victim->Die(Damage.Instigator);
+			NumDeaths++;
+		}
+	}
+
+	Coalesced.Reset();
+	CoalescedIndex.Reset();
+}
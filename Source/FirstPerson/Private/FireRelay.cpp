@@ -0,0 +1,163 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FireRelay.h"
+#include "FirstPersonCharacter.h"
+#include "FirstPersonPlayerController.h"
+#include "NetStats.h"
+#include "Camera/PlayerCameraManager.h"
+#include "Engine/NetConnection.h"
+#include "Engine/NetDriver.h"
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+
+static TAutoConsoleVariable<int32> CVarFireRelay(
+	TEXT("fp.FireRelay.Enabled"),
+	1,
+	TEXT("Send shots to the clients that can see or hear them, unreliable and batched. 0 multicasts every shot reliably to everyone."));
+
+static TAutoConsoleVariable<float> CVarAudibleDistance(
+	TEXT("fp.FireRelay.AudibleDistance"),
+	8000.f,
+	TEXT("Distance within which a shot is heard, and relayed whichever way the player looks."));
+
+static FAutoConsoleCommand FireRelayStatsCommand(
+	TEXT("fp.FireRelay.Stats"),
+	TEXT("Prints the shots relayed against the deliveries culled. Usage: fp.FireRelay.Stats [reset]"),
+	FConsoleCommandWithWorldArgsAndOutputDeviceDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World, FOutputDevice& Ar)
+	{
+		UFireRelaySubsystem* Relay = World != nullptr ? World->GetSubsystem<UFireRelaySubsystem>() : nullptr;
+		if (Relay == nullptr) return;
+
+		if (Args.Num() > 0 && Args[0] == TEXT("reset"))
+		{
+			Relay->NumShots = Relay->NumDelivered = Relay->NumCulled = Relay->NumRPCs = 0;
+			return;
+		}
+		Ar.Logf(TEXT("Fire relay: %lld shots, %lld delivered, %lld culled (%.1f%%), %lld RPCs (%.2f shots each)"),
+			Relay->NumShots, Relay->NumDelivered, Relay->NumCulled,
+			Relay->NumDelivered + Relay->NumCulled > 0 ? 100.0 * Relay->NumCulled / (Relay->NumDelivered + Relay->NumCulled) : 0.0,
+			Relay->NumRPCs, Relay->NumRPCs > 0 ? double(Relay->NumDelivered) / Relay->NumRPCs : 0.0);
+	}));
+
+bool UFireRelaySubsystem::IsEnabled()
+{
+	return CVarFireRelay.GetValueOnGameThread() != 0;
+}
+
+void UFireRelaySubsystem::Deinitialize()
+{
+	Queued.Reset();
+	QueuedIndex.Reset();
+
+	Super::Deinitialize();
+}
+
+ETickableTickType UFireRelaySubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool UFireRelaySubsystem::IsTickable() const
+{
+	return Queued.Num() > 0;
+}
+
+TStatId UFireRelaySubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UFireRelaySubsystem, STATGROUP_Tickables);
+}
+
+void UFireRelaySubsystem::Tick(float DeltaTime)
+{
+	Flush();
+}
+
+void UFireRelaySubsystem::QueueShot(AFirstPersonCharacter* Shooter, const FFireShot& Shot)
+{
+	if (Shooter == nullptr || !Shooter->HasAuthority()) return;
+
+	NumShots++;
+	if (const int32* Index = QueuedIndex.Find(Shooter))
+	{
+		Queued[*Index].Shots.Add(Shot);
+	}
+	else
+	{
+		QueuedIndex.Add(Shooter, Queued.Num());
+		FRelayedShots& Shots = Queued.AddDefaulted_GetRef();
+		Shots.Shooter = Shooter;
+		Shots.Shots.Add(Shot);
+	}
+}
+
+bool UFireRelaySubsystem::IsAudibleOrVisible(UNetConnection* Connection, const AFirstPersonCharacter* Shooter, const FVector& ViewLocation, const FVector& ViewDirection, float CosViewAngle) const
+{
+	// Shooters that aren't relevant to the connection can't be referenced there, and are too far to matter
+	if (Connection->FindActorChannelRef(Shooter) == nullptr) return false;
+
+	const FVector ToShooter = Shooter->GetActorLocation() - ViewLocation;
+	const float AudibleDistance = CVarAudibleDistance.GetValueOnGameThread();
+	if (ToShooter.SizeSquared() <= FMath::Square(AudibleDistance)) return true;
+
+	return FVector::DotProduct(ToShooter.GetSafeNormal(), ViewDirection) >= CosViewAngle;
+}
+
+void UFireRelaySubsystem::Flush()
+{
+	const UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	if (NetDriver != nullptr)
+	{
+		for (UNetConnection* Connection : NetDriver->ClientConnections)
+		{
+			// Dead and spectating players have no pawn but still a view point
+			AFirstPersonPlayerController* Controller = Cast<AFirstPersonPlayerController>(Connection->PlayerController);
+			if (Controller == nullptr) continue;
+			const APawn* Receiver = Controller->GetPawn();
+
+			FVector ViewLocation;
+			FRotator ViewRotation;
+			Controller->GetPlayerViewPoint(ViewLocation, ViewRotation);
+
+			// Projectiles fly into view from the sides, give the view cone some margin
+			const float FOV = Controller->PlayerCameraManager != nullptr ? Controller->PlayerCameraManager->GetFOVAngle() : 90.f;
+			const float CosViewAngle = FMath::Cos(FMath::DegreesToRadians(FMath::Min(FOV * 0.5f + 20.f, 180.f)));
+
+			Batch.Reset();
+			const bool bMeasure = FFirstPersonNetStats::IsEnabled();
+			int64 Bits = 0;
+			int32 NumShotsInBatch = 0;
+			for (const FRelayedShots& Shots : Queued)
+			{
+				// The shooter's own client confirms its shots reliably
+				if (!IsValid(Shots.Shooter) || Shots.Shooter == Receiver) continue;
+
+				if (!IsAudibleOrVisible(Connection, Shots.Shooter, ViewLocation, ViewRotation.Vector(), CosViewAngle))
+				{
+					NumCulled += Shots.Shots.Num();
+					continue;
+				}
+
+				Batch.Add(Shots);
+				NumShotsInBatch += Shots.Shots.Num();
+
+				// Shooter as a NetGUID and the shot count, then the shots
+				if (!bMeasure) continue;
+				Bits += 32 + 8;
+				for (const FFireShot& Shot : Shots.Shots) Bits += FFirstPersonNetStats::MeasureBits(Shot);
+			}
+
+			if (Batch.Num() == 0) continue;
+
+			NumDelivered += NumShotsInBatch;
+			NumRPCs++;
+			FFirstPersonNetStats::RecordRPCSize(Controller, GET_FUNCTION_NAME_CHECKED(AFirstPersonPlayerController, Client_ReceiveShots), Bits + 8);
+			Controller->Client_ReceiveShots(Batch);
+		}
+	}
+
+	Queued.Reset();
+	QueuedIndex.Reset();
+	Batch.Reset();
+}
@@ -0,0 +1,250 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FireShot.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonCharacter.h"
+#include "LagCompensation.h"
+#include "NetStats.h"
+#include "Async/Async.h"
+#include "Engine/NetSerialization.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "Misc/CoreDelegates.h"
+#include "Misc/Crc.h"
+#include "RenderingThread.h"
+
+FRotator FFireShot::GetRotation() const
+{
+	return AFirstPersonCharacter::UnpackAim(PackedAim);
+}
+
+void FFireShot::SetMuzzle(const FVector& InLocation, const FRotator& InRotation)
+{
+	Location.X = FMath::RoundToFloat(InLocation.X * 10.f) / 10.f;
+	Location.Y = FMath::RoundToFloat(InLocation.Y * 10.f) / 10.f;
+	Location.Z = FMath::RoundToFloat(InLocation.Z * 10.f) / 10.f;
+	PackedAim = AFirstPersonCharacter::PackAim(InRotation);
+}
+
+void FFireShot::GetPelletDirections(int32 NumPellets, float SpreadDegrees, TArray<FVector>& OutDirections) const
+{
+	const FVector Aim = GetRotation().Vector();
+	if (SpreadDegrees <= 0.f)
+	{
+		OutDirections.Init(Aim, NumPellets);
+		return;
+	}
+
+	// Sequence numbers are hashed, consecutive seeds would give similar patterns
+	FRandomStream Stream(int32(FCrc::MemCrc32(&Seed, sizeof(Seed))));
+	const float HalfAngle = FMath::DegreesToRadians(SpreadDegrees);
+
+	OutDirections.Reset(NumPellets);
+	for (int32 i = 0; i < NumPellets; i++) OutDirections.Add(Stream.VRandCone(Aim, HalfAngle));
+}
+
+bool FFireShot::NetSerialize(FArchive& Ar, UPackageMap* Map, bool& bOutSuccess)
+{
+	bOutSuccess = SerializePackedVector<10, 24>(Location, Ar);
+	Ar << PackedAim;
+	Ar << Seed;
+	Ar << Timestamp;
+
+	uint32 WeaponIndex = Weapon;
+	Ar.SerializeInt(WeaponIndex, MAX_WEAPON_TYPE);
+	if (Ar.IsLoading()) Weapon = EWeaponType(WeaponIndex);
+
+	return true;
+}
+
+// Tenth of a millisecond buckets up to 10 ms, then millisecond buckets up to a second, then one for anything longer
+static const int32 NumFineBuckets = 100;
+static const int32 NumLatencyBuckets = NumFineBuckets + 990 + 1;
+
+static int32 GetLatencyBucket(double Ms)
+{
+	if (Ms < 10.0) return FMath::Max(int32(Ms * 10.0), 0);
+	return FMath::Min(NumFineBuckets + int32(Ms) - 10, NumLatencyBuckets - 1);
+}
+
+// Upper bound of a bucket, in milliseconds
+static double GetLatencyBucketMs(int32 Bucket)
+{
+	return Bucket < NumFineBuckets ? (Bucket + 1) * 0.1 : double(Bucket - NumFineBuckets + 11);
+}
+
+struct FLatencyHistogram
+{
+	uint32 Buckets[NumLatencyBuckets] = {};
+	int64 NumSamples = 0;
+	double MaxSeconds = 0.0;
+};
+
+static FLatencyHistogram LatencyHistograms[int32(EFireLatencyStage::Num)];
+
+void FFireLatencyStats::Record(EFireLatencyStage Stage, double Seconds)
+{
+	FLatencyHistogram& Histogram = LatencyHistograms[int32(Stage)];
+	Histogram.Buckets[GetLatencyBucket(Seconds * 1000.0)]++;
+	Histogram.NumSamples++;
+	Histogram.MaxSeconds = FMath::Max(Histogram.MaxSeconds, Seconds);
+}
+
+// Samples of this frame, waiting for it to be rendered
+static TArray<TPair<EFireLatencyStage, double>> OnScreenSamples;
+static FDelegateHandle OnScreenEndFrameHandle;
+
+void FFireLatencyStats::RecordOnScreen(EFireLatencyStage Stage, double StartTime)
+{
+	OnScreenSamples.Emplace(Stage, StartTime);
+	if (OnScreenEndFrameHandle.IsValid()) return;
+
+	// By the end of the frame its scene rendering is queued, a command queued then runs once it is rendered
+	OnScreenEndFrameHandle = FCoreDelegates::OnEndFrame.AddLambda([]()
+	{
+		FCoreDelegates::OnEndFrame.Remove(OnScreenEndFrameHandle);
+		OnScreenEndFrameHandle.Reset();
+
+		ENQUEUE_RENDER_COMMAND(FireLatencyOnScreen)([Samples = MoveTemp(OnScreenSamples)](FRHICommandListImmediate&)
+		{
+			// The histograms belong to the game thread
+			const double RenderedTime = FPlatformTime::Seconds();
+			AsyncTask(ENamedThreads::GameThread, [Samples, RenderedTime]()
+			{
+				for (const TPair<EFireLatencyStage, double>& Sample : Samples) Record(Sample.Key, RenderedTime - Sample.Value);
+			});
+		});
+		OnScreenSamples.Reset();
+	});
+}
+
+void FFireLatencyStats::Reset()
+{
+	for (FLatencyHistogram& Histogram : LatencyHistograms) Histogram = FLatencyHistogram();
+}
+
+int64 FFireLatencyStats::GetNumSamples(EFireLatencyStage Stage)
+{
+	return LatencyHistograms[int32(Stage)].NumSamples;
+}
+
+double FFireLatencyStats::GetPercentile(EFireLatencyStage Stage, float Percentile)
+{
+	const FLatencyHistogram& Histogram = LatencyHistograms[int32(Stage)];
+	if (Histogram.NumSamples == 0) return 0.0;
+
+	// The overflow bucket has no upper bound, the maximum is the closest there is
+	const int64 Rank = FMath::Max<int64>(int64(FMath::CeilToDouble(Histogram.NumSamples * FMath::Clamp(Percentile, 0.f, 100.f) / 100.0)), 1);
+	int64 Count = 0;
+	for (int32 Bucket = 0; Bucket < NumLatencyBuckets - 1; Bucket++)
+	{
+		Count += Histogram.Buckets[Bucket];
+		if (Count >= Rank) return FMath::Min(GetLatencyBucketMs(Bucket) / 1000.0, Histogram.MaxSeconds);
+	}
+	return Histogram.MaxSeconds;
+}
+
+void FFireLatencyStats::Dump(FOutputDevice& Ar)
+{
+	static const TCHAR* StageNames[] = { TEXT("Input"), TEXT("ToServer"), TEXT("ToRemote"), TEXT("ShooterEffect"), TEXT("Confirm"), TEXT("Flight") };
+	static_assert(UE_ARRAY_COUNT(StageNames) == int32(EFireLatencyStage::Num), "One name per stage");
+
+	Ar.Logf(TEXT("Fire latency (%s):"), IsRunningDedicatedServer() ? TEXT("server") : TEXT("client"));
+	for (int32 i = 0; i < int32(EFireLatencyStage::Num); i++)
+	{
+		const EFireLatencyStage Stage = EFireLatencyStage(i);
+		if (GetNumSamples(Stage) == 0) continue;
+
+		Ar.Logf(TEXT("  %s: %lld samples, p50 %.1f ms, p95 %.1f ms, p99 %.1f ms, max %.1f ms"), StageNames[i], GetNumSamples(Stage),
+			GetPercentile(Stage, 50.f) * 1000.0, GetPercentile(Stage, 95.f) * 1000.0, GetPercentile(Stage, 99.f) * 1000.0, LatencyHistograms[i].MaxSeconds * 1000.0);
+	}
+}
+
+static FAutoConsoleCommand FireLatencyCommand(
+	TEXT("fp.FireLatency"),
+	TEXT("Prints the latency percentiles of each stage of the shots seen on this machine. Usage: fp.FireLatency [reset]"),
+	FConsoleCommandWithArgsAndOutputDeviceDelegate::CreateLambda([](const TArray<FString>& Args, FOutputDevice& Ar)
+	{
+		if (Args.Num() > 0 && Args[0] == TEXT("reset")) FFireLatencyStats::Reset();
+		else FFireLatencyStats::Dump(Ar);
+	}));
+
+// Compares the bits of a shot sent as one FFireShot against one Server_OnFire(FVector, FRotator) per
+// pellet, and the server cost of tracing the pellets one by one against tracing them as a batch
+static FAutoConsoleCommand FireShotBenchmarkCommand(
+	TEXT("fp.Bench.FireShot"),
+	TEXT("Reports bytes per shot and pellet trace cost. Usage: fp.Bench.FireShot [Shots=10000] [Pawns=64]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const int32 NumShots = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 10000, 1);
+		const int32 NumPawns = FMath::Clamp(Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 64, 1, ULagCompensationSubsystem::MaxCharacters);
+		const AFirstPersonCharacter* Defaults = GetDefault<AFirstPersonCharacter>();
+		const float TickRate = 1.f / 60.f;
+
+		FRandomStream Random(42);
+		FPoseHistory History;
+		History.Init(ULagCompensationSubsystem::MaxCharacters, ULagCompensationSubsystem::MaxFrames);
+
+		TArray<FVector> Positions;
+		for (int32 i = 0; i < NumPawns; i++)
+		{
+			History.AddSlot();
+			Positions.Add(FVector(Random.FRandRange(-5000.f, 5000.f), Random.FRandRange(-5000.f, 5000.f), 96.f));
+		}
+
+		float Time = 0.f;
+		for (int32 Frame = 0; Frame < ULagCompensationSubsystem::MaxFrames; Frame++, Time += TickRate)
+		{
+			History.BeginFrame(Time);
+			for (int32 i = 0; i < NumPawns; i++) History.SetPose(i, Positions[i], 55.f, 96.f);
+		}
+
+		int64 LegacyBits = 0, ShotBits = 0;
+		int32 SingleHits = 0, BatchHits = 0;
+		double SingleSeconds = 0.0, BatchSeconds = 0.0;
+		TArray<FVector> Directions, Ends, HitLocations;
+		TArray<int32> Slots;
+
+		for (int32 Shot = 0; Shot < NumShots; Shot++)
+		{
+			const int32 Shooter = Random.RandHelper(NumPawns);
+			const FVector Aim = Positions[Random.RandHelper(NumPawns)] + Random.VRand() * 100.f - Positions[Shooter];
+
+			FFireShot FireShot;
+			FireShot.SetMuzzle(Positions[Shooter], Aim.Rotation());
+			FireShot.Seed = uint16(Shot);
+			FireShot.Timestamp = Random.FRandRange(History.GetOldestTime(), Time);
+			FireShot.Weapon = Shotgun;
+			Defaults->GetPelletDirections(FireShot, Directions);
+
+			ShotBits += FFirstPersonNetStats::MeasureBits(FireShot);
+			LegacyBits += FFirstPersonNetStats::MeasureBits(FireShot.Location, FireShot.GetRotation()) * Directions.Num();
+
+			Ends.Reset();
+			for (const FVector& Direction : Directions) Ends.Add(FireShot.Location + Direction * Defaults->HitscanRange);
+
+			const double SingleStart = FPlatformTime::Seconds();
+			for (const FVector& End : Ends)
+			{
+				FVector HitLocation;
+				if (History.Trace(FireShot.Timestamp, FireShot.Location, End, Shooter, HitLocation) != INDEX_NONE) SingleHits++;
+			}
+			const double BatchStart = FPlatformTime::Seconds();
+			History.TraceMulti(FireShot.Timestamp, FireShot.Location, Ends, Shooter, Slots, HitLocations);
+			const double BatchEnd = FPlatformTime::Seconds();
+
+			SingleSeconds += BatchStart - SingleStart;
+			BatchSeconds += BatchEnd - BatchStart;
+			for (int32 Slot : Slots)
+			{
+				if (Slot != INDEX_NONE) BatchHits++;
+			}
+		}
+
+		UE_LOG(LogFPBench, Display, TEXT("Shotgun shots: %d pellets, %d pawns, %d shots"), Defaults->ShotgunPellets, NumPawns, NumShots);
+		UE_LOG(LogFPBench, Display, TEXT("  one Server_OnFire(FVector, FRotator) per pellet: %.1f bytes/shot"), LegacyBits / 8.0 / NumShots);
+		UE_LOG(LogFPBench, Display, TEXT("  one FFireShot (any weapon): %.1f bytes/shot"), ShotBits / 8.0 / NumShots);
+		UE_LOG(LogFPBench, Display, TEXT("  pellet traces one by one: %.3f us/shot, %d hits"), SingleSeconds * 1e6 / NumShots, SingleHits);
+		UE_LOG(LogFPBench, Display, TEXT("  pellet traces batched: %.3f us/shot, %d hits"), BatchSeconds * 1e6 / NumShots, BatchHits);
+	}));
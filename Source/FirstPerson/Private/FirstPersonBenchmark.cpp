@@ -0,0 +1,54 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FirstPersonBenchmark.h"
+#include "Containers/Ticker.h"
+#include "Misc/App.h"
+#include "UObject/UObjectGlobals.h"
+
+DEFINE_LOG_CATEGORY(LogFPBench);
+
+namespace FirstPersonBenchmark
+{
+	void RunFrames(int32 NumFrames, TFunction<void(float DeltaSeconds)> OnFrame, TFunction<void(const FFrameStats&)> OnDone)
+	{
+		TSharedRef<FFrameStats> Stats = MakeShared<FFrameStats>();
+		Stats->GarbageCollections = GetNumGarbageCollections();
+
+		bool bFirstFrame = true;
+		FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([=](float DeltaSeconds) mutable
+		{
+			// The previous frame ran our OnFrame, so it is the one being measured
+			if (!bFirstFrame)
+			{
+				const double BusyMs = FMath::Max(FApp::GetDeltaTime() - FApp::GetIdleTime(), 0.0) * 1000.0;
+				Stats->BusyMs += BusyMs;
+				Stats->MaxBusyMs = FMath::Max(Stats->MaxBusyMs, BusyMs);
+				Stats->Frames++;
+			}
+			bFirstFrame = false;
+
+			if (Stats->Frames >= NumFrames)
+			{
+				Stats->GarbageCollections = GetNumGarbageCollections() - Stats->GarbageCollections;
+				OnDone(*Stats);
+				return false;
+			}
+
+			OnFrame(DeltaSeconds);
+			return true;
+		}));
+	}
+
+	int32 GetNumGarbageCollections()
+	{
+		static int32 NumCollections = 0;
+		static bool bRegistered = false;
+		if (!bRegistered)
+		{
+			FCoreUObjectDelegates::GetPostGarbageCollect().AddLambda([]() { NumCollections++; });
+			bRegistered = true;
+		}
+		return NumCollections;
+	}
+}
@@ -0,0 +1,29 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+DECLARE_LOG_CATEGORY_EXTERN(LogFPBench, Log, All);
+
+// Helpers for the fp.Bench console commands, which run headless on a dedicated server
+namespace FirstPersonBenchmark
+{
+	// Game thread time of the frames sampled by RunFrames
+	struct FFrameStats
+	{
+		int32 Frames = 0;
+		double BusyMs = 0.0;
+		double MaxBusyMs = 0.0;
+		int32 GarbageCollections = 0;
+
+		double AverageMs() const { return Frames > 0 ? BusyMs / Frames : 0.0; }
+	};
+
+	// Calls OnFrame at the start of each of the next NumFrames frames, then OnDone with the
+	// busy game thread time (frame time minus max tick rate idle) of those frames
+	void RunFrames(int32 NumFrames, TFunction<void(float DeltaSeconds)> OnFrame, TFunction<void(const FFrameStats&)> OnDone);
+
+	// Number of garbage collections since the first call
+	int32 GetNumGarbageCollections();
+}
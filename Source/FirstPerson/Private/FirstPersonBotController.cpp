@@ -0,0 +1,79 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FirstPersonBotController.h"
+#include "FirstPersonCharacter.h"
+
+AFirstPersonBotController::AFirstPersonBotController()
+{
+	PrimaryActorTick.bCanEverTick = true;
+}
+
+void AFirstPersonBotController::Tick(float DeltaSeconds)
+{
+	Super::Tick(DeltaSeconds);
+
+	AFirstPersonCharacter* Character = Cast<AFirstPersonCharacter>(GetPawn());
+	if (Character == nullptr) return;
+
+	Brain.FireInterval = FireInterval;
+	Brain.Tick(this, Character, DeltaSeconds);
+}
+
+void FFirstPersonBotBrain::Tick(AController* Controller, AFirstPersonCharacter* Character, float DeltaSeconds)
+{
+	DecisionTimeLeft -= DeltaSeconds;
+	if (DecisionTimeLeft <= 0.f) Decide(Character);
+
+	Character->MoveForward(Forward);
+	Character->MoveRight(Right);
+
+	// Look around, the character follows the controller's yaw
+	FRotator Rotation = Controller->GetControlRotation() + LookRate * DeltaSeconds;
+	Rotation.Pitch = FMath::ClampAngle(Rotation.Pitch, -60.f, 60.f);
+	Controller->SetControlRotation(Rotation);
+
+	FireTimeLeft -= DeltaSeconds;
+	if (bFiring && FireTimeLeft <= 0.f)
+	{
+		FireTimeLeft = FireInterval;
+
+		FFirstPersonInventory& Inventory = Character->Inventory;
+		const EWeaponType Gun = Inventory.Equipped;
+		if (Gun != Melee && Inventory.Weapons[Gun].clipAmmo <= 0)
+		{
+			// Bots never run dry, the load test is about sustained fire. Only the server can refill.
+			if (Inventory.TotalAmmo[Gun] <= 0 && Character->HasAuthority()) Inventory.TotalAmmo[Gun] = Inventory.MaxTotalAmmo[Gun];
+			Character->OnReload();
+		}
+		else Character->OnFire();
+	}
+}
+
+void FFirstPersonBotBrain::Decide(AFirstPersonCharacter* Character)
+{
+	DecisionTimeLeft = Random.FRandRange(1.f, 4.f);
+
+	Forward = Random.RandRange(-1, 1);
+	Right = Random.RandRange(-1, 1);
+	LookRate = FRotator(Random.FRandRange(-20.f, 20.f), Random.FRandRange(-90.f, 90.f), 0.f);
+	bFiring = Random.FRand() < 0.6f;
+
+	const bool bSprint = Forward > 0.f && Random.FRand() < 0.3f;
+	if (bSprint != bSprinting)
+	{
+		bSprinting = bSprint;
+		if (bSprinting) Character->Sprint();
+		else Character->Walk();
+	}
+
+	const bool bCrouch = !bSprinting && Random.FRand() < 0.15f;
+	if (bCrouch != bCrouching)
+	{
+		bCrouching = bCrouch;
+		if (bCrouching) Character->StartCrouch();
+		else Character->StopCrouch();
+	}
+
+	if (Random.FRand() < 0.2f) Character->OnSwitchWeapon();
+}
@@ -0,0 +1,108 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FirstPersonMovementComponent.h"
+#include "FirstPersonBenchmark.h"
+#include "GameFramework/Character.h"
+#include "HAL/IConsoleManager.h"
+
+int64 UFirstPersonMovementComponent::NumCorrectionsSent = 0;
+
+UFirstPersonMovementComponent::UFirstPersonMovementComponent()
+{
+	bWantsToSprint = false;
+
+	// Crouching goes through ACharacter::Crouch and the saved move's crouch flag
+	NavAgentProps.bCanCrouch = true;
+}
+
+bool UFirstPersonMovementComponent::IsSprinting() const
+{
+	return bWantsToSprint && MovementMode == MOVE_Walking && !IsCrouching();
+}
+
+float UFirstPersonMovementComponent::GetMaxSpeed() const
+{
+	return IsSprinting() ? MaxSprintSpeed : Super::GetMaxSpeed();
+}
+
+void UFirstPersonMovementComponent::UpdateFromCompressedFlags(uint8 Flags)
+{
+	Super::UpdateFromCompressedFlags(Flags);
+
+	bWantsToSprint = (Flags & FSavedMove_Character::FLAG_Custom_0) != 0;
+}
+
+FNetworkPredictionData_Client* UFirstPersonMovementComponent::GetPredictionData_Client() const
+{
+	check(PawnOwner != nullptr);
+
+	if (ClientPredictionData == nullptr)
+	{
+		UFirstPersonMovementComponent* MutableThis = const_cast<UFirstPersonMovementComponent*>(this);
+		MutableThis->ClientPredictionData = new FNetworkPredictionData_Client_FirstPerson(*this);
+	}
+	return ClientPredictionData;
+}
+
+void UFirstPersonMovementComponent::SendClientAdjustment()
+{
+	// A pending adjustment that is not a good move acknowledgement is a correction
+	if (HasPredictionData_Server())
+	{
+		const FNetworkPredictionData_Server_Character* ServerData = GetPredictionData_Server_Character();
+		if (ServerData->PendingAdjustment.TimeStamp > 0.f && !ServerData->PendingAdjustment.bAckGoodMove) NumCorrectionsSent++;
+	}
+
+	Super::SendClientAdjustment();
+}
+
+void FSavedMove_FirstPerson::Clear()
+{
+	Super::Clear();
+
+	bWantsToSprint = false;
+}
+
+void FSavedMove_FirstPerson::SetMoveFor(ACharacter* Character, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData)
+{
+	Super::SetMoveFor(Character, InDeltaTime, NewAccel, ClientData);
+
+	bWantsToSprint = CastChecked<UFirstPersonMovementComponent>(Character->GetCharacterMovement())->bWantsToSprint;
+}
+
+void FSavedMove_FirstPerson::PrepMoveFor(ACharacter* Character)
+{
+	Super::PrepMoveFor(Character);
+
+	// Replayed moves run with the sprint input they were made with
+	CastChecked<UFirstPersonMovementComponent>(Character->GetCharacterMovement())->bWantsToSprint = bWantsToSprint;
+}
+
+bool FSavedMove_FirstPerson::CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* InCharacter, float MaxDelta) const
+{
+	if (bWantsToSprint != static_cast<const FSavedMove_FirstPerson*>(NewMove.Get())->bWantsToSprint) return false;
+
+	return Super::CanCombineWith(NewMove, InCharacter, MaxDelta);
+}
+
+uint8 FSavedMove_FirstPerson::GetCompressedFlags() const
+{
+	uint8 Flags = Super::GetCompressedFlags();
+	if (bWantsToSprint) Flags |= FLAG_Custom_0;
+	return Flags;
+}
+
+FSavedMovePtr FNetworkPredictionData_Client_FirstPerson::AllocateNewMove()
+{
+	return FSavedMovePtr(new FSavedMove_FirstPerson());
+}
+
+static FAutoConsoleCommand MovementCorrectionsCommand(
+	TEXT("fp.Movement.Corrections"),
+	TEXT("Prints the number of position corrections this server sent to clients. Usage: fp.Movement.Corrections [reset]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		if (Args.Num() > 0 && Args[0] == TEXT("reset")) UFirstPersonMovementComponent::ResetNumCorrectionsSent();
+		else UE_LOG(LogFPBench, Display, TEXT("Movement corrections sent: %lld"), UFirstPersonMovementComponent::GetNumCorrectionsSent());
+	}));
@@ -0,0 +1,10 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FirstPersonPlayerController.h"
+#include "FirstPersonCharacter.h"
+
+void AFirstPersonPlayerController::Client_ReceiveShots_Implementation(const TArray<FRelayedShots>& Batches)
+{
+	AFirstPersonCharacter::ReceiveShots(Batches);
+}
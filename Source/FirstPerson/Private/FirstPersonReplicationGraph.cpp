@@ -0,0 +1,188 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FirstPersonReplicationGraph.h"
+#include "FirstPersonCharacter.h"
+#include "FirstPersonProjectile.h"
+#include "Weapon.h"
+#include "Engine/NetConnection.h"
+#include "Engine/NetDriver.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "UObject/UObjectIterator.h"
+
+DEFINE_LOG_CATEGORY_STATIC(LogFPRepGraph, Log, All);
+
+static TAutoConsoleVariable<int32> CVarReplicationGraph(
+	TEXT("fp.Net.ReplicationGraph"),
+	1,
+	TEXT("Create the game net driver with UFirstPersonReplicationGraph. 0 keeps the net driver's own relevancy checks. Read when the server starts listening."));
+
+bool UFirstPersonReplicationGraph::IsEnabled()
+{
+	return CVarReplicationGraph.GetValueOnGameThread() != 0;
+}
+
+EFirstPersonClassRepPolicy UFirstPersonReplicationGraph::GetPolicy(const AActor* ActorCDO) const
+{
+	// Controllers are added to their connection's list as its viewer
+	if (ActorCDO->IsA<APlayerController>()) return EFirstPersonClassRepPolicy::NotRouted;
+
+	if (ActorCDO->IsA<AWeapon>()) return EFirstPersonClassRepPolicy::Spatialize_Dormancy;
+	if (ActorCDO->IsA<AFirstPersonCharacter>() || ActorCDO->IsA<AFirstPersonProjectile>()) return EFirstPersonClassRepPolicy::Spatialize_Dynamic;
+
+	// Game state, player states and anything else flagged so
+	if (ActorCDO->bAlwaysRelevant) return EFirstPersonClassRepPolicy::RelevantAllConnections;
+	if (ActorCDO->bOnlyRelevantToOwner) return EFirstPersonClassRepPolicy::RelevantToOwner;
+
+	return EFirstPersonClassRepPolicy::Spatialize_Dynamic;
+}
+
+EFirstPersonClassRepPolicy UFirstPersonReplicationGraph::GetClassRepPolicy(UClass* Class)
+{
+	if (const EFirstPersonClassRepPolicy* Policy = ClassRepPolicies.Get(Class)) return *Policy;
+
+	// Loaded after InitGlobalActorClassSettings or not replicated then, registered so it warns once and is removed as it was added
+	const AActor* ActorCDO = Cast<AActor>(Class->GetDefaultObject());
+	const EFirstPersonClassRepPolicy Policy = ActorCDO != nullptr ? GetPolicy(ActorCDO) : EFirstPersonClassRepPolicy::Spatialize_Dynamic;
+	UE_LOG(LogFPRepGraph, Warning, TEXT("%s has no replication policy, routed by policy %d of EFirstPersonClassRepPolicy"), *GetNameSafe(Class), (int32)Policy);
+	ClassRepPolicies.Set(Class, Policy);
+	return Policy;
+}
+
+void UFirstPersonReplicationGraph::InitGlobalActorClassSettings()
+{
+	Super::InitGlobalActorClassSettings();
+
+	// The graph ticks per frame, update frequencies and cull distances come from each class's defaults
+	for (TObjectIterator<UClass> It; It; ++It)
+	{
+		UClass* Class = *It;
+		const AActor* ActorCDO = Cast<AActor>(Class->GetDefaultObject(false));
+		if (ActorCDO == nullptr || !ActorCDO->GetIsReplicated()) continue;
+		if (Class->GetName().StartsWith(TEXT("SKEL_")) || Class->GetName().StartsWith(TEXT("REINST_"))) continue;
+
+		const EFirstPersonClassRepPolicy Policy = GetPolicy(ActorCDO);
+		ClassRepPolicies.Set(Class, Policy);
+
+		FClassReplicationInfo ClassInfo;
+		ClassInfo.ReplicationPeriodFrame = GetReplicationPeriodFrameForFrequency(ActorCDO->NetUpdateFrequency);
+		const bool bSpatialized = Policy == EFirstPersonClassRepPolicy::Spatialize_Dynamic || Policy == EFirstPersonClassRepPolicy::Spatialize_Dormancy;
+		ClassInfo.SetCullDistanceSquared(bSpatialized ? ActorCDO->NetCullDistanceSquared : 0.f);
+		GlobalActorReplicationInfoMap.SetClassInfo(Class, ClassInfo);
+	}
+}
+
+void UFirstPersonReplicationGraph::SetUpdateFrequency(AActor* Actor, float Frequency)
+{
+	if (FGlobalActorReplicationInfo* Info = GlobalActorReplicationInfoMap.Find(Actor))
+	{
+		Info->Settings.ReplicationPeriodFrame = GetReplicationPeriodFrameForFrequency(Frequency);
+	}
+}
+
+void UFirstPersonReplicationGraph::InitGlobalGraphNodes()
+{
+	GridNode = CreateNewNode<UReplicationGraphNode_GridSpatialization2D>();
+	GridNode->CellSize = CellSize;
+	GridNode->SpatialBias = SpatialBias;
+	AddGlobalGraphNode(GridNode);
+
+	AlwaysRelevantNode = CreateNewNode<UReplicationGraphNode_ActorList>();
+	AddGlobalGraphNode(AlwaysRelevantNode);
+}
+
+void UFirstPersonReplicationGraph::InitConnectionGraphNodes(UNetReplicationGraphConnection* RepGraphConnection)
+{
+	Super::InitConnectionGraphNodes(RepGraphConnection);
+
+	UReplicationGraphNode_AlwaysRelevant_ForConnection* ConnectionNode = CreateNewNode<UReplicationGraphNode_AlwaysRelevant_ForConnection>();
+	AddConnectionGraphNode(ConnectionNode, RepGraphConnection);
+	ConnectionNodes.Add(RepGraphConnection->NetConnection, ConnectionNode);
+}
+
+void UFirstPersonReplicationGraph::RemoveClientConnection(UNetConnection* NetConnection)
+{
+	ConnectionNodes.Remove(NetConnection);
+
+	Super::RemoveClientConnection(NetConnection);
+}
+
+bool UFirstPersonReplicationGraph::AddToOwnerConnection(AActor* Actor)
+{
+	UNetConnection* Connection = Actor->GetNetConnection();
+	UReplicationGraphNode_AlwaysRelevant_ForConnection* const* ConnectionNode = Connection != nullptr ? ConnectionNodes.Find(Connection) : nullptr;
+	if (ConnectionNode == nullptr) return false;
+
+	(*ConnectionNode)->NotifyAddNetworkActor(FNewReplicatedActorInfo(Actor));
+	return true;
+}
+
+void UFirstPersonReplicationGraph::RouteAddNetworkActorToNodes(const FNewReplicatedActorInfo& ActorInfo, FGlobalActorReplicationInfo& GlobalInfo)
+{
+	switch (GetClassRepPolicy(ActorInfo.Class))
+	{
+	case EFirstPersonClassRepPolicy::RelevantAllConnections:
+		AlwaysRelevantNode->NotifyAddNetworkActor(ActorInfo);
+		break;
+
+	case EFirstPersonClassRepPolicy::RelevantToOwner:
+		if (!AddToOwnerConnection(ActorInfo.Actor)) ActorsWithoutNetConnection.Add(ActorInfo.Actor);
+		break;
+
+	case EFirstPersonClassRepPolicy::Spatialize_Dynamic:
+		GridNode->AddActor_Dynamic(ActorInfo, GlobalInfo);
+		break;
+
+	case EFirstPersonClassRepPolicy::Spatialize_Dormancy:
+		GridNode->AddActor_Dormancy(ActorInfo, GlobalInfo);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void UFirstPersonReplicationGraph::RouteRemoveNetworkActorToNodes(const FNewReplicatedActorInfo& ActorInfo)
+{
+	switch (GetClassRepPolicy(ActorInfo.Class))
+	{
+	case EFirstPersonClassRepPolicy::RelevantAllConnections:
+		AlwaysRelevantNode->NotifyRemoveNetworkActor(ActorInfo);
+		break;
+
+	case EFirstPersonClassRepPolicy::RelevantToOwner:
+		if (ActorsWithoutNetConnection.Remove(ActorInfo.Actor) == 0)
+		{
+			// The owner may have changed since, look for it everywhere
+			for (const TPair<UNetConnection*, UReplicationGraphNode_AlwaysRelevant_ForConnection*>& Pair : ConnectionNodes)
+			{
+				if (Pair.Value->NotifyRemoveNetworkActor(ActorInfo, false)) break;
+			}
+		}
+		break;
+
+	case EFirstPersonClassRepPolicy::Spatialize_Dynamic:
+		GridNode->RemoveActor_Dynamic(ActorInfo);
+		break;
+
+	case EFirstPersonClassRepPolicy::Spatialize_Dormancy:
+		GridNode->RemoveActor_Dormancy(ActorInfo);
+		break;
+
+	default:
+		break;
+	}
+}
+
+int32 UFirstPersonReplicationGraph::ServerReplicateActors(float DeltaSeconds)
+{
+	// Owner only actors whose owner got a connection since they were added
+	for (int32 i = ActorsWithoutNetConnection.Num() - 1; i >= 0; i--)
+	{
+		AActor* Actor = ActorsWithoutNetConnection[i];
+		if (!IsValid(Actor) || AddToOwnerConnection(Actor)) ActorsWithoutNetConnection.RemoveAtSwap(i, 1, false);
+	}
+
+	return Super::ServerReplicateActors(DeltaSeconds);
+}
@@ -0,0 +1,27 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ProfilingDebugging/CpuProfilerTrace.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+#include "Stats/Stats.h"
+
+// Hot paths of the character, weapon and projectile code, in "stat FirstPerson", in Unreal
+// Insights captures (-trace=cpu) and in the FirstPerson category of CSV profiles, which headless
+// servers record with -csvCaptureFrames=N or the csvprofile start/stop commands.
+DECLARE_STATS_GROUP(TEXT("FirstPerson"), STATGROUP_FirstPerson, STATCAT_Advanced);
+
+CSV_DECLARE_CATEGORY_EXTERN(FirstPerson);
+
+// Times the enclosing scope in STAT_FirstPerson_<Name>, declared with DECLARE_CYCLE_STAT in the same file.
+// The trace scope keeps the path in Insights in builds without stats.
+#define FIRSTPERSON_SCOPE_CYCLE_COUNTER(Name) \
+	SCOPE_CYCLE_COUNTER(STAT_FirstPerson_##Name); \
+	TRACE_CPUPROFILER_EVENT_SCOPE(FirstPerson_##Name); \
+	CSV_SCOPED_TIMING_STAT(FirstPerson, Name)
+
+// Counts one event in STAT_FirstPerson_Num<Name>, declared with DECLARE_DWORD_COUNTER_STAT in the same file
+#define FIRSTPERSON_INC_COUNTER(Name) \
+	INC_DWORD_STAT(STAT_FirstPerson_Num##Name); \
+	CSV_CUSTOM_STAT(FirstPerson, Num##Name, 1, ECsvCustomStatOp::Accumulate)
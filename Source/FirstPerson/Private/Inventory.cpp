@@ -0,0 +1,354 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Inventory.h"
+#include "FirstPersonBenchmark.h"
+#include "NetStats.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "UObject/CoreNet.h"
+
+static_assert(MAX_WEAPON_TYPE <= 4, "Owned weapons, equipped and cached weapon are packed into one byte");
+
+// Bits of the replicated fields, values are validated where they enter the inventory
+static const uint32 ClipAmmoRange = FFirstPersonInventory::MaxClipAmmoLimit + 1;
+static const uint32 TotalAmmoRange = FFirstPersonInventory::MaxTotalAmmoLimit + 1;
+static const uint32 ReloadTimeRange = FFirstPersonInventory::MaxReloadTimeLimit + 1;
+static const uint32 DamageRange = FFirstPersonInventory::MaxDamageLimit + 1;
+
+// Dirty mask: the state byte, then clip ammo, total ammo and stats of each weapon
+enum EInventoryField
+{
+	Field_Clip,
+	Field_Total,
+	Field_Stats,
+	NumWeaponFields
+};
+static const int32 NumDirtyBits = 1 + MAX_WEAPON_TYPE * NumWeaponFields;
+
+static uint32 WeaponFieldBit(int32 Weapon, EInventoryField Field)
+{
+	return 1u << (1 + Weapon * NumWeaponFields + Field);
+}
+
+static void SerializeBounded(FArchive& Ar, int& Value, uint32 Range)
+{
+	// Out of range values are a bug where they were set, the client would silently get another one
+	ensureMsgf(Ar.IsLoading() || (Value >= 0 && uint32(Value) < Range), TEXT("Inventory value %d doesn't fit the replicated range [0, %u)"), Value, Range);
+	uint32 Bounded = FMath::Clamp<int32>(Value, 0, Range - 1);
+	Ar.SerializeInt(Bounded, Range);
+	Value = Bounded;
+}
+
+// What a connection last received
+class FInventoryDeltaState : public INetDeltaBaseState
+{
+public:
+	FInventoryDeltaState(const FFirstPersonInventory& InInventory) : Inventory(InInventory) {}
+
+	virtual bool IsStateEqual(INetDeltaBaseState* OtherState) override
+	{
+		return Inventory == static_cast<FInventoryDeltaState*>(OtherState)->Inventory;
+	}
+
+	FFirstPersonInventory Inventory;
+};
+
+FFirstPersonInventory::FFirstPersonInventory()
+{
+	Weapons[Melee].Initialize(Melee);
+	Weapons[Revolver].Initialize(Revolver);
+
+	for (int32 i = 0; i < MAX_WEAPON_TYPE; i++) checkSlow(MaxTotalAmmo[i] <= MaxTotalAmmoLimit && IsReplicable(Weapons[i]));
+}
+
+bool FFirstPersonInventory::IsReplicable(const FGun& Gun)
+{
+	return Gun.clipAmmo >= 0 && Gun.clipAmmo <= Gun.maxClipAmmo && Gun.maxClipAmmo <= MaxClipAmmoLimit
+		&& Gun.reloadTime >= 0 && Gun.reloadTime <= MaxReloadTimeLimit
+		&& Gun.damage >= 0 && Gun.damage <= MaxDamageLimit;
+}
+
+bool FFirstPersonInventory::Equip(EWeaponType Type)
+{
+	if (Type == Equipped || !Owns(Type)) return false;
+
+	Cached = Equipped;
+	Equipped = Type;
+	return true;
+}
+
+bool FFirstPersonInventory::ConsumeClipAmmo()
+{
+	FGun& Gun = Weapons[Equipped];
+	if (Equipped == Melee || Gun.clipAmmo <= 0) return false;
+
+	Gun.clipAmmo--;
+	return true;
+}
+
+void FFirstPersonInventory::Reload()
+{
+	if (Equipped == Melee) return;
+
+	FGun& Gun = Weapons[Equipped];
+	const int Loaded = FMath::Min(Gun.maxClipAmmo - Gun.clipAmmo, TotalAmmo[Equipped]);
+	if (Loaded <= 0) return; // full or out of ammo
+
+	Gun.clipAmmo += Loaded;
+	TotalAmmo[Equipped] -= Loaded;
+}
+
+bool FFirstPersonInventory::AddWeapon(EWeaponType Type, const FGun& Gun)
+{
+	if (!ensureMsgf(IsReplicable(Gun), TEXT("Weapon %d doesn't fit the inventory's replicated ranges: clip %d/%d, reload %d, damage %d"),
+		int32(Type), Gun.clipAmmo, Gun.maxClipAmmo, Gun.reloadTime, Gun.damage))
+	{
+		return false;
+	}
+
+	FGun& Weapon = Weapons[Type];
+	if (!Weapon.active)
+	{
+		Weapon.clipAmmo = Gun.clipAmmo;
+		Weapon.maxClipAmmo = Gun.maxClipAmmo;
+		Weapon.reloadTime = Gun.reloadTime;
+		Weapon.damage = Gun.damage;
+		Weapon.active = true;
+		return true;
+	}
+
+	TotalAmmo[Type] = FMath::Min(FMath::Max(TotalAmmo[Type], 0) + Gun.clipAmmo, MaxTotalAmmo[Type]);
+	return false;
+}
+
+uint8 FFirstPersonInventory::GetStateByte() const
+{
+	uint8 State = 0;
+	for (int32 i = 0; i < MAX_WEAPON_TYPE; i++)
+	{
+		if (Weapons[i].active) State |= 1 << i;
+	}
+	return State | (Equipped << 4) | (Cached << 6);
+}
+
+void FFirstPersonInventory::SetStateByte(uint8 State)
+{
+	for (int32 i = 0; i < MAX_WEAPON_TYPE; i++) Weapons[i].active = (State & (1 << i)) != 0;
+	Equipped = EWeaponType(FMath::Min<uint8>((State >> 4) & 3, MAX_WEAPON_TYPE - 1));
+	Cached = EWeaponType(FMath::Min<uint8>((State >> 6) & 3, MAX_WEAPON_TYPE - 1));
+}
+
+void FFirstPersonInventory::WriteDelta(FArchive& Ar, const FFirstPersonInventory* Old) const
+{
+	uint32 DirtyMask = 0;
+	if (Old == nullptr || GetStateByte() != Old->GetStateByte()) DirtyMask |= 1;
+	for (int32 i = 0; i < MAX_WEAPON_TYPE; i++)
+	{
+		const FGun& Gun = Weapons[i];
+		if (Old == nullptr || Gun.clipAmmo != Old->Weapons[i].clipAmmo) DirtyMask |= WeaponFieldBit(i, Field_Clip);
+		if (Old == nullptr || TotalAmmo[i] != Old->TotalAmmo[i]) DirtyMask |= WeaponFieldBit(i, Field_Total);
+		if (Old == nullptr || Gun.maxClipAmmo != Old->Weapons[i].maxClipAmmo || Gun.reloadTime != Old->Weapons[i].reloadTime || Gun.damage != Old->Weapons[i].damage)
+		{
+			DirtyMask |= WeaponFieldBit(i, Field_Stats);
+		}
+	}
+
+	// SerializeBounded goes through non-const references
+	FFirstPersonInventory Copy = *this;
+	Ar.SerializeBits(&DirtyMask, NumDirtyBits);
+	if (DirtyMask & 1)
+	{
+		uint8 State = Copy.GetStateByte();
+		Ar << State;
+	}
+	for (int32 i = 0; i < MAX_WEAPON_TYPE; i++)
+	{
+		FGun& Gun = Copy.Weapons[i];
+		if (DirtyMask & WeaponFieldBit(i, Field_Clip)) SerializeBounded(Ar, Gun.clipAmmo, ClipAmmoRange);
+		if (DirtyMask & WeaponFieldBit(i, Field_Total)) SerializeBounded(Ar, Copy.TotalAmmo[i], TotalAmmoRange);
+		if (DirtyMask & WeaponFieldBit(i, Field_Stats))
+		{
+			SerializeBounded(Ar, Gun.maxClipAmmo, ClipAmmoRange);
+			SerializeBounded(Ar, Gun.reloadTime, ReloadTimeRange);
+			SerializeBounded(Ar, Gun.damage, DamageRange);
+		}
+	}
+}
+
+void FFirstPersonInventory::ReadDelta(FArchive& Ar)
+{
+	uint32 DirtyMask = 0;
+	Ar.SerializeBits(&DirtyMask, NumDirtyBits);
+	DirtyMask &= (1u << NumDirtyBits) - 1;
+	if (DirtyMask & 1)
+	{
+		uint8 State = 0;
+		Ar << State;
+		SetStateByte(State);
+	}
+	for (int32 i = 0; i < MAX_WEAPON_TYPE; i++)
+	{
+		FGun& Gun = Weapons[i];
+		if (DirtyMask & WeaponFieldBit(i, Field_Clip)) SerializeBounded(Ar, Gun.clipAmmo, ClipAmmoRange);
+		if (DirtyMask & WeaponFieldBit(i, Field_Total)) SerializeBounded(Ar, TotalAmmo[i], TotalAmmoRange);
+		if (DirtyMask & WeaponFieldBit(i, Field_Stats))
+		{
+			SerializeBounded(Ar, Gun.maxClipAmmo, ClipAmmoRange);
+			SerializeBounded(Ar, Gun.reloadTime, ReloadTimeRange);
+			SerializeBounded(Ar, Gun.damage, DamageRange);
+		}
+	}
+}
+
+bool FFirstPersonInventory::NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms)
+{
+	if (DeltaParms.Writer != nullptr)
+	{
+		const FInventoryDeltaState* OldState = static_cast<const FInventoryDeltaState*>(DeltaParms.OldState);
+		const FFirstPersonInventory* Old = OldState != nullptr ? &OldState->Inventory : nullptr;
+
+		// Nothing to send until something changes
+		if (Old != nullptr && *Old == *this) return false;
+
+		*DeltaParms.NewState = MakeShared<FInventoryDeltaState>(*this);
+		const int64 StartBits = DeltaParms.Writer->GetNumBits();
+		WriteDelta(*DeltaParms.Writer, Old);
+
+		// Only written for the owner's connection, so accounted on it instead of in PreReplication
+		static const FName InventoryName(TEXT("Inventory"));
+		FFirstPersonNetStats::RecordDeltaProperty(DeltaParms, InventoryName, DeltaParms.Writer->GetNumBits() - StartBits);
+		return true;
+	}
+
+	if (DeltaParms.Reader != nullptr)
+	{
+		ReceiveDelta(*DeltaParms.Reader);
+		return !DeltaParms.Reader->IsError();
+	}
+
+	return true;
+}
+
+void FFirstPersonInventory::ReceiveDelta(FArchive& Ar)
+{
+	// The server's delta is against what it sent, the owner's copy may hold rounds it fired or
+	// reloaded in prediction that the server never accepted
+	FFirstPersonInventory Received = ServerState.IsValid() ? *ServerState : *this;
+	Received.ServerState.Reset();
+	Received.ReadDelta(Ar);
+	if (Ar.IsError()) return;
+
+	ServerState = MakeShared<FFirstPersonInventory>(Received);
+	RestoreServerState();
+}
+
+void FFirstPersonInventory::RestoreServerState()
+{
+	if (!ServerState.IsValid()) return;
+
+	// Assigning copies the received state's empty ServerState over ours
+	const TSharedPtr<FFirstPersonInventory> Received = ServerState;
+	*this = *Received;
+	ServerState = Received;
+}
+
+bool FFirstPersonInventory::operator==(const FFirstPersonInventory& Other) const
+{
+	if (GetStateByte() != Other.GetStateByte()) return false;
+
+	for (int32 i = 0; i < MAX_WEAPON_TYPE; i++)
+	{
+		const FGun& Gun = Weapons[i];
+		const FGun& OtherGun = Other.Weapons[i];
+		if (Gun.clipAmmo != OtherGun.clipAmmo || Gun.maxClipAmmo != OtherGun.maxClipAmmo || Gun.reloadTime != OtherGun.reloadTime || Gun.damage != OtherGun.damage) return false;
+		if (TotalAmmo[i] != Other.TotalAmmo[i]) return false;
+	}
+	return true;
+}
+
+// Plays random inventory changes on a server copy, replicates each delta to a client copy and
+// checks they match, reporting bits per change against sending the whole inventory
+static FAutoConsoleCommand InventoryBenchmarkCommand(
+	TEXT("fp.Bench.Inventory"),
+	TEXT("Checks inventory replication and reports bits per change. Usage: fp.Bench.Inventory [Changes=10000]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const int32 NumChanges = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 10000, 1);
+
+		// Designer placed pickups, the stats only travel the first time a weapon is owned
+		FGun Pickups[MAX_WEAPON_TYPE];
+		for (int32 i = 0; i < MAX_WEAPON_TYPE; i++)
+		{
+			Pickups[i].clipAmmo = Pickups[i].maxClipAmmo = 6 + i * 8;
+			Pickups[i].reloadTime = 3 + i;
+			Pickups[i].damage = 20 + i * 10;
+		}
+
+		FFirstPersonInventory Server, Client, Acked;
+		FRandomStream Random(42);
+		int32 Mismatches = 0;
+		int64 NumSent = 0, DeltaBits = 0, FireBits = 0, NumFires = 0;
+
+		// The first replication of an inventory is whole
+		{
+			FNetBitWriter Writer(nullptr, 256);
+			Server.WriteDelta(Writer, nullptr);
+			FNetBitReader Reader(nullptr, Writer.GetData(), Writer.GetNumBits());
+			Client.ReceiveDelta(Reader);
+		}
+
+		for (int32 Change = 0; Change < NumChanges; Change++)
+		{
+			const float Roll = Random.FRand();
+			const bool bFire = Roll < 0.7f;
+
+			// The owner predicts its shots, one in ten the server rejects
+			if (bFire)
+			{
+				Client.ConsumeClipAmmo();
+				if (Random.FRand() >= 0.1f) Server.ConsumeClipAmmo();
+			}
+			else if (Roll < 0.8f) Server.Reload();
+			else if (Roll < 0.9f) Server.Equip(EWeaponType(Random.RandRange(0, MAX_WEAPON_TYPE - 1)));
+			else
+			{
+				const int32 Type = Random.RandRange(1, MAX_WEAPON_TYPE - 1);
+				Server.AddWeapon(EWeaponType(Type), Pickups[Type]);
+			}
+
+			// Nothing changed on the server, a rejected or empty shot, so nothing is sent and the owner's
+			// prediction is dropped once its shot times out unconfirmed
+			if (Server == Acked)
+			{
+				Client.RestoreServerState();
+				if (Client != Server) Mismatches++;
+				continue;
+			}
+
+			FNetBitWriter Writer(nullptr, 256);
+			Server.WriteDelta(Writer, &Acked);
+			FNetBitReader Reader(nullptr, Writer.GetData(), Writer.GetNumBits());
+			Client.ReceiveDelta(Reader);
+			Acked = Server;
+
+			if (Client != Server || Reader.IsError() || Reader.GetBitsLeft() != 0) Mismatches++;
+			NumSent++;
+			DeltaBits += Writer.GetNumBits();
+			if (bFire)
+			{
+				FireBits += Writer.GetNumBits();
+				NumFires++;
+			}
+		}
+
+		FNetBitWriter Full(nullptr, 256);
+		Server.WriteDelta(Full, nullptr);
+
+		// The arrays as plain replicated properties: five int32 per gun, the carried ammo and two enum bytes
+		const int64 RawBits = (MAX_WEAPON_TYPE * 5 + MAX_WEAPON_TYPE) * 32 + 16;
+
+		UE_LOG(LogFPBench, Display, TEXT("Inventory replication over %lld changes: %d mismatches"), NumSent, Mismatches);
+		UE_LOG(LogFPBench, Display, TEXT("  %.1f bits per change, %.1f bits per shot"), NumSent > 0 ? DeltaBits / float(NumSent) : 0.f, NumFires > 0 ? FireBits / float(NumFires) : 0.f);
+		UE_LOG(LogFPBench, Display, TEXT("  full inventory %lld bits, unpacked arrays %lld bits"), Full.GetNumBits(), RawBits);
+	}));
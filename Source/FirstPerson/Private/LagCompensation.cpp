@@ -0,0 +1,370 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LagCompensation.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonCharacter.h"
+#include "Components/CapsuleComponent.h"
+#include "GameFramework/PlayerState.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+
+static TAutoConsoleVariable<float> CVarMaxRewind(
+	TEXT("fp.LagCompensation.MaxRewind"),
+	0.4f,
+	TEXT("Maximum time in seconds a shot can be rewound on the server."));
+
+//////////////////////////////////////////////////////////////////////////
+// FPoseHistory
+
+void FPoseHistory::Init(int32 InMaxSlots, int32 InMaxFrames)
+{
+	MaxSlots = InMaxSlots;
+	MaxFrames = InMaxFrames;
+	NumFrames = 0;
+	Head = INDEX_NONE;
+
+	const int32 Count = MaxSlots * MaxFrames;
+	FrameTimes.SetNumZeroed(MaxFrames);
+	SlotUsed.Init(false, MaxSlots);
+	PosX.SetNumZeroed(Count);
+	PosY.SetNumZeroed(Count);
+	PosZ.SetNumZeroed(Count);
+	Radius.SetNumZeroed(Count);
+	HalfHeight.SetNumZeroed(Count);
+	Valid.SetNumZeroed(Count);
+}
+
+int32 FPoseHistory::AddSlot()
+{
+	const int32 Slot = SlotUsed.Find(false);
+	if (Slot != INDEX_NONE)
+	{
+		SlotUsed[Slot] = true;
+
+		// Don't let the new character inherit poses of the previous owner
+		for (int32 Frame = 0; Frame < MaxFrames; Frame++) Valid[Frame * MaxSlots + Slot] = 0;
+	}
+	return Slot;
+}
+
+void FPoseHistory::RemoveSlot(int32 Slot)
+{
+	if (SlotUsed.IsValidIndex(Slot)) SlotUsed[Slot] = false;
+}
+
+void FPoseHistory::BeginFrame(float Time)
+{
+	Head = (Head + 1) % MaxFrames;
+	NumFrames = FMath::Min(NumFrames + 1, MaxFrames);
+	FrameTimes[Head] = Time;
+	FMemory::Memzero(&Valid[Head * MaxSlots], MaxSlots);
+}
+
+void FPoseHistory::SetPose(int32 Slot, const FVector& Location, float InRadius, float InHalfHeight)
+{
+	const int32 Index = Head * MaxSlots + Slot;
+	PosX[Index] = Location.X;
+	PosY[Index] = Location.Y;
+	PosZ[Index] = Location.Z;
+	Radius[Index] = InRadius;
+	HalfHeight[Index] = InHalfHeight;
+	Valid[Index] = 1;
+}
+
+float FPoseHistory::GetOldestTime() const
+{
+	return NumFrames > 0 ? FrameTimes[(Head - NumFrames + 1 + MaxFrames) % MaxFrames] : 0.f;
+}
+
+bool FPoseHistory::FindFrames(float Time, int32& OutOlder, int32& OutNewer, float& OutAlpha) const
+{
+	if (NumFrames == 0) return false;
+
+	// Walk back from the newest frame until one is not newer than Time
+	int32 Newer = Head;
+	for (int32 i = 0; i < NumFrames; i++)
+	{
+		const int32 Frame = (Head - i + MaxFrames) % MaxFrames;
+		if (FrameTimes[Frame] <= Time)
+		{
+			OutOlder = Frame;
+			OutNewer = Newer;
+			const float Span = FrameTimes[Newer] - FrameTimes[Frame];
+			OutAlpha = Span > KINDA_SMALL_NUMBER ? (Time - FrameTimes[Frame]) / Span : 0.f;
+			return true;
+		}
+		Newer = Frame;
+	}
+
+	// Older than the history, use the oldest frame
+	OutOlder = OutNewer = Newer;
+	OutAlpha = 0.f;
+	return true;
+}
+
+// Distance along the shot to where it enters a vertical capsule, false if it misses
+static FORCEINLINE bool IntersectCapsule(const FVector& Start, const FVector& End, const FVector& UnitDir, const FVector& Center, float CapsuleRadius, float CapsuleHalfHeight, float& OutDistance)
+{
+	const FVector Axis(0.f, 0.f, FMath::Max(CapsuleHalfHeight - CapsuleRadius, 0.f));
+
+	// Closest points between the shot and the capsule's axis
+	FVector OnShot, OnAxis;
+	FMath::SegmentDistToSegmentSafe(Start, End, Center - Axis, Center + Axis, OnShot, OnAxis);
+	const float DistSquared = FVector::DistSquared(OnShot, OnAxis);
+	if (DistSquared > CapsuleRadius * CapsuleRadius) return false;
+
+	// Step back from the closest point to approximate where the shot enters the capsule
+	OutDistance = FMath::Max(FVector::DotProduct(OnShot - Start, UnitDir) - FMath::Sqrt(CapsuleRadius * CapsuleRadius - DistSquared), 0.f);
+	return true;
+}
+
+int32 FPoseHistory::Trace(float Time, const FVector& Start, const FVector& End, int32 IgnoreSlot, FVector& OutHitLocation) const
+{
+	int32 Older, Newer;
+	float Alpha;
+	if (!FindFrames(Time, Older, Newer, Alpha)) return INDEX_NONE;
+
+	const FVector Dir = End - Start;
+	const float Length = Dir.Size();
+	if (Length < KINDA_SMALL_NUMBER) return INDEX_NONE;
+	const FVector UnitDir = Dir / Length;
+
+	const float* RESTRICT X0 = &PosX[Older * MaxSlots];
+	const float* RESTRICT Y0 = &PosY[Older * MaxSlots];
+	const float* RESTRICT Z0 = &PosZ[Older * MaxSlots];
+	const float* RESTRICT X1 = &PosX[Newer * MaxSlots];
+	const float* RESTRICT Y1 = &PosY[Newer * MaxSlots];
+	const float* RESTRICT Z1 = &PosZ[Newer * MaxSlots];
+	const float* RESTRICT Radii = &Radius[Newer * MaxSlots];
+	const float* RESTRICT HalfHeights = &HalfHeight[Newer * MaxSlots];
+	const uint8* RESTRICT Valid0 = &Valid[Older * MaxSlots];
+	const uint8* RESTRICT Valid1 = &Valid[Newer * MaxSlots];
+
+	int32 HitSlot = INDEX_NONE;
+	float HitDistance = Length;
+	for (int32 Slot = 0; Slot < MaxSlots; Slot++)
+	{
+		if (!(Valid0[Slot] & Valid1[Slot]) || Slot == IgnoreSlot) continue;
+
+		const FVector Center(FMath::Lerp(X0[Slot], X1[Slot], Alpha), FMath::Lerp(Y0[Slot], Y1[Slot], Alpha), FMath::Lerp(Z0[Slot], Z1[Slot], Alpha));
+		float Distance;
+		if (IntersectCapsule(Start, End, UnitDir, Center, Radii[Slot], HalfHeights[Slot], Distance) && Distance < HitDistance)
+		{
+			HitDistance = Distance;
+			HitSlot = Slot;
+		}
+	}
+
+	if (HitSlot != INDEX_NONE) OutHitLocation = Start + UnitDir * HitDistance;
+	return HitSlot;
+}
+
+void FPoseHistory::TraceMulti(float Time, const FVector& Start, TArrayView<const FVector> Ends, int32 IgnoreSlot, TArray<int32>& OutSlots, TArray<FVector>& OutHitLocations) const
+{
+	OutSlots.Init(INDEX_NONE, Ends.Num());
+	OutHitLocations.Init(FVector::ZeroVector, Ends.Num());
+
+	int32 Older, Newer;
+	float Alpha;
+	if (!FindFrames(Time, Older, Newer, Alpha)) return;
+
+	// Interpolate the capsules once, every segment is traced against the same poses
+	TArray<int32, TInlineAllocator<32>> Slots;
+	TArray<FVector, TInlineAllocator<32>> Centers;
+	for (int32 Slot = 0; Slot < MaxSlots; Slot++)
+	{
+		const int32 Index0 = Older * MaxSlots + Slot;
+		const int32 Index1 = Newer * MaxSlots + Slot;
+		if (!(Valid[Index0] & Valid[Index1]) || Slot == IgnoreSlot) continue;
+
+		Slots.Add(Slot);
+		Centers.Add(FVector(FMath::Lerp(PosX[Index0], PosX[Index1], Alpha), FMath::Lerp(PosY[Index0], PosY[Index1], Alpha), FMath::Lerp(PosZ[Index0], PosZ[Index1], Alpha)));
+	}
+
+	const float* RESTRICT Radii = &Radius[Newer * MaxSlots];
+	const float* RESTRICT HalfHeights = &HalfHeight[Newer * MaxSlots];
+	for (int32 Segment = 0; Segment < Ends.Num(); Segment++)
+	{
+		const FVector& End = Ends[Segment];
+		const FVector Dir = End - Start;
+		const float Length = Dir.Size();
+		if (Length < KINDA_SMALL_NUMBER) continue;
+		const FVector UnitDir = Dir / Length;
+
+		float HitDistance = Length;
+		for (int32 i = 0; i < Slots.Num(); i++)
+		{
+			float Distance;
+			if (IntersectCapsule(Start, End, UnitDir, Centers[i], Radii[Slots[i]], HalfHeights[Slots[i]], Distance) && Distance < HitDistance)
+			{
+				HitDistance = Distance;
+				OutSlots[Segment] = Slots[i];
+			}
+		}
+		if (OutSlots[Segment] != INDEX_NONE) OutHitLocations[Segment] = Start + UnitDir * HitDistance;
+	}
+}
+
+//////////////////////////////////////////////////////////////////////////
+// ULagCompensationSubsystem
+
+void ULagCompensationSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	History.Init(MaxCharacters, MaxFrames);
+	Characters.SetNum(MaxCharacters);
+}
+
+void ULagCompensationSubsystem::Deinitialize()
+{
+	Characters.Reset();
+
+	Super::Deinitialize();
+}
+
+ETickableTickType ULagCompensationSubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool ULagCompensationSubsystem::IsTickable() const
+{
+	const UWorld* World = GetWorld();
+	return World != nullptr && World->IsServer() && World->IsGameWorld();
+}
+
+TStatId ULagCompensationSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(ULagCompensationSubsystem, STATGROUP_Tickables);
+}
+
+void ULagCompensationSubsystem::Tick(float DeltaTime)
+{
+	History.BeginFrame(GetWorld()->GetTimeSeconds());
+
+	for (int32 Slot = 0; Slot < Characters.Num(); Slot++)
+	{
+		const AFirstPersonCharacter* Character = Characters[Slot].Get();
+		if (Character == nullptr) continue;
+
+		const UCapsuleComponent* Capsule = Character->GetCapsuleComponent();
+		History.SetPose(Slot, Capsule->GetComponentLocation(), Capsule->GetScaledCapsuleRadius(), Capsule->GetScaledCapsuleHalfHeight());
+	}
+}
+
+void ULagCompensationSubsystem::RegisterCharacter(AFirstPersonCharacter* Character)
+{
+	if (Characters.Find(Character) != INDEX_NONE) return;
+
+	const int32 Slot = History.AddSlot();
+	if (Slot != INDEX_NONE) Characters[Slot] = Character;
+}
+
+void ULagCompensationSubsystem::UnregisterCharacter(AFirstPersonCharacter* Character)
+{
+	const int32 Slot = Characters.Find(Character);
+	if (Slot != INDEX_NONE)
+	{
+		Characters[Slot].Reset();
+		History.RemoveSlot(Slot);
+	}
+}
+
+float ULagCompensationSubsystem::GetMaxRewind()
+{
+	return CVarMaxRewind.GetValueOnGameThread();
+}
+
+float ULagCompensationSubsystem::GetShooterTime(const AFirstPersonCharacter* Shooter) const
+{
+	// The client sees others about one round trip behind the server by the time its shot arrives
+	const APlayerState* PlayerState = Shooter->GetPlayerState();
+	const float Rewind = PlayerState != nullptr ? PlayerState->ExactPing * 0.001f : 0.f;
+	return GetWorld()->GetTimeSeconds() - FMath::Clamp(Rewind, 0.f, CVarMaxRewind.GetValueOnGameThread());
+}
+
+float ULagCompensationSubsystem::GetShooterTime(const AFirstPersonCharacter* Shooter, float Timestamp) const
+{
+	// Shots without a timestamp fall back to the ping estimate
+	if (Timestamp <= 0.f) return GetShooterTime(Shooter);
+
+	// Shooters can claim to have seen the world as far back as everyone else, but not into the future
+	const float Now = GetWorld()->GetTimeSeconds();
+	return FMath::Clamp(Timestamp, Now - CVarMaxRewind.GetValueOnGameThread(), Now);
+}
+
+AFirstPersonCharacter* ULagCompensationSubsystem::RewindTrace(AFirstPersonCharacter* Shooter, const FVector& Start, const FVector& End, FVector& OutHitLocation) const
+{
+	// Traces against the recorded capsules instead of moving the actors back, so nothing has to be restored
+	const int32 Slot = History.Trace(GetShooterTime(Shooter), Start, End, Characters.Find(Shooter), OutHitLocation);
+	return Slot != INDEX_NONE ? Characters[Slot].Get() : nullptr;
+}
+
+void ULagCompensationSubsystem::RewindTraceMulti(AFirstPersonCharacter* Shooter, float ShotTime, const FVector& Start, TArrayView<const FVector> Directions, float Range,
+	TArray<AFirstPersonCharacter*>& OutVictims, TArray<FVector>& OutHitLocations) const
+{
+	TArray<FVector, TInlineAllocator<16>> Ends;
+	for (const FVector& Direction : Directions) Ends.Add(Start + Direction * Range);
+
+	TArray<int32> Slots;
+	History.TraceMulti(ShotTime, Start, Ends, Characters.Find(Shooter), Slots, OutHitLocations);
+
+	OutVictims.SetNumUninitialized(Slots.Num());
+	for (int32 i = 0; i < Slots.Num(); i++) OutVictims[i] = Slots[i] != INDEX_NONE ? Characters[Slots[i]].Get() : nullptr;
+}
+
+// Fills a history with randomly walking pawns and times rewound shots against it
+static FAutoConsoleCommand LagCompensationBenchmarkCommand(
+	TEXT("fp.Bench.LagCompensation"),
+	TEXT("Times lag compensated shots. Usage: fp.Bench.LagCompensation [Shots=10000] [Pawns=64]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const int32 NumShots = Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 10000;
+		const int32 NumPawns = FMath::Clamp(Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 64, 1, ULagCompensationSubsystem::MaxCharacters);
+		const float TickRate = 1.f / 60.f;
+
+		FRandomStream Random(42);
+		FPoseHistory History;
+		History.Init(ULagCompensationSubsystem::MaxCharacters, ULagCompensationSubsystem::MaxFrames);
+
+		TArray<FVector> Positions, Velocities;
+		for (int32 i = 0; i < NumPawns; i++)
+		{
+			History.AddSlot();
+			Positions.Add(FVector(Random.FRandRange(-5000.f, 5000.f), Random.FRandRange(-5000.f, 5000.f), 96.f));
+			Velocities.Add(FVector(Random.FRandRange(-600.f, 600.f), Random.FRandRange(-600.f, 600.f), 0.f));
+		}
+
+		float Time = 0.f;
+		double RecordSeconds = 0.0;
+		for (int32 Frame = 0; Frame < ULagCompensationSubsystem::MaxFrames; Frame++, Time += TickRate)
+		{
+			const double RecordStart = FPlatformTime::Seconds();
+			History.BeginFrame(Time);
+			for (int32 i = 0; i < NumPawns; i++)
+			{
+				Positions[i] += Velocities[i] * TickRate;
+				History.SetPose(i, Positions[i], 55.f, 96.f);
+			}
+			RecordSeconds += FPlatformTime::Seconds() - RecordStart;
+		}
+
+		// Shots from random pawns aimed near random targets, at random points in the history
+		int32 Hits = 0;
+		const double Start = FPlatformTime::Seconds();
+		for (int32 Shot = 0; Shot < NumShots; Shot++)
+		{
+			const int32 Shooter = Random.RandHelper(NumPawns);
+			const int32 Target = Random.RandHelper(NumPawns);
+			const FVector Aim = Positions[Target] + Random.VRand() * 100.f - Positions[Shooter];
+			FVector HitLocation;
+			const float ShotTime = Random.FRandRange(History.GetOldestTime(), Time);
+			if (History.Trace(ShotTime, Positions[Shooter], Positions[Shooter] + Aim.GetSafeNormal() * 20000.f, Shooter, HitLocation) != INDEX_NONE) Hits++;
+		}
+		const double Elapsed = FPlatformTime::Seconds() - Start;
+
+		UE_LOG(LogFPBench, Display, TEXT("Lag compensation: %d pawns, %d shots, %d hits"), NumPawns, NumShots, Hits);
+		UE_LOG(LogFPBench, Display, TEXT("  record: %.3f us/frame, rewind trace: %.3f us/shot"), RecordSeconds * 1e6 / ULagCompensationSubsystem::MaxFrames, Elapsed * 1e6 / FMath::Max(NumShots, 1));
+	}));
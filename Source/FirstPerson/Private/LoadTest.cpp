@@ -0,0 +1,311 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "LoadTest.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonBotController.h"
+#include "FirstPersonCharacter.h"
+#include "FirstPersonMovementComponent.h"
+#include "FireShot.h"
+#include "NetStats.h"
+#include "EngineUtils.h"
+#include "Engine/NetConnection.h"
+#include "Engine/NetDriver.h"
+#include "GameFramework/GameModeBase.h"
+#include "GameFramework/PlayerController.h"
+#include "GameFramework/PlayerStart.h"
+#include "HAL/PlatformMemory.h"
+#include "Misc/App.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+bool ULoadTestSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	int32 Bots = 0;
+	return FParse::Value(FCommandLine::Get(), TEXT("FPBots="), Bots) || FParse::Param(FCommandLine::Get(), TEXT("FPClientBot"));
+}
+
+void ULoadTestSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	if (!InWorld.IsGameWorld()) return;
+
+	FParse::Value(FCommandLine::Get(), TEXT("FPLoadTestDuration="), Duration);
+
+	if (!InWorld.IsServer())
+	{
+		bClientBot = FParse::Param(FCommandLine::Get(), TEXT("FPClientBot"));
+		bStarted = bClientBot;
+		ClientBrain.SetSeed(FPlatformProcess::GetCurrentProcessId());
+		return;
+	}
+
+	FParse::Value(FCommandLine::Get(), TEXT("FPBots="), NumBots);
+	FParse::Value(FCommandLine::Get(), TEXT("FPLoadTestInterval="), Interval);
+	if (!FParse::Value(FCommandLine::Get(), TEXT("FPLoadTestCSV="), CSVPath)) CSVPath = TEXT("LoadTest.csv");
+	CSVPath = FPaths::Combine(FPaths::ProjectSavedDir(), CSVPath);
+	Interval = FMath::Max(Interval, 0.1f);
+
+	FString NetConditions;
+	if (FParse::Value(FCommandLine::Get(), TEXT("FPLoadTestNet="), NetConditions, false))
+	{
+		FParse::Value(FCommandLine::Get(), TEXT("FPLoadTestStageTime="), StageTime);
+		StageTime = FMath::Max(StageTime, Interval);
+
+		TArray<FString> Conditions;
+		NetConditions.ParseIntoArray(Conditions, TEXT(","));
+		for (const FString& Condition : Conditions)
+		{
+			TArray<FString> Values;
+			Condition.ParseIntoArray(Values, TEXT(":"), false);
+			FNetStage& Stage = NetStages.AddDefaulted_GetRef();
+			Stage.Lag = Values.Num() > 0 ? FCString::Atoi(*Values[0]) : 0;
+			Stage.LagVariance = Values.Num() > 1 ? FCString::Atoi(*Values[1]) : 0;
+			Stage.Loss = Values.Num() > 2 ? FCString::Atoi(*Values[2]) : 0;
+		}
+		if (Duration <= 0.f) Duration = StageTime * NetStages.Num();
+	}
+
+	SpawnBots();
+
+	// Bound after the net driver's TickFlush so called before it, events call their handlers last to first
+	TickFlushHandle = InWorld.OnTickFlush().AddUObject(this, &ULoadTestSubsystem::OnTickFlush);
+	PostTickFlushHandle = InWorld.OnPostTickFlush().AddUObject(this, &ULoadTestSubsystem::OnPostTickFlush);
+
+	FFileHelper::SaveStringToFile(TEXT("Time,Bots,Connections,FrameMs,MaxFrameMs,NetTickMs,MaxNetTickMs,OutBytesPerConnection,MaxOutBytesPerConnection,RPCsPerSecond,CorrectionsPerSecond,PktLag,PktLoss,UsedMemoryMB\n"), *CSVPath);
+	// The RPC rate comes from the net stats, off by default
+	FFirstPersonNetStats::SetEnabled(true);
+	LastRPCCalls = FFirstPersonNetStats::Get().GetTotalRPCCalls();
+	LastCorrections = UFirstPersonMovementComponent::GetNumCorrectionsSent();
+	bStarted = true;
+	if (NetStages.Num() > 0) StartNetStage(0);
+
+	const UNetDriver* NetDriver = InWorld.GetNetDriver();
+	UE_LOG(LogFPBench, Display, TEXT("Load test: %d bots, %s, writing %s every %.1fs"), NumBots,
+		NetDriver != nullptr && NetDriver->GetReplicationDriver() != nullptr ? TEXT("replication graph") : TEXT("net driver relevancy"), *CSVPath, Interval);
+}
+
+void ULoadTestSubsystem::Deinitialize()
+{
+	if (UWorld* World = GetWorld())
+	{
+		World->OnTickFlush().Remove(TickFlushHandle);
+		World->OnPostTickFlush().Remove(PostTickFlushHandle);
+	}
+
+	Super::Deinitialize();
+}
+
+void ULoadTestSubsystem::OnTickFlush(float DeltaSeconds)
+{
+	NetTickStart = FPlatformTime::Seconds();
+}
+
+void ULoadTestSubsystem::OnPostTickFlush()
+{
+	if (NetTickStart <= 0.0) return;
+
+	// Replicating actors to every connection and sending the packets
+	const double Ms = (FPlatformTime::Seconds() - NetTickStart) * 1000.0;
+	NetTickMs += Ms;
+	MaxNetTickMs = FMath::Max(MaxNetTickMs, Ms);
+	NetTicks++;
+	NetTickStart = 0.0;
+}
+
+void ULoadTestSubsystem::StartNetStage(int32 Index)
+{
+	NetStage = Index;
+	StageStartTime = ElapsedTime;
+	StageStartCorrections = UFirstPersonMovementComponent::GetNumCorrectionsSent();
+
+	const FNetStage& Stage = NetStages[Index];
+#if DO_ENABLE_NET_TEST
+	if (UNetDriver* NetDriver = GetWorld()->GetNetDriver())
+	{
+		// Both ways from the server, lost and late moves as much as lost and late corrections
+		FPacketSimulationSettings Settings = NetDriver->PacketSimulationSettings;
+		Settings.PktLag = Stage.Lag;
+		Settings.PktLagVariance = Stage.LagVariance;
+		Settings.PktLoss = Stage.Loss;
+		Settings.PktIncomingLagMin = FMath::Max(Stage.Lag - Stage.LagVariance, 0);
+		Settings.PktIncomingLagMax = Stage.Lag + Stage.LagVariance;
+		Settings.PktIncomingLoss = Stage.Loss;
+		NetDriver->SetPacketSimulationSettings(Settings);
+	}
+#else
+	UE_LOG(LogFPBench, Warning, TEXT("Load test: this build can't simulate network conditions"));
+#endif
+
+	UE_LOG(LogFPBench, Display, TEXT("Load test: PktLag=%d PktLagVariance=%d PktLoss=%d for %.0fs"), Stage.Lag, Stage.LagVariance, Stage.Loss, StageTime);
+}
+
+void ULoadTestSubsystem::EndNetStage()
+{
+	if (!NetStages.IsValidIndex(NetStage)) return;
+
+	const FNetStage& Stage = NetStages[NetStage];
+	const int64 Corrections = UFirstPersonMovementComponent::GetNumCorrectionsSent() - StageStartCorrections;
+	const float Seconds = FMath::Max(ElapsedTime - StageStartTime, 0.001f);
+	const UNetDriver* NetDriver = GetWorld()->GetNetDriver();
+	const int32 NumConnections = FMath::Max(NetDriver != nullptr ? NetDriver->ClientConnections.Num() : 0, 1);
+
+	// Client bots are the only ones whose moves are predicted, and so corrected
+	UE_LOG(LogFPBench, Display, TEXT("Load test: PktLag=%d PktLagVariance=%d PktLoss=%d: %lld movement corrections in %.0fs, %.2f per connection per second"),
+		Stage.Lag, Stage.LagVariance, Stage.Loss, Corrections, Seconds, Corrections / Seconds / NumConnections);
+	NetStage = INDEX_NONE;
+}
+
+void ULoadTestSubsystem::SpawnBots()
+{
+	UWorld* World = GetWorld();
+	const AGameModeBase* GameMode = World->GetAuthGameMode();
+	if (GameMode == nullptr) return;
+
+	TArray<APlayerStart*> Starts;
+	for (TActorIterator<APlayerStart> It(World); It; ++It) Starts.Add(*It);
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButAlwaysSpawn;
+
+	const int32 NumStarts = FMath::Max(Starts.Num(), 1);
+	for (int32 i = 0; i < NumBots; i++)
+	{
+		// Spread bots on a grid around each player start so they don't all pile up on one
+		FTransform Transform = Starts.Num() > 0 ? Starts[i % NumStarts]->GetActorTransform() : FTransform::Identity;
+		const int32 Row = i / NumStarts;
+		Transform.AddToTranslation(FVector(Row % 8 * 150.f, Row / 8 * 150.f, 0.f));
+
+		APawn* Pawn = World->SpawnActor<APawn>(GameMode->DefaultPawnClass, Transform, SpawnParams);
+		if (Pawn == nullptr) continue;
+
+		AFirstPersonBotController* Bot = World->SpawnActor<AFirstPersonBotController>();
+		Bot->SetSeed(i);
+		Bot->Possess(Pawn);
+	}
+}
+
+ETickableTickType ULoadTestSubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool ULoadTestSubsystem::IsTickable() const
+{
+	return bStarted;
+}
+
+TStatId ULoadTestSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(ULoadTestSubsystem, STATGROUP_Tickables);
+}
+
+void ULoadTestSubsystem::Tick(float DeltaTime)
+{
+	if (bClientBot)
+	{
+		TickClientBot(DeltaTime);
+		return;
+	}
+
+	// Busy time of the previous frame, without the wait for the max tick rate
+	const double FrameMs = FMath::Max(FApp::GetDeltaTime() - FApp::GetIdleTime(), 0.0) * 1000.0;
+	BusyMs += FrameMs;
+	MaxBusyMs = FMath::Max(MaxBusyMs, FrameMs);
+	Frames++;
+
+	ElapsedTime += DeltaTime;
+	TimeSinceRow += DeltaTime;
+	if (TimeSinceRow >= Interval)
+	{
+		WriteRow();
+		TimeSinceRow = 0.f;
+		Frames = NetTicks = 0;
+		BusyMs = MaxBusyMs = NetTickMs = MaxNetTickMs = 0.0;
+	}
+
+	if (NetStages.IsValidIndex(NetStage + 1) && ElapsedTime - StageStartTime >= StageTime)
+	{
+		const int32 Next = NetStage + 1;
+		EndNetStage();
+		StartNetStage(Next);
+	}
+
+	if (Duration > 0.f && ElapsedTime >= Duration)
+	{
+		EndNetStage();
+		UE_LOG(LogFPBench, Display, TEXT("Load test finished after %.0fs"), ElapsedTime);
+		bStarted = false;
+		FPlatformMisc::RequestExit(false);
+	}
+}
+
+void ULoadTestSubsystem::TickClientBot(float DeltaTime)
+{
+	ElapsedTime += DeltaTime;
+	if (Duration > 0.f && ElapsedTime >= Duration)
+	{
+		FFireLatencyStats::Dump(*GLog);
+		bStarted = false;
+		FPlatformMisc::RequestExit(false);
+		return;
+	}
+
+	APlayerController* Controller = GetWorld()->GetFirstPlayerController();
+	AFirstPersonCharacter* Character = Controller != nullptr ? Cast<AFirstPersonCharacter>(Controller->GetPawn()) : nullptr;
+	if (Character != nullptr) ClientBrain.Tick(Controller, Character, DeltaTime);
+}
+
+void ULoadTestSubsystem::WriteRow()
+{
+	int32 NumConnections = 0;
+	int64 OutBytes = 0;
+	int32 MaxOutBytes = 0;
+	if (const UNetDriver* NetDriver = GetWorld()->GetNetDriver())
+	{
+		for (const UNetConnection* Connection : NetDriver->ClientConnections)
+		{
+			NumConnections++;
+			OutBytes += Connection->OutBytesPerSecond;
+			MaxOutBytes = FMath::Max(MaxOutBytes, Connection->OutBytesPerSecond);
+		}
+	}
+
+	const int64 RPCCalls = FFirstPersonNetStats::Get().GetTotalRPCCalls();
+	const int64 NewRPCCalls = FMath::Max<int64>(RPCCalls - LastRPCCalls, 0);
+	LastRPCCalls = RPCCalls;
+
+	const int64 Corrections = UFirstPersonMovementComponent::GetNumCorrectionsSent();
+	const int64 NewCorrections = FMath::Max<int64>(Corrections - LastCorrections, 0);
+	LastCorrections = Corrections;
+
+	int32 PktLag = 0;
+	int32 PktLoss = 0;
+#if DO_ENABLE_NET_TEST
+	if (const UNetDriver* NetDriver = GetWorld()->GetNetDriver())
+	{
+		PktLag = NetDriver->PacketSimulationSettings.PktLag;
+		PktLoss = NetDriver->PacketSimulationSettings.PktLoss;
+	}
+#endif
+
+	const FString Row = FString::Printf(TEXT("%.1f,%d,%d,%.3f,%.3f,%.3f,%.3f,%lld,%d,%.1f,%.1f,%d,%d,%.1f\n"),
+		ElapsedTime,
+		NumBots,
+		NumConnections,
+		Frames > 0 ? BusyMs / Frames : 0.0,
+		MaxBusyMs,
+		NetTicks > 0 ? NetTickMs / NetTicks : 0.0,
+		MaxNetTickMs,
+		NumConnections > 0 ? OutBytes / NumConnections : 0,
+		MaxOutBytes,
+		NewRPCCalls / TimeSinceRow,
+		NewCorrections / TimeSinceRow,
+		PktLag,
+		PktLoss,
+		FPlatformMemory::GetStats().UsedPhysical / (1024.0 * 1024.0));
+
+	FFileHelper::SaveStringToFile(Row, *CSVPath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), FILEWRITE_Append);
+}
@@ -0,0 +1,254 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "MatchReplay.h"
+#include "FirstPersonBenchmark.h"
+#include "Containers/Ticker.h"
+#include "Engine/DemoNetDriver.h"
+#include "Engine/GameInstance.h"
+#include "Engine/World.h"
+#include "GameFramework/GameStateBase.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Paths.h"
+
+void UMatchReplaySubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	FString Name;
+	if (FParse::Value(FCommandLine::Get(), TEXT("FPRecordReplay="), Name) || FParse::Param(FCommandLine::Get(), TEXT("FPRecordReplay")))
+	{
+		StartRecording(Name);
+	}
+}
+
+void UMatchReplaySubsystem::Deinitialize()
+{
+	FinishRecording(true);
+
+	Super::Deinitialize();
+}
+
+ETickableTickType UMatchReplaySubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool UMatchReplaySubsystem::IsTickable() const
+{
+	return IsRecording();
+}
+
+TStatId UMatchReplaySubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UMatchReplaySubsystem, STATGROUP_Tickables);
+}
+
+void UMatchReplaySubsystem::Tick(float DeltaTime)
+{
+	// Stopped by demostop or the replay subsystem of the game instance
+	if (!IsRecordingShots(GetWorld()))
+	{
+		StopRecording();
+		return;
+	}
+
+	const AGameStateBase* GameState = GetWorld()->GetGameState();
+	PlayerSeconds += (GameState != nullptr ? GameState->PlayerArray.Num() : 0) * DeltaTime;
+	RecordedSeconds += DeltaTime;
+}
+
+bool UMatchReplaySubsystem::StartRecording(const FString& Name)
+{
+	UWorld* World = GetWorld();
+	UGameInstance* GameInstance = World->GetGameInstance();
+	if (!World->IsGameWorld() || !World->IsServer() || GameInstance == nullptr) return false;
+
+	StopRecording();
+
+	const FString MapName = World->GetMapName();
+	const FString NewName = Name.IsEmpty() ? FString::Printf(TEXT("%s_%s"), *MapName, *FDateTime::Now().ToString()) : Name;
+	GameInstance->StartRecordingReplay(NewName, MapName);
+	if (!IsRecordingShots(World))
+	{
+		UE_LOG(LogFPBench, Error, TEXT("Replay: can't record %s"), *NewName);
+		return false;
+	}
+
+	ReplayName = NewName;
+	PlayerSeconds = 0.0;
+	RecordedSeconds = 0.0;
+	UE_LOG(LogFPBench, Display, TEXT("Replay: recording %s"), *ReplayName);
+	return true;
+}
+
+// Size of a replay per player-minute, measured once the streamer stopped writing it
+struct FReplaySizeReport
+{
+	FString Path;
+	double Minutes = 0.0;
+	double PlayerMinutes = 0.0;
+	int64 LastSize = -1;
+
+	// True once the file is the same size as the last time
+	bool IsComplete()
+	{
+		const int64 Size = IFileManager::Get().FileSize(*Path);
+		const bool bComplete = Size > 0 && Size == LastSize;
+		LastSize = Size;
+		return bComplete;
+	}
+
+	void Log(const TCHAR* State) const
+	{
+		if (LastSize < 0)
+		{
+			UE_LOG(LogFPBench, Warning, TEXT("Replay: %s not found"), *Path);
+			return;
+		}
+
+		UE_LOG(LogFPBench, Display, TEXT("Replay: %s%s, %.1f minutes, %.1f player-minutes, %.1f KB, %.1f KB per player-minute"),
+			*Path, State, Minutes, PlayerMinutes, LastSize / 1024.0, PlayerMinutes > 0.0 ? LastSize / 1024.0 / PlayerMinutes : 0.0);
+	}
+};
+
+void UMatchReplaySubsystem::StopRecording()
+{
+	FinishRecording(false);
+}
+
+void UMatchReplaySubsystem::FinishRecording(bool bReportNow)
+{
+	if (!IsRecording()) return;
+
+	UGameInstance* GameInstance = GetWorld()->GetGameInstance();
+	if (GameInstance != nullptr) GameInstance->StopRecordingReplay();
+
+	TSharedRef<FReplaySizeReport> Report = MakeShared<FReplaySizeReport>();
+	Report->Path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Demos"), ReplayName + TEXT(".replay"));
+	Report->Minutes = RecordedSeconds / 60.0;
+	Report->PlayerMinutes = PlayerSeconds / 60.0;
+	ReplayName.Empty();
+
+	if (bReportNow)
+	{
+		Report->IsComplete();
+		Report->Log(TEXT(" (as written when the world ended)"));
+		return;
+	}
+
+	// The streamer completes the file over the next frames, it is measured once it stops growing
+	const double GiveUpTime = FPlatformTime::Seconds() + 30.0;
+	FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([Report, GiveUpTime](float DeltaSeconds)
+	{
+		if (Report->IsComplete())
+		{
+			Report->Log(TEXT(""));
+			return false;
+		}
+		if (FPlatformTime::Seconds() < GiveUpTime) return true;
+
+		Report->Log(TEXT(" (still growing)"));
+		return false;
+	}), 0.5f);
+}
+
+bool UMatchReplaySubsystem::IsRecordingShots(const UWorld* World)
+{
+	const UDemoNetDriver* DemoNetDriver = World != nullptr ? World->GetDemoNetDriver() : nullptr;
+	return DemoNetDriver != nullptr && DemoNetDriver->IsRecording();
+}
+
+// Seeks to each of Times in turn, the next once the previous one completed, then reports how long they took
+static void RunSeeks(TWeakObjectPtr<UDemoNetDriver> WeakDriver, TSharedRef<TArray<float>> Times, TSharedRef<TArray<double>> SeekMs)
+{
+	UDemoNetDriver* DemoNetDriver = WeakDriver.Get();
+	if (DemoNetDriver == nullptr || !DemoNetDriver->IsPlaying()) return;
+
+	if (SeekMs->Num() == Times->Num())
+	{
+		double TotalMs = 0.0;
+		double MaxMs = 0.0;
+		for (double Ms : *SeekMs)
+		{
+			TotalMs += Ms;
+			MaxMs = FMath::Max(MaxMs, Ms);
+		}
+		UE_LOG(LogFPBench, Display, TEXT("Replay seek: %d seeks in %.1f s of replay, %.1f ms avg, %.1f ms max"),
+			SeekMs->Num(), DemoNetDriver->GetDemoTotalTime(), TotalMs / SeekMs->Num(), MaxMs);
+		return;
+	}
+
+	const float Time = (*Times)[SeekMs->Num()];
+	const double Start = FPlatformTime::Seconds();
+	DemoNetDriver->GotoTimeInSeconds(Time, FOnGotoTimeDelegate::CreateLambda([=](bool bWasSuccessful)
+	{
+		SeekMs->Add((FPlatformTime::Seconds() - Start) * 1000.0);
+		if (!bWasSuccessful) UE_LOG(LogFPBench, Warning, TEXT("Replay seek: seeking to %.1f s failed"), Time);
+
+		// The driver is still finishing this seek
+		FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateLambda([=](float DeltaSeconds)
+		{
+			RunSeeks(WeakDriver, Times, SeekMs);
+			return false;
+		}));
+	}));
+}
+
+static UDemoNetDriver* GetPlayingDemoNetDriver(UWorld* World)
+{
+	UDemoNetDriver* DemoNetDriver = World != nullptr ? World->GetDemoNetDriver() : nullptr;
+	if (DemoNetDriver != nullptr && DemoNetDriver->IsPlaying()) return DemoNetDriver;
+
+	UE_LOG(LogFPBench, Warning, TEXT("Replay seek: no replay is playing, start one with demoplay <Name>"));
+	return nullptr;
+}
+
+static FAutoConsoleCommand ReplayRecordCommand(
+	TEXT("fp.Replay.Record"),
+	TEXT("Starts recording the match into a replay, on the server. Usage: fp.Replay.Record [Name]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UMatchReplaySubsystem* Replays = World != nullptr ? World->GetSubsystem<UMatchReplaySubsystem>() : nullptr;
+		if (Replays != nullptr) Replays->StartRecording(Args.Num() > 0 ? Args[0] : FString());
+	}));
+
+static FAutoConsoleCommand ReplayStopCommand(
+	TEXT("fp.Replay.Stop"),
+	TEXT("Stops recording the match and reports the replay's size per player-minute."),
+	FConsoleCommandWithWorldDelegate::CreateLambda([](UWorld* World)
+	{
+		UMatchReplaySubsystem* Replays = World != nullptr ? World->GetSubsystem<UMatchReplaySubsystem>() : nullptr;
+		if (Replays != nullptr) Replays->StopRecording();
+	}));
+
+static FAutoConsoleCommand ReplaySeekCommand(
+	TEXT("fp.Replay.Seek"),
+	TEXT("Seeks the replay being played and reports how long it took. Usage: fp.Replay.Seek <Seconds>"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UDemoNetDriver* DemoNetDriver = GetPlayingDemoNetDriver(World);
+		if (DemoNetDriver == nullptr || Args.Num() == 0) return;
+
+		RunSeeks(DemoNetDriver, MakeShared<TArray<float>>(TArray<float>{ FCString::Atof(*Args[0]) }), MakeShared<TArray<double>>());
+	}));
+
+// Seeks back and forth to random times of the replay, as someone scrubbing through it would
+static FAutoConsoleCommand ReplaySeekBenchmarkCommand(
+	TEXT("fp.Bench.ReplaySeek"),
+	TEXT("Times seeks to random times of the replay being played. Usage: fp.Bench.ReplaySeek [Seeks=10]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UDemoNetDriver* DemoNetDriver = GetPlayingDemoNetDriver(World);
+		if (DemoNetDriver == nullptr) return;
+
+		const int32 NumSeeks = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 10, 1);
+		FRandomStream Random(NumSeeks);
+		TSharedRef<TArray<float>> Times = MakeShared<TArray<float>>();
+		for (int32 i = 0; i < NumSeeks; i++) Times->Add(Random.FRandRange(0.f, DemoNetDriver->GetDemoTotalTime()));
+
+		RunSeeks(DemoNetDriver, Times, MakeShared<TArray<double>>());
+	}));
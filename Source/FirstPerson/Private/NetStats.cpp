@@ -0,0 +1,235 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "NetStats.h"
+#include "Containers/Ticker.h"
+#include "Engine/ActorChannel.h"
+#include "Engine/NetConnection.h"
+#include "Engine/NetDriver.h"
+#include "Engine/PackageMapClient.h"
+#include "GameFramework/Actor.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+#include "UObject/UnrealType.h"
+
+DECLARE_STATS_GROUP(TEXT("FirstPersonNet"), STATGROUP_FirstPersonNet, STATCAT_Advanced);
+DECLARE_DWORD_COUNTER_STAT(TEXT("RPC Calls"), STAT_FirstPersonNet_RPCCalls, STATGROUP_FirstPersonNet);
+DECLARE_DWORD_COUNTER_STAT(TEXT("RPC Bytes"), STAT_FirstPersonNet_RPCBytes, STATGROUP_FirstPersonNet);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Property Updates"), STAT_FirstPersonNet_PropertyUpdates, STATGROUP_FirstPersonNet);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Property Bytes"), STAT_FirstPersonNet_PropertyBytes, STATGROUP_FirstPersonNet);
+
+CSV_DEFINE_CATEGORY(FirstPersonNet, true);
+
+static TAutoConsoleVariable<int32> CVarNetStatsEnable(
+	TEXT("fp.NetStats.Enable"),
+	0,
+	TEXT("Record per-connection RPC and replicated property traffic of gameplay actors. Measuring serializes every recorded value again, ignored in shipping builds."));
+
+static TAutoConsoleVariable<float> CVarNetStatsCsvInterval(
+	TEXT("fp.NetStats.CsvInterval"),
+	0.f,
+	TEXT("Seconds between rows appended to Saved/NetStats.csv, 0 disables the file."));
+
+static FAutoConsoleCommand NetStatsCommand(
+	TEXT("fp.NetStats"),
+	TEXT("Prints RPC and property traffic per connection. Usage: fp.NetStats [reset]"),
+	FConsoleCommandWithWorldArgsAndOutputDeviceDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World, FOutputDevice& Ar)
+	{
+		if (Args.Num() > 0 && Args[0] == TEXT("reset")) FFirstPersonNetStats::Get().Reset();
+		else FFirstPersonNetStats::Get().Dump(Ar);
+	}));
+
+FFirstPersonNetStats& FFirstPersonNetStats::Get()
+{
+	static FFirstPersonNetStats Instance;
+	return Instance;
+}
+
+bool FFirstPersonNetStats::IsEnabled()
+{
+#if UE_BUILD_SHIPPING
+	return false;
+#else
+	return CVarNetStatsEnable.GetValueOnGameThread() != 0;
+#endif
+}
+
+void FFirstPersonNetStats::SetEnabled(bool bEnabled)
+{
+	CVarNetStatsEnable->Set(bEnabled ? 1 : 0, ECVF_SetByCode);
+}
+
+FFirstPersonNetStats::FFirstPersonNetStats()
+{
+	StartTime = FPlatformTime::Seconds();
+	CSVPath = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("NetStats.csv"));
+}
+
+void FFirstPersonNetStats::StartupModule()
+{
+	FFirstPersonNetStats& Stats = Get();
+	Stats.CSVTickerHandle = FTicker::GetCoreTicker().AddTicker(FTickerDelegate::CreateRaw(&Stats, &FFirstPersonNetStats::WriteCSV));
+}
+
+void FFirstPersonNetStats::ShutdownModule()
+{
+	FFirstPersonNetStats& Stats = Get();
+	FTicker::GetCoreTicker().RemoveTicker(Stats.CSVTickerHandle);
+	Stats.CSVTickerHandle.Reset();
+}
+
+void FFirstPersonNetStats::SerializeParam(FNetBitWriter& Writer, const FRotator& Value)
+{
+	bool bSuccess = true;
+	FRotator Rotation = Value;
+	Rotation.NetSerialize(Writer, nullptr, bSuccess);
+}
+
+void FFirstPersonNetStats::SerializeParam(FNetBitWriter& Writer, bool Value)
+{
+	Writer.WriteBit(Value);
+}
+
+int64 FFirstPersonNetStats::MeasurePropertyBits(const AActor* Actor, FName Name)
+{
+	const FProperty* Property = FindFProperty<FProperty>(Actor->GetClass(), Name);
+	if (Property == nullptr) return 0;
+
+	// Enums and bools take fewer bits than their memory, custom structs go through their NetSerialize
+	FNetBitWriter Writer(nullptr, 1024);
+	Property->NetSerializeItem(Writer, nullptr, const_cast<void*>(Property->ContainerPtrToValuePtr<void>(Actor)));
+	return Writer.GetNumBits();
+}
+
+void FFirstPersonNetStats::RecordRPCBits(AActor* Actor, FName Name, int64 Bits)
+{
+	if (Record(Actor, Actor->GetNetConnection(), Name, Bits, true)) CountRPCCall();
+}
+
+void FFirstPersonNetStats::RecordMulticastBits(AActor* Actor, FName Name, int64 Bits)
+{
+	const UNetDriver* NetDriver = Actor->GetNetDriver();
+	if (NetDriver == nullptr) return;
+
+	// Multicasts only go where the actor has a channel, each connection's traffic is recorded but the call once
+	bool bSent = false;
+	for (UNetConnection* Connection : NetDriver->ClientConnections)
+	{
+		if (Connection->FindActorChannelRef(Actor) != nullptr) bSent |= Record(Actor, Connection, Name, Bits, true);
+	}
+	if (bSent) CountRPCCall();
+}
+
+void FFirstPersonNetStats::RecordPropertyBits(AActor* Actor, FName Name, int64 Bits, bool bSkipOwner)
+{
+	if (const UNetDriver* NetDriver = Actor->GetNetDriver())
+	{
+		const UNetConnection* OwnerConnection = bSkipOwner ? Actor->GetNetConnection() : nullptr;
+		for (UNetConnection* Connection : NetDriver->ClientConnections)
+		{
+			if (Connection != OwnerConnection && Connection->FindActorChannelRef(Actor) != nullptr) Record(Actor, Connection, Name, Bits, false);
+		}
+	}
+}
+
+void FFirstPersonNetStats::RecordDeltaPropertyBits(const FNetDeltaSerializeInfo& DeltaParms, FName Name, int64 Bits)
+{
+	const UPackageMapClient* PackageMap = Cast<UPackageMapClient>(DeltaParms.Map);
+	AActor* Actor = Cast<AActor>(DeltaParms.Object);
+	if (PackageMap != nullptr && Actor != nullptr) Record(Actor, PackageMap->GetConnection(), Name, Bits, false);
+}
+
+bool FFirstPersonNetStats::Record(AActor* Actor, UNetConnection* Connection, FName Name, int64 Bits, bool bRPC)
+{
+	if (Connection == nullptr) return false;
+
+	FConnectionStats* Stats = Connections.Find(Connection);
+	if (Stats == nullptr)
+	{
+		Stats = &Connections.Add(Connection);
+		Stats->Address = Connection->LowLevelGetRemoteAddress(true);
+	}
+
+	FNetStatsEntry& Entry = Stats->Entries.FindOrAdd(Name);
+	Entry.Calls++;
+	Entry.Bits += Bits;
+	if (const UActorChannel* Channel = Connection->FindActorChannelRef(Actor))
+	{
+		Entry.MaxReliableBuffer = FMath::Max(Entry.MaxReliableBuffer, Channel->NumOutRec);
+	}
+
+	const uint32 Bytes = (Bits + 7) / 8;
+	if (bRPC)
+	{
+		INC_DWORD_STAT_BY(STAT_FirstPersonNet_RPCBytes, Bytes);
+	}
+	else
+	{
+		INC_DWORD_STAT(STAT_FirstPersonNet_PropertyUpdates);
+		INC_DWORD_STAT_BY(STAT_FirstPersonNet_PropertyBytes, Bytes);
+	}
+
+#if CSV_PROFILER
+	FCsvProfiler::RecordCustomStat(Name, CSV_CATEGORY_INDEX(FirstPersonNet), int32(Bytes), ECsvCustomStatOp::Accumulate);
+#endif
+	return true;
+}
+
+void FFirstPersonNetStats::CountRPCCall()
+{
+	TotalRPCCalls++;
+	INC_DWORD_STAT(STAT_FirstPersonNet_RPCCalls);
+}
+
+void FFirstPersonNetStats::Dump(FOutputDevice& Ar) const
+{
+	const double Seconds = FMath::Max(FPlatformTime::Seconds() - StartTime, 1.0);
+	Ar.Logf(TEXT("Net stats over %.0fs:"), Seconds);
+
+	for (const TPair<TWeakObjectPtr<UNetConnection>, FConnectionStats>& Connection : Connections)
+	{
+		Ar.Logf(TEXT("  %s%s"), *Connection.Value.Address, Connection.Key.IsValid() ? TEXT("") : TEXT(" (closed)"));
+		for (const TPair<FName, FNetStatsEntry>& Entry : Connection.Value.Entries)
+		{
+			Ar.Logf(TEXT("    %-24s %8lld calls %8.1f/s %10lld bytes %8.1f B/s  max reliable %d"),
+				*Entry.Key.ToString(), Entry.Value.Calls, Entry.Value.Calls / Seconds, Entry.Value.Bits / 8, Entry.Value.Bits / 8.0 / Seconds, Entry.Value.MaxReliableBuffer);
+		}
+	}
+}
+
+void FFirstPersonNetStats::Reset()
+{
+	Connections.Reset();
+	TotalRPCCalls = 0;
+	StartTime = FPlatformTime::Seconds();
+}
+
+bool FFirstPersonNetStats::WriteCSV(float DeltaTime)
+{
+	const float Interval = CVarNetStatsCsvInterval.GetValueOnGameThread();
+	if (Interval <= 0.f) return true;
+
+	TimeSinceCSV += DeltaTime;
+	if (TimeSinceCSV < Interval) return true;
+	TimeSinceCSV = 0.f;
+
+	if (!IFileManager::Get().FileExists(*CSVPath))
+	{
+		FFileHelper::SaveStringToFile(TEXT("Time,Connection,Name,Calls,Bytes,MaxReliableBuffer\n"), *CSVPath);
+	}
+
+	// Totals since the last reset, consecutive rows give the rates
+	const double Time = FPlatformTime::Seconds() - StartTime;
+	FString Rows;
+	for (const TPair<TWeakObjectPtr<UNetConnection>, FConnectionStats>& Connection : Connections)
+	{
+		for (const TPair<FName, FNetStatsEntry>& Entry : Connection.Value.Entries)
+		{
+			Rows += FString::Printf(TEXT("%.1f,%s,%s,%lld,%lld,%d\n"), Time, *Connection.Value.Address, *Entry.Key.ToString(), Entry.Value.Calls, Entry.Value.Bits / 8, Entry.Value.MaxReliableBuffer);
+		}
+	}
+	FFileHelper::SaveStringToFile(Rows, *CSVPath, FFileHelper::EEncodingOptions::AutoDetect, &IFileManager::Get(), FILEWRITE_Append);
+	return true;
+}
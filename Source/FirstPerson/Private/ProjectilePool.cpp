@@ -0,0 +1,230 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ProjectilePool.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonCharacter.h"
+#include "FirstPersonProjectile.h"
+#include "Engine/World.h"
+#include "GameFramework/GameModeBase.h"
+#include "HAL/IConsoleManager.h"
+#include "UObject/UObjectArray.h"
+
+static TAutoConsoleVariable<int32> CVarProjectilePool(
+	TEXT("fp.ProjectilePool.Enable"),
+	1,
+	TEXT("Fire projectiles from UProjectilePoolSubsystem instead of spawning an actor per shot."));
+
+void FProjectilePool::AddNewest(AFirstPersonProjectile* Projectile)
+{
+	Projectile->PoolPrev = Newest;
+	Projectile->PoolNext = nullptr;
+	if (Newest != nullptr) Newest->PoolNext = Projectile;
+	else Oldest = Projectile;
+	Newest = Projectile;
+}
+
+void FProjectilePool::Remove(AFirstPersonProjectile* Projectile)
+{
+	if (Projectile->PoolPrev != nullptr) Projectile->PoolPrev->PoolNext = Projectile->PoolNext;
+	else Oldest = Projectile->PoolNext;
+	if (Projectile->PoolNext != nullptr) Projectile->PoolNext->PoolPrev = Projectile->PoolPrev;
+	else Newest = Projectile->PoolPrev;
+	Projectile->PoolPrev = Projectile->PoolNext = nullptr;
+}
+
+void UProjectilePoolSubsystem::Deinitialize()
+{
+	Pools.Reset();
+
+	Super::Deinitialize();
+}
+
+AFirstPersonProjectile* UProjectilePoolSubsystem::SpawnProjectile(UWorld* World, TSubclassOf<AFirstPersonProjectile> Class, const FVector& Location, const FRotator& Rotation)
+{
+	if (CVarProjectilePool.GetValueOnGameThread() != 0)
+	{
+		return World->GetSubsystem<UProjectilePoolSubsystem>()->Acquire(Class, Location, Rotation);
+	}
+
+	//Set Spawn Collision Handling Override
+	FActorSpawnParameters ActorSpawnParams;
+	ActorSpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AdjustIfPossibleButDontSpawnIfColliding;
+
+	return World->SpawnActor<AFirstPersonProjectile>(Class, Location, Rotation, ActorSpawnParams);
+}
+
+AFirstPersonProjectile* UProjectilePoolSubsystem::Acquire(TSubclassOf<AFirstPersonProjectile> Class, const FVector& Location, const FRotator& Rotation)
+{
+	if (Class == nullptr) return nullptr;
+
+	FProjectilePool& Pool = Pools.FindOrAdd(Class);
+
+	AFirstPersonProjectile* Projectile = nullptr;
+	if (Pool.Free.Num() > 0)
+	{
+		Projectile = Pool.Free.Pop(false);
+		Stats.Hits++;
+	}
+	else
+	{
+		Stats.Misses++;
+		switch (OverflowPolicy)
+		{
+			case EProjectilePoolOverflow::Grow:
+			{
+				Projectile = SpawnPooled(Class);
+				break;
+			}
+			case EProjectilePoolOverflow::RecycleOldest:
+			{
+				// Still flying: its timer, movement and collision are stopped before it is fired again
+				if (Pool.Oldest != nullptr)
+				{
+					Projectile = Pool.Oldest;
+					Pool.Remove(Projectile);
+					Projectile->OnReleased();
+					Stats.Active--;
+				}
+				else Projectile = SpawnPooled(Class);
+				break;
+			}
+			case EProjectilePoolOverflow::Drop:
+			{
+				return nullptr;
+			}
+		}
+	}
+
+	if (Projectile == nullptr) return nullptr;
+
+	Pool.AddNewest(Projectile);
+	Projectile->bPoolActive = true;
+	Projectile->PoolGeneration++;
+	Stats.Active++;
+	Stats.Peak = FMath::Max(Stats.Peak, Stats.Active);
+
+	Projectile->OnAcquired(Location, Rotation);
+	return Projectile;
+}
+
+void UProjectilePoolSubsystem::Release(AFirstPersonProjectile* Projectile)
+{
+	FProjectilePool* Pool = Pools.Find(Projectile->GetClass());
+	if (Pool == nullptr || !Projectile->bPoolActive) return;
+
+	Pool->Remove(Projectile);
+	Projectile->bPoolActive = false;
+	Projectile->OnReleased();
+	Pool->Free.Add(Projectile);
+	Stats.Active--;
+}
+
+void UProjectilePoolSubsystem::Prewarm(TSubclassOf<AFirstPersonProjectile> Class)
+{
+	if (Class == nullptr) return;
+
+	FProjectilePool& Pool = Pools.FindOrAdd(Class);
+	while (Pool.All.Num() < PoolSize)
+	{
+		AFirstPersonProjectile* Projectile = SpawnPooled(Class);
+		if (Projectile == nullptr) break;
+		Pool.Free.Add(Projectile);
+	}
+}
+
+void UProjectilePoolSubsystem::ResetStats()
+{
+	const int32 Active = Stats.Active;
+	Stats = FProjectilePoolStats();
+	Stats.Active = Stats.Peak = Active;
+}
+
+AFirstPersonProjectile* UProjectilePoolSubsystem::SpawnPooled(TSubclassOf<AFirstPersonProjectile> Class)
+{
+	FActorSpawnParameters ActorSpawnParams;
+	ActorSpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+	AFirstPersonProjectile* Projectile = GetWorld()->SpawnActor<AFirstPersonProjectile>(Class, FVector::ZeroVector, FRotator::ZeroRotator, ActorSpawnParams);
+	if (Projectile != nullptr)
+	{
+		// The pool decides when the projectile ends, not InitialLifeSpan
+		Projectile->bPooled = true;
+		Projectile->SetLifeSpan(0.f);
+		Projectile->OnReleased();
+		Pools.FindOrAdd(Class).All.Add(Projectile);
+	}
+	return Projectile;
+}
+
+// Fires projectiles at a fixed rate, first spawning an actor per shot and then from the pool
+static FAutoConsoleCommand ProjectilePoolBenchmarkCommand(
+	TEXT("fp.Bench.ProjectilePool"),
+	TEXT("Compares spawning and pooling projectiles. Usage: fp.Bench.ProjectilePool [ShotsPerSecond=1000] [Frames=600]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		const float ShotsPerSecond = Args.Num() > 0 ? FCString::Atof(*Args[0]) : 1000.f;
+		const int32 NumFrames = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 600;
+
+		TSubclassOf<AFirstPersonProjectile> Class = AFirstPersonProjectile::StaticClass();
+		const AGameModeBase* GameMode = World != nullptr ? World->GetAuthGameMode() : nullptr;
+		if (GameMode == nullptr) return;
+		if (const AFirstPersonCharacter* Character = Cast<AFirstPersonCharacter>(GameMode->DefaultPawnClass.GetDefaultObject()))
+		{
+			if (Character->ProjectileClass != nullptr) Class = Character->ProjectileClass;
+		}
+
+		TWeakObjectPtr<UWorld> WeakWorld = World;
+		const int32 PreviousMode = CVarProjectilePool.GetValueOnGameThread();
+
+		auto RunMode = [=](int32 PoolMode, TFunction<void(const FirstPersonBenchmark::FFrameStats&, double, int32)> OnDone)
+		{
+			CVarProjectilePool->Set(PoolMode);
+			TSharedRef<float> ShotsDue = MakeShared<float>(0.f);
+			TSharedRef<double> FireSeconds = MakeShared<double>(0.0);
+			TSharedRef<int32> Objects = MakeShared<int32>(GUObjectArray.GetObjectArrayNumMinusAvailable());
+
+			FirstPersonBenchmark::RunFrames(NumFrames, [=](float DeltaSeconds)
+			{
+				UWorld* CurrentWorld = WeakWorld.Get();
+				if (CurrentWorld == nullptr) return;
+
+				const double Start = FPlatformTime::Seconds();
+				for (*ShotsDue += ShotsPerSecond * DeltaSeconds; *ShotsDue >= 1.f; *ShotsDue -= 1.f)
+				{
+					// Straight up from above the origin, so shots rarely hit anything
+					const FRotator Rotation(FMath::FRandRange(60.f, 90.f), FMath::FRandRange(0.f, 360.f), 0.f);
+					UProjectilePoolSubsystem::SpawnProjectile(CurrentWorld, Class, FVector(0.f, 0.f, 5000.f), Rotation);
+				}
+				*FireSeconds += FPlatformTime::Seconds() - Start;
+			},
+			[=](const FirstPersonBenchmark::FFrameStats& Stats)
+			{
+				OnDone(Stats, *FireSeconds, GUObjectArray.GetObjectArrayNumMinusAvailable() - *Objects);
+			});
+		};
+
+		auto Report = [=](const TCHAR* Name, const FirstPersonBenchmark::FFrameStats& Stats, double FireSeconds, int32 ObjectDelta)
+		{
+			UE_LOG(LogFPBench, Display, TEXT("  %s: frame %.3f ms avg, %.3f ms max, firing %.3f ms/frame, %d GCs, %+d UObjects"),
+				Name, Stats.AverageMs(), Stats.MaxBusyMs, FireSeconds * 1000.0 / FMath::Max(Stats.Frames, 1), Stats.GarbageCollections, ObjectDelta);
+		};
+
+		UE_LOG(LogFPBench, Display, TEXT("Projectile pool: %.0f shots/s over %d frames"), ShotsPerSecond, NumFrames);
+		RunMode(0, [=](const FirstPersonBenchmark::FFrameStats& SpawnStats, double SpawnSeconds, int32 SpawnObjects)
+		{
+			Report(TEXT("SpawnActor"), SpawnStats, SpawnSeconds, SpawnObjects);
+
+			if (UWorld* CurrentWorld = WeakWorld.Get()) CurrentWorld->GetSubsystem<UProjectilePoolSubsystem>()->ResetStats();
+			RunMode(1, [=](const FirstPersonBenchmark::FFrameStats& PoolStats, double PoolSeconds, int32 PoolObjects)
+			{
+				Report(TEXT("Pool"), PoolStats, PoolSeconds, PoolObjects);
+				if (UWorld* CurrentWorld = WeakWorld.Get())
+				{
+					const FProjectilePoolStats& Stats = CurrentWorld->GetSubsystem<UProjectilePoolSubsystem>()->GetStats();
+					UE_LOG(LogFPBench, Display, TEXT("  Pool hits %d, misses %d, peak %d"), Stats.Hits, Stats.Misses, Stats.Peak);
+				}
+				CVarProjectilePool->Set(PreviousMode);
+			});
+		});
+	}));
@@ -0,0 +1,344 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "ProjectileSimulation.h"
+#include "DamageQueue.h"
+#include "FireShot.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonCharacter.h"
+#include "FirstPersonProjectile.h"
+#include "FirstPersonStats.h"
+#include "ProjectilePool.h"
+#include "Async/ParallelFor.h"
+#include "Components/SphereComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/ProjectileMovementComponent.h"
+#include "HAL/IConsoleManager.h"
+
+DECLARE_CYCLE_STAT(TEXT("Simulated Projectile Hit"), STAT_FirstPerson_SimulatedHit, STATGROUP_FirstPerson);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Simulated Hits"), STAT_FirstPerson_NumSimulatedHits, STATGROUP_FirstPerson);
+
+static TAutoConsoleVariable<int32> CVarBatchedSimulation(
+	TEXT("fp.Projectile.BatchedSimulation"),
+	1,
+	TEXT("Simulate projectiles in UProjectileSimulationSubsystem instead of one ProjectileMovementComponent per actor."));
+
+static TAutoConsoleVariable<int32> CVarParallelSweepThreshold(
+	TEXT("fp.Projectile.ParallelSweepThreshold"),
+	256,
+	TEXT("Number of projectiles from which sweeps are spread across worker threads. 0 never does."));
+
+void UProjectileSimulationSubsystem::Deinitialize()
+{
+	Reset();
+
+	Super::Deinitialize();
+}
+
+ETickableTickType UProjectileSimulationSubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool UProjectileSimulationSubsystem::IsTickable() const
+{
+	return PosX.Num() > 0;
+}
+
+TStatId UProjectileSimulationSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UProjectileSimulationSubsystem, STATGROUP_Tickables);
+}
+
+void UProjectileSimulationSubsystem::Fire(UWorld* World, TSubclassOf<AFirstPersonProjectile> Class, const FVector& Location, const FRotator& Rotation,
+	AFirstPersonCharacter* Instigator, int32 InDamage, EWeaponType Weapon, uint16 ShotId, float FastForward)
+{
+	if (Class == nullptr) return;
+
+	if (IsBatched())
+	{
+		// The dedicated server has nobody to show the projectile to
+		World->GetSubsystem<UProjectileSimulationSubsystem>()->Add(Class, Location, Rotation, !IsRunningDedicatedServer(), Instigator, InDamage, Weapon, ShotId, FastForward);
+	}
+	else if (AFirstPersonProjectile* Projectile = UProjectilePoolSubsystem::SpawnProjectile(World, Class, Location, Rotation))
+	{
+		Projectile->SetInstigator(Instigator);
+		Projectile->Damage = InDamage;
+		Projectile->Weapon = Weapon;
+
+		// Straight ahead, stopping at whatever is in the way
+		if (FastForward > 0.f) Projectile->SetActorLocation(Location + Projectile->GetVelocity() * FastForward, true);
+	}
+}
+
+bool UProjectileSimulationSubsystem::IsBatched()
+{
+	return CVarBatchedSimulation.GetValueOnGameThread() != 0;
+}
+
+int32 UProjectileSimulationSubsystem::FindOrAddClassParams(TSubclassOf<AFirstPersonProjectile> Class)
+{
+	const int32 Found = ClassParams.IndexOfByPredicate([Class](const FProjectileClassParams& Params) { return Params.Class == Class; });
+	if (Found != INDEX_NONE) return Found;
+
+	const AFirstPersonProjectile* Defaults = Class.GetDefaultObject();
+	const UProjectileMovementComponent* Movement = Defaults->GetProjectileMovement();
+	const USphereComponent* Collision = Defaults->GetCollisionComp();
+
+	FProjectileClassParams& Params = ClassParams.AddDefaulted_GetRef();
+	Params.Class = Class;
+	Params.Speed = Movement->InitialSpeed;
+	Params.GravityZ = GetWorld()->GetGravityZ() * Movement->ProjectileGravityScale;
+	Params.Radius = Collision->GetUnscaledSphereRadius();
+	Params.LifeSpan = Defaults->InitialLifeSpan;
+	Params.Bounciness = Movement->Bounciness;
+	Params.Friction = Movement->Friction;
+	Params.bShouldBounce = Movement->bShouldBounce;
+	Params.Channel = Collision->GetCollisionObjectType();
+	Params.ResponseParams = FCollisionResponseParams(Collision->GetCollisionResponseToChannels());
+	return ClassParams.Num() - 1;
+}
+
+int32 UProjectileSimulationSubsystem::Add(TSubclassOf<AFirstPersonProjectile> Class, const FVector& Location, const FRotator& Rotation, bool bWithVisual,
+	AFirstPersonCharacter* Instigator, int32 InDamage, EWeaponType Weapon, uint16 ShotId, float FastForward)
+{
+	const int32 ParamsIndex = FindOrAddClassParams(Class);
+	const FProjectileClassParams& Params = ClassParams[ParamsIndex];
+	const FVector Velocity = Rotation.Vector() * Params.Speed;
+
+	PosX.Add(Location.X);
+	PosY.Add(Location.Y);
+	PosZ.Add(Location.Z);
+	VelX.Add(Velocity.X);
+	VelY.Add(Velocity.Y);
+	VelZ.Add(Velocity.Z);
+	GravityZ.Add(Params.GravityZ);
+	LifeLeft.Add(Params.LifeSpan > 0.f ? Params.LifeSpan : BIG_NUMBER);
+	ClassIndex.Add(ParamsIndex);
+
+	AFirstPersonProjectile* Visual = nullptr;
+	if (bWithVisual)
+	{
+		Visual = GetWorld()->GetSubsystem<UProjectilePoolSubsystem>()->Acquire(Class, Location, Rotation);
+		if (Visual != nullptr) Visual->MakeCosmetic();
+	}
+	Visuals.Add(Visual);
+	VisualGenerations.Add(Visual != nullptr ? Visual->PoolGeneration : 0);
+	Instigators.Add(Instigator);
+	Damage.Add(InDamage);
+	Weapons.Add(Weapon);
+	ShotIds.Add(ShotId);
+	FastForwardTime.Add(FMath::Max(FastForward, 0.f));
+
+	return PosX.Num() - 1;
+}
+
+int32 UProjectileSimulationSubsystem::RemoveShot(const AFirstPersonCharacter* Instigator, uint16 ShotId)
+{
+	int32 Removed = 0;
+	for (int32 i = PosX.Num() - 1; i >= 0; i--)
+	{
+		if (ShotIds[i] == ShotId && Instigators[i].Get() == Instigator)
+		{
+			RemoveAtSwap(i);
+			Removed++;
+		}
+	}
+	return Removed;
+}
+
+void UProjectileSimulationSubsystem::Reset()
+{
+	while (PosX.Num() > 0) RemoveAtSwap(PosX.Num() - 1);
+}
+
+AFirstPersonProjectile* UProjectileSimulationSubsystem::GetVisual(int32 Index) const
+{
+	AFirstPersonProjectile* Visual = Visuals[Index].Get();
+	return Visual != nullptr && Visual->PoolGeneration == VisualGenerations[Index] ? Visual : nullptr;
+}
+
+void UProjectileSimulationSubsystem::RemoveAtSwap(int32 Index)
+{
+	if (AFirstPersonProjectile* Visual = GetVisual(Index)) Visual->Expire();
+
+	PosX.RemoveAtSwap(Index, 1, false);
+	PosY.RemoveAtSwap(Index, 1, false);
+	PosZ.RemoveAtSwap(Index, 1, false);
+	VelX.RemoveAtSwap(Index, 1, false);
+	VelY.RemoveAtSwap(Index, 1, false);
+	VelZ.RemoveAtSwap(Index, 1, false);
+	GravityZ.RemoveAtSwap(Index, 1, false);
+	LifeLeft.RemoveAtSwap(Index, 1, false);
+	ClassIndex.RemoveAtSwap(Index, 1, false);
+	Visuals.RemoveAtSwap(Index, 1, false);
+	VisualGenerations.RemoveAtSwap(Index, 1, false);
+	Instigators.RemoveAtSwap(Index, 1, false);
+	Damage.RemoveAtSwap(Index, 1, false);
+	Weapons.RemoveAtSwap(Index, 1, false);
+	ShotIds.RemoveAtSwap(Index, 1, false);
+	FastForwardTime.RemoveAtSwap(Index, 1, false);
+}
+
+void UProjectileSimulationSubsystem::Tick(float DeltaTime)
+{
+	const int32 Count = PosX.Num();
+	SweepEnd.SetNumUninitialized(Count, false);
+	SweepHits.SetNum(Count, false);
+	SweepBlocked.SetNumUninitialized(Count, false);
+	SweepIgnored.SetNumUninitialized(Count, false);
+
+	// Projectiles start inside or next to their shooter's capsule, resolved here as workers can't read weak pointers
+	for (int32 i = 0; i < Count; i++)
+	{
+		const AFirstPersonCharacter* Instigator = Instigators[i].Get();
+		SweepIgnored[i] = Instigator != nullptr ? Instigator->GetUniqueID() : 0;
+	}
+
+	// Integrate velocities and lifetimes, one straight pass over each array
+	{
+		float* RESTRICT VZ = VelZ.GetData();
+		const float* RESTRICT GZ = GravityZ.GetData();
+		float* RESTRICT Life = LifeLeft.GetData();
+		const float* RESTRICT Forward = FastForwardTime.GetData();
+		for (int32 i = 0; i < Count; i++)
+		{
+			const float Step = DeltaTime + Forward[i];
+			VZ[i] += GZ[i] * Step;
+			Life[i] -= Step;
+		}
+
+		const float* RESTRICT PX = PosX.GetData();
+		const float* RESTRICT PY = PosY.GetData();
+		const float* RESTRICT PZ = PosZ.GetData();
+		const float* RESTRICT VX = VelX.GetData();
+		const float* RESTRICT VY = VelY.GetData();
+		FVector* RESTRICT End = SweepEnd.GetData();
+		for (int32 i = 0; i < Count; i++)
+		{
+			const float Step = DeltaTime + Forward[i];
+			End[i] = FVector(PX[i] + VX[i] * Step, PY[i] + VY[i] * Step, PZ[i] + VZ[i] * Step);
+		}
+
+		// Fast forwarded projectiles have caught up
+		FMemory::Memzero(FastForwardTime.GetData(), Count * sizeof(float));
+	}
+
+	// Sweep every projectile along its step, spread across worker threads for large batches
+	{
+		UWorld* World = GetWorld();
+		const int32 ParallelThreshold = CVarParallelSweepThreshold.GetValueOnGameThread();
+		ParallelFor(Count, [&](int32 i)
+		{
+			FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(ProjectileSimulation), false);
+			if (SweepIgnored[i] != 0) QueryParams.AddIgnoredActor(SweepIgnored[i]);
+
+			const FProjectileClassParams& Params = ClassParams[ClassIndex[i]];
+			const FVector Start(PosX[i], PosY[i], PosZ[i]);
+			SweepBlocked[i] = World->SweepSingleByChannel(SweepHits[i], Start, SweepEnd[i], FQuat::Identity, Params.Channel,
+				FCollisionShape::MakeSphere(Params.Radius), QueryParams, Params.ResponseParams);
+		}, ParallelThreshold <= 0 || Count < ParallelThreshold);
+	}
+
+	// Apply results and dispatch hits on the game thread, back to front so removals don't skip anything
+	for (int32 i = Count - 1; i >= 0; i--)
+	{
+		if (!Resolve(i) || LifeLeft[i] <= 0.f) RemoveAtSwap(i);
+	}
+}
+
+bool UProjectileSimulationSubsystem::Resolve(int32 Index)
+{
+	FVector Velocity(VelX[Index], VelY[Index], VelZ[Index]);
+	FVector Location = SweepEnd[Index];
+
+	if (SweepBlocked[Index])
+	{
+		FIRSTPERSON_SCOPE_CYCLE_COUNTER(SimulatedHit);
+		FIRSTPERSON_INC_COUNTER(SimulatedHits);
+
+		const FHitResult& Hit = SweepHits[Index];
+		OnProjectileHit.Broadcast(Hit, Velocity);
+
+		// Projectiles that deal damage stop in the character they hit
+		AFirstPersonCharacter* Victim = Cast<AFirstPersonCharacter>(Hit.GetActor());
+		const bool bHitCharacter = Victim != nullptr && Victim != Instigators[Index].Get();
+		const float LifeSpan = ClassParams[ClassIndex[Index]].LifeSpan;
+		if (bHitCharacter && LifeSpan > 0.f) FFireLatencyStats::Record(EFireLatencyStage::Flight, LifeSpan - LifeLeft[Index]);
+		if (Damage[Index] > 0 && bHitCharacter)
+		{
+			GetWorld()->GetSubsystem<UDamageQueueSubsystem>()->AddDamage(Victim, Instigators[Index].Get(), Damage[Index], Hit.ImpactPoint, Weapons[Index]);
+			return false;
+		}
+
+		// Started inside a wall or a character it doesn't damage, reflecting it would keep it there
+		if (Hit.bStartPenetrating) return false;
+
+		// Same rule as AFirstPersonProjectile::OnHit for physics objects
+		if (AFirstPersonProjectile::ApplyHitImpulse(Hit.GetActor(), Hit.GetComponent(), Velocity, Hit.Location)) return false;
+
+		const FProjectileClassParams& Params = ClassParams[ClassIndex[Index]];
+		if (!Params.bShouldBounce) return false;
+
+		// Reflect like UProjectileMovementComponent does, losing speed along the normal and to friction
+		const FVector Normal = Hit.Normal;
+		const FVector NormalVelocity = FVector::DotProduct(Velocity, Normal) * Normal;
+		Velocity = (Velocity - NormalVelocity) * (1.f - Params.Friction) - NormalVelocity * Params.Bounciness;
+		Location = Hit.Location;
+
+		// Came to rest
+		if (Velocity.SizeSquared() < FMath::Square(5.f)) return false;
+
+		VelX[Index] = Velocity.X;
+		VelY[Index] = Velocity.Y;
+		VelZ[Index] = Velocity.Z;
+	}
+
+	PosX[Index] = Location.X;
+	PosY[Index] = Location.Y;
+	PosZ[Index] = Location.Z;
+
+	if (AFirstPersonProjectile* Visual = GetVisual(Index))
+	{
+		Visual->SetActorLocationAndRotation(Location, Velocity.Rotation());
+	}
+	return true;
+}
+
+// Times simulation ticks with a growing number of live projectiles
+static FAutoConsoleCommand ProjectileSimulationBenchmarkCommand(
+	TEXT("fp.Bench.ProjectileSimulation"),
+	TEXT("Times batched projectile simulation. Usage: fp.Bench.ProjectileSimulation [Min=100] [Max=20000] [Ticks=30]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (World == nullptr) return;
+
+		const int32 Min = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 100, 1);
+		const int32 Max = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 20000;
+		const int32 NumTicks = FMath::Max(Args.Num() > 2 ? FCString::Atoi(*Args[2]) : 30, 1);
+		const float DeltaTime = 1.f / 30.f;
+
+		UProjectileSimulationSubsystem* Simulation = World->GetSubsystem<UProjectileSimulationSubsystem>();
+		Simulation->Reset();
+
+		UE_LOG(LogFPBench, Display, TEXT("Projectile simulation, %d ticks per count:"), NumTicks);
+		for (int32 Count = Min; ; Count = FMath::Min(Count * 2, Max))
+		{
+			while (Simulation->Num() < Count)
+			{
+				// Upwards from high above the origin so they stay in flight
+				const FRotator Rotation(FMath::FRandRange(30.f, 90.f), FMath::FRandRange(0.f, 360.f), 0.f);
+				Simulation->Add(AFirstPersonProjectile::StaticClass(), FVector(0.f, 0.f, 50000.f), Rotation, false);
+			}
+
+			const double Start = FPlatformTime::Seconds();
+			for (int32 i = 0; i < NumTicks; i++) Simulation->Tick(DeltaTime);
+			const double TickUs = (FPlatformTime::Seconds() - Start) * 1e6 / NumTicks;
+
+			UE_LOG(LogFPBench, Display, TEXT("  %6d projectiles: %10.1f us/tick, %7.1f ns/projectile"), Count, TickUs, TickUs * 1000.0 / Count);
+
+			if (Count >= Max) break;
+		}
+
+		Simulation->Reset();
+	}));
@@ -0,0 +1,357 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Telemetry.h"
+#include "FirstPersonBenchmark.h"
+#include "Engine/World.h"
+#include "GameFramework/Pawn.h"
+#include "GameFramework/PlayerState.h"
+#include "HAL/Event.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/CommandLine.h"
+#include "Misc/Paths.h"
+#include <atomic>
+
+static TAutoConsoleVariable<int32> CVarTelemetry(
+	TEXT("fp.Telemetry.Enabled"),
+	0,
+	TEXT("Record gameplay telemetry of each match on the server. Read when a map loads, -FPTelemetry sets it too."));
+
+// Events of one producing thread, written by that thread only and read by the writer thread only
+struct FTelemetryRing
+{
+	// 2 MB per thread, a few seconds of a busy server's events if the writer falls behind
+	static const uint32 Capacity = 1 << 16;
+
+	FTelemetryRecord Records[Capacity];
+
+	// Count of records written and read, wrapping, indices are taken modulo the capacity
+	std::atomic<uint32> Head{ 0 };
+	std::atomic<uint32> Tail{ 0 };
+};
+
+// A telemetry file being written, and the thread writing it
+class FTelemetryStream : public FRunnable
+{
+public:
+	FTelemetryStream(FArchive* InFile, uint32 InGeneration)
+		: File(InFile)
+		, Generation(InGeneration)
+		, StartSeconds(FPlatformTime::Seconds())
+		, WakeEvent(FPlatformProcess::GetSynchEventFromPool())
+	{
+	}
+
+	virtual ~FTelemetryStream()
+	{
+		FPlatformProcess::ReturnSynchEventToPool(WakeEvent);
+	}
+
+	void StartThread()
+	{
+		Thread = FRunnableThread::Create(this, TEXT("FPTelemetryWriter"), 0, TPri_BelowNormal);
+	}
+
+	// FRunnable interface
+	virtual uint32 Run() override
+	{
+		while (!bStopping.load(std::memory_order_acquire))
+		{
+			WakeEvent->Wait(50);
+			Drain();
+		}
+		Drain();
+		return 0;
+	}
+
+	virtual void Stop() override
+	{
+		bStopping.store(true, std::memory_order_release);
+		WakeEvent->Trigger();
+	}
+	// End of FRunnable interface
+
+	// Stops the thread once everything is written, and completes the header
+	void Close(FTelemetryFileHeader& Header)
+	{
+		Stop();
+		Thread->WaitForCompletion();
+		delete Thread;
+		Thread = nullptr;
+
+		Header.NumRecords = NumWritten;
+		Header.NumDropped = NumDropped.load(std::memory_order_relaxed);
+		File->Seek(0);
+		File->Serialize(&Header, sizeof(Header));
+		File->Close();
+		delete File;
+		File = nullptr;
+	}
+
+	FTelemetryRing* RegisterRing()
+	{
+		FScopeLock Lock(&RingsLock);
+		return Rings.Add_GetRef(MakeUnique<FTelemetryRing>()).Get();
+	}
+
+	bool IsDrained()
+	{
+		FScopeLock Lock(&RingsLock);
+		for (const TUniquePtr<FTelemetryRing>& Ring : Rings)
+		{
+			if (Ring->Head.load(std::memory_order_acquire) != Ring->Tail.load(std::memory_order_acquire)) return false;
+		}
+		return true;
+	}
+
+	void Wake()
+	{
+		WakeEvent->Trigger();
+	}
+
+	// Only the stream's producers may write to their rings, a ring cached for an older stream is stale
+	const uint32 Generation;
+	const double StartSeconds;
+	std::atomic<uint64> NumDropped{ 0 };
+
+private:
+	// Appends every ring's new records to the file, straight from the ring's memory
+	void Drain()
+	{
+		// Rings live as long as the stream, threads registering theirs don't wait for the file
+		{
+			FScopeLock Lock(&RingsLock);
+			DrainRings.Reset();
+			for (const TUniquePtr<FTelemetryRing>& Ring : Rings) DrainRings.Add(Ring.Get());
+		}
+
+		for (FTelemetryRing* Ring : DrainRings)
+		{
+			const uint32 Tail = Ring->Tail.load(std::memory_order_relaxed);
+			const uint32 Head = Ring->Head.load(std::memory_order_acquire);
+			const uint32 Count = Head - Tail;
+			if (Count == 0) continue;
+
+			// In up to two pieces when the records wrap around the end of the ring
+			const uint32 Start = Tail % FTelemetryRing::Capacity;
+			const uint32 First = FMath::Min(Count, FTelemetryRing::Capacity - Start);
+			File->Serialize(&Ring->Records[Start], First * sizeof(FTelemetryRecord));
+			if (First < Count) File->Serialize(&Ring->Records[0], (Count - First) * sizeof(FTelemetryRecord));
+
+			NumWritten += Count;
+			Ring->Tail.store(Head, std::memory_order_release);
+		}
+		File->Flush();
+	}
+
+	FArchive* File;
+	FRunnableThread* Thread = nullptr;
+	FEvent* WakeEvent;
+	std::atomic<bool> bStopping{ false };
+	uint64 NumWritten = 0;
+
+	FCriticalSection RingsLock;
+	TArray<TUniquePtr<FTelemetryRing>> Rings;
+
+	// Copy of Rings the writer thread drains
+	TArray<FTelemetryRing*> DrainRings;
+};
+
+static std::atomic<FTelemetryStream*> ActiveStream{ nullptr };
+static uint32 StreamGeneration = 0;
+static FTelemetryFileHeader ActiveHeader;
+
+// Calls using the active stream, Stop waits for those that got it before it was swapped out
+static std::atomic<int32> NumStreamUsers{ 0 };
+
+struct FScopedStreamUse
+{
+	FScopedStreamUse()
+	{
+		// Counted before the load, so Stop either sees the count or this sees no stream
+		NumStreamUsers.fetch_add(1);
+		Stream = ActiveStream.load();
+	}
+
+	~FScopedStreamUse()
+	{
+		NumStreamUsers.fetch_sub(1);
+	}
+
+	FTelemetryStream* Stream;
+};
+
+// Ring of the calling thread for the active stream
+static thread_local FTelemetryRing* LocalRing = nullptr;
+static thread_local uint32 LocalGeneration = 0;
+
+bool FGameplayTelemetry::Start(const FString& Path, const FString& MapName)
+{
+	Stop();
+
+	FArchive* File = IFileManager::Get().CreateFileWriter(*Path);
+	if (File == nullptr) return false;
+
+	ActiveHeader = FTelemetryFileHeader();
+	ActiveHeader.StartTicks = FDateTime::UtcNow().GetTicks();
+	FCStringAnsi::Strncpy(ActiveHeader.Map, TCHAR_TO_ANSI(*MapName), UE_ARRAY_COUNT(ActiveHeader.Map));
+	File->Serialize(&ActiveHeader, sizeof(ActiveHeader));
+
+	FTelemetryStream* Stream = new FTelemetryStream(File, ++StreamGeneration);
+	Stream->StartThread();
+	ActiveStream.store(Stream, std::memory_order_release);
+	return true;
+}
+
+void FGameplayTelemetry::Stop()
+{
+	FTelemetryStream* Stream = ActiveStream.exchange(nullptr);
+	if (Stream == nullptr) return;
+
+	while (NumStreamUsers.load() != 0) FPlatformProcess::YieldThread();
+
+	Stream->Close(ActiveHeader);
+	delete Stream;
+}
+
+bool FGameplayTelemetry::IsRecording()
+{
+	return ActiveStream.load(std::memory_order_relaxed) != nullptr;
+}
+
+void FGameplayTelemetry::Record(ETelemetryEvent Type, uint32 Subject, uint32 Other, const FVector& Location, uint8 Weapon, int16 Value, uint16 Seed)
+{
+	FScopedStreamUse Use;
+	FTelemetryStream* Stream = Use.Stream;
+	if (Stream == nullptr) return;
+
+	if (LocalGeneration != Stream->Generation)
+	{
+		LocalRing = Stream->RegisterRing();
+		LocalGeneration = Stream->Generation;
+	}
+
+	// Only this thread moves the head, only the writer the tail
+	const uint32 Head = LocalRing->Head.load(std::memory_order_relaxed);
+	if (Head - LocalRing->Tail.load(std::memory_order_acquire) >= FTelemetryRing::Capacity)
+	{
+		Stream->NumDropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	FTelemetryRecord& Record = LocalRing->Records[Head % FTelemetryRing::Capacity];
+	Record.Time = float(FPlatformTime::Seconds() - Stream->StartSeconds);
+	Record.Subject = Subject;
+	Record.Other = Other;
+	Record.X = Location.X;
+	Record.Y = Location.Y;
+	Record.Z = Location.Z;
+	Record.Value = Value;
+	Record.Seed = Seed;
+	Record.Type = uint8(Type);
+	Record.Weapon = Weapon;
+	Record.Padding[0] = Record.Padding[1] = 0;
+
+	LocalRing->Head.store(Head + 1, std::memory_order_release);
+}
+
+void FGameplayTelemetry::Flush()
+{
+	FScopedStreamUse Use;
+	FTelemetryStream* Stream = Use.Stream;
+	if (Stream == nullptr) return;
+
+	while (!Stream->IsDrained())
+	{
+		Stream->Wake();
+		FPlatformProcess::Sleep(0.f);
+	}
+}
+
+uint64 FGameplayTelemetry::GetNumDropped()
+{
+	FScopedStreamUse Use;
+	return Use.Stream != nullptr ? Use.Stream->NumDropped.load(std::memory_order_relaxed) : 0;
+}
+
+uint32 FGameplayTelemetry::GetSubjectId(const AActor* Actor)
+{
+	if (Actor == nullptr) return 0;
+
+	const APawn* Pawn = Cast<APawn>(Actor);
+	const APlayerState* PlayerState = Pawn != nullptr ? Pawn->GetPlayerState() : nullptr;
+	return PlayerState != nullptr ? uint32(PlayerState->GetPlayerId()) : Actor->GetUniqueID();
+}
+
+bool UTelemetrySubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	return CVarTelemetry.GetValueOnGameThread() != 0 || FParse::Param(FCommandLine::Get(), TEXT("FPTelemetry"));
+}
+
+void UTelemetrySubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	// The server sees every event of the match
+	if (!InWorld.IsGameWorld() || !InWorld.IsServer()) return;
+
+	const FString MapName = InWorld.GetMapName();
+	const FString Path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Telemetry"), FString::Printf(TEXT("%s_%s.fptm"), *MapName, *FDateTime::Now().ToString()));
+	bStarted = FGameplayTelemetry::Start(Path, MapName);
+	if (bStarted) UE_LOG(LogFPBench, Display, TEXT("Telemetry: writing %s"), *Path);
+}
+
+void UTelemetrySubsystem::Deinitialize()
+{
+	if (bStarted)
+	{
+		UE_LOG(LogFPBench, Display, TEXT("Telemetry: %llu events dropped"), FGameplayTelemetry::GetNumDropped());
+		FGameplayTelemetry::Stop();
+		bStarted = false;
+	}
+
+	Super::Deinitialize();
+}
+
+// Records events into Benchmark.fptm in batches of half a ring, waiting for the writer between
+// batches so none are dropped, and reports the game thread time of Record alone
+static FAutoConsoleCommand TelemetryBenchmarkCommand(
+	TEXT("fp.Bench.Telemetry"),
+	TEXT("Reports the game thread cost of recording a telemetry event. Usage: fp.Bench.Telemetry [Events=1000000]"),
+	FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+	{
+		const int32 NumEvents = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1000000, 1);
+
+		// There is one stream, its events would end up in the match's file
+		if (FGameplayTelemetry::IsRecording())
+		{
+			UE_LOG(LogFPBench, Warning, TEXT("Telemetry: a match is being recorded, run the benchmark without one"));
+			return;
+		}
+
+		const FString Path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Telemetry"), TEXT("Benchmark.fptm"));
+		if (!FGameplayTelemetry::Start(Path, TEXT("Benchmark"))) return;
+
+		const uint64 DroppedBefore = FGameplayTelemetry::GetNumDropped();
+		const int32 BatchSize = FTelemetryRing::Capacity / 2;
+		double Seconds = 0.0;
+		for (int32 Recorded = 0; Recorded < NumEvents; Recorded += BatchSize)
+		{
+			const int32 Count = FMath::Min(BatchSize, NumEvents - Recorded);
+			const double Start = FPlatformTime::Seconds();
+			for (int32 i = 0; i < Count; i++)
+			{
+				FGameplayTelemetry::Record(ETelemetryEvent::Shot, uint32(i & 63), 0, FVector(float(i), 0.f, 0.f), 1, 0, uint16(i));
+			}
+			Seconds += FPlatformTime::Seconds() - Start;
+			FGameplayTelemetry::Flush();
+		}
+
+		UE_LOG(LogFPBench, Display, TEXT("Telemetry: %d events, %.1f ns per event on the recording thread, %llu dropped, %d bytes per event"),
+			NumEvents, Seconds * 1e9 / NumEvents, FGameplayTelemetry::GetNumDropped() - DroppedBefore, int32(sizeof(FTelemetryRecord)));
+
+		FGameplayTelemetry::Stop();
+	}));
@@ -0,0 +1,65 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TelemetryToCSVCommandlet.h"
+#include "FirstPersonBenchmark.h"
+#include "Telemetry.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/PlatformFilemanager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+static const TCHAR* TelemetryEventNames[] = { TEXT("Shot"), TEXT("Hit"), TEXT("Pickup"), TEXT("Reload"), TEXT("WeaponSwitch"), TEXT("Death") };
+static_assert(UE_ARRAY_COUNT(TelemetryEventNames) == int32(ETelemetryEvent::Num), "Every telemetry event has a name");
+
+int32 UTelemetryToCSVCommandlet::Main(const FString& Params)
+{
+	FString InPath;
+	FString OutPath;
+	if (!FParse::Value(*Params, TEXT("In="), InPath))
+	{
+		UE_LOG(LogFPBench, Error, TEXT("Usage: -run=TelemetryToCSV -In=<file.fptm> [-Out=<file.csv>]"));
+		return 1;
+	}
+	if (!FParse::Value(*Params, TEXT("Out="), OutPath)) OutPath = FPaths::ChangeExtension(InPath, TEXT("csv"));
+
+	// Mapped, the records are read where they are instead of copied into memory first
+	TUniquePtr<IMappedFileHandle> File(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*InPath));
+	TUniquePtr<IMappedFileRegion> Region(File.IsValid() ? File->MapRegion() : nullptr);
+	if (!Region.IsValid() || Region->GetMappedSize() < int64(sizeof(FTelemetryFileHeader)))
+	{
+		UE_LOG(LogFPBench, Error, TEXT("TelemetryToCSV: can't read %s"), *InPath);
+		return 1;
+	}
+
+	const FTelemetryFileHeader& Header = *reinterpret_cast<const FTelemetryFileHeader*>(Region->GetMappedPtr());
+	if (Header.Magic != FTelemetryFileHeader::FileMagic || Header.Version != FTelemetryFileHeader::FileVersion || Header.RecordSize != sizeof(FTelemetryRecord))
+	{
+		UE_LOG(LogFPBench, Error, TEXT("TelemetryToCSV: %s is not a version %d telemetry file"), *InPath, FTelemetryFileHeader::FileVersion);
+		return 1;
+	}
+
+	const int64 NumInFile = (Region->GetMappedSize() - sizeof(FTelemetryFileHeader)) / sizeof(FTelemetryRecord);
+	const int64 NumRecords = Header.NumRecords > 0 ? FMath::Min(int64(Header.NumRecords), NumInFile) : NumInFile;
+	const FTelemetryRecord* Records = reinterpret_cast<const FTelemetryRecord*>(Region->GetMappedPtr() + sizeof(FTelemetryFileHeader));
+
+	FString CSV = TEXT("Time,Event,Subject,Other,X,Y,Z,Weapon,Value,Seed\n");
+	CSV.Reserve(NumRecords * 64);
+	for (int64 i = 0; i < NumRecords; i++)
+	{
+		const FTelemetryRecord& Record = Records[i];
+		const TCHAR* Event = Record.Type < UE_ARRAY_COUNT(TelemetryEventNames) ? TelemetryEventNames[Record.Type] : TEXT("Unknown");
+		CSV += FString::Printf(TEXT("%.4f,%s,%u,%u,%.1f,%.1f,%.1f,%u,%d,%u\n"),
+			Record.Time, Event, Record.Subject, Record.Other, Record.X, Record.Y, Record.Z, Record.Weapon, Record.Value, Record.Seed);
+	}
+
+	if (!FFileHelper::SaveStringToFile(CSV, *OutPath))
+	{
+		UE_LOG(LogFPBench, Error, TEXT("TelemetryToCSV: can't write %s"), *OutPath);
+		return 1;
+	}
+
+	UE_LOG(LogFPBench, Display, TEXT("TelemetryToCSV: %lld events of %hs written to %s, %llu were dropped while recording"),
+		NumRecords, Header.Map, *OutPath, Header.NumDropped);
+	return 0;
+}
@@ -0,0 +1,224 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "TraceQueue.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonCharacter.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+
+static TAutoConsoleVariable<int32> CVarTraceQueueAsync(
+	TEXT("fp.TraceQueue.Async"),
+	1,
+	TEXT("Run queued gameplay traces through the engine's async traces, results arrive next frame. 0 runs them on the spot."));
+
+static TAutoConsoleVariable<int32> CVarTraceQueueMaxPerFrame(
+	TEXT("fp.TraceQueue.MaxPerFrame"),
+	0,
+	TEXT("Maximum number of queued traces handed to the engine per frame, the rest wait for the next one. 0 is no limit."));
+
+void UTraceQueueSubsystem::Initialize(FSubsystemCollectionBase& Collection)
+{
+	Super::Initialize(Collection);
+
+	TraceDelegate.BindUObject(this, &UTraceQueueSubsystem::OnTraceDone);
+}
+
+void UTraceQueueSubsystem::Deinitialize()
+{
+	TraceDelegate.Unbind();
+	Queued.Reset();
+	Pending.Reset();
+
+	Super::Deinitialize();
+}
+
+ETickableTickType UTraceQueueSubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool UTraceQueueSubsystem::IsTickable() const
+{
+	return Queued.Num() > 0;
+}
+
+TStatId UTraceQueueSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UTraceQueueSubsystem, STATGROUP_Tickables);
+}
+
+void UTraceQueueSubsystem::LineTrace(const UObject* Owner, EAsyncTraceType Type, const FVector& Start, const FVector& End, ECollisionChannel Channel,
+	const FCollisionQueryParams& Params, FTraceQueueCallback Callback)
+{
+	Submit(FQueuedTrace{ Start, End, FQuat::Identity, FCollisionShape::LineShape, Channel, Params, Type, Owner, MoveTemp(Callback) });
+}
+
+void UTraceQueueSubsystem::Sweep(const UObject* Owner, EAsyncTraceType Type, const FVector& Start, const FVector& End, const FQuat& Rotation, const FCollisionShape& Shape,
+	ECollisionChannel Channel, const FCollisionQueryParams& Params, FTraceQueueCallback Callback)
+{
+	Submit(FQueuedTrace{ Start, End, Rotation, Shape, Channel, Params, Type, Owner, MoveTemp(Callback) });
+}
+
+void UTraceQueueSubsystem::Submit(FQueuedTrace&& Trace)
+{
+	if (CVarTraceQueueAsync.GetValueOnGameThread() != 0) Queued.Add(MoveTemp(Trace));
+	else RunNow(Trace);
+}
+
+void UTraceQueueSubsystem::RunNow(const FQueuedTrace& Trace)
+{
+	UWorld* World = GetWorld();
+	TArray<FHitResult> Hits;
+	if (Trace.Type == EAsyncTraceType::Multi)
+	{
+		if (Trace.Shape.IsLine()) World->LineTraceMultiByChannel(Hits, Trace.Start, Trace.End, Trace.Channel, Trace.Params);
+		else World->SweepMultiByChannel(Hits, Trace.Start, Trace.End, Trace.Rotation, Trace.Channel, Trace.Shape, Trace.Params);
+	}
+	else
+	{
+		FHitResult Hit;
+		const bool bHit = Trace.Shape.IsLine()
+			? World->LineTraceSingleByChannel(Hit, Trace.Start, Trace.End, Trace.Channel, Trace.Params)
+			: World->SweepSingleByChannel(Hit, Trace.Start, Trace.End, Trace.Rotation, Trace.Channel, Trace.Shape, Trace.Params);
+		if (bHit) Hits.Add(Hit);
+	}
+
+	if (Trace.Owner.IsValid()) Trace.Callback(Hits);
+}
+
+void UTraceQueueSubsystem::Tick(float DeltaTime)
+{
+	const int32 MaxPerFrame = CVarTraceQueueMaxPerFrame.GetValueOnGameThread();
+	const int32 Count = MaxPerFrame > 0 ? FMath::Min(MaxPerFrame, Queued.Num()) : Queued.Num();
+
+	// The engine runs them in batches on worker threads once the frame's ticks are done
+	UWorld* World = GetWorld();
+	for (int32 i = 0; i < Count; i++)
+	{
+		FQueuedTrace& Trace = Queued[i];
+		const uint32 UserData = NextUserData++;
+		if (Trace.Shape.IsLine())
+		{
+			World->AsyncLineTraceByChannel(Trace.Type, Trace.Start, Trace.End, Trace.Channel, Trace.Params, FCollisionResponseParams::DefaultResponseParam, &TraceDelegate, UserData);
+		}
+		else
+		{
+			World->AsyncSweepByChannel(Trace.Type, Trace.Start, Trace.End, Trace.Rotation, Trace.Channel, Trace.Shape, Trace.Params, FCollisionResponseParams::DefaultResponseParam, &TraceDelegate, UserData);
+		}
+		Pending.Add(UserData, FPendingTrace{ MoveTemp(Trace.Owner), MoveTemp(Trace.Callback) });
+	}
+
+	// Traces over the budget go first next frame
+	Queued.RemoveAt(0, Count, false);
+}
+
+void UTraceQueueSubsystem::OnTraceDone(const FTraceHandle& Handle, FTraceDatum& Datum)
+{
+	FPendingTrace Trace;
+	if (Pending.RemoveAndCopyValue(Datum.UserData, Trace) && Trace.Owner.IsValid()) Trace.Callback(Datum.OutHits);
+}
+
+// Players spread over the map each fire a hitscan rifle every frame, traced on the spot or through
+// the queue. With Melee they swing a knife every frame instead, as sphere sweeps.
+static FAutoConsoleCommand TraceQueueBenchmarkCommand(
+	TEXT("fp.Bench.Traces"),
+	TEXT("Compares synchronous and queued async gameplay traces. Usage: fp.Bench.Traces [Players=64] [Frames=300] [Melee]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		UTraceQueueSubsystem* Queue = World != nullptr ? World->GetSubsystem<UTraceQueueSubsystem>() : nullptr;
+		if (Queue == nullptr) return;
+
+		const int32 NumPlayers = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 64, 1);
+		const int32 NumFrames = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 300;
+		const bool bMelee = Args.Num() > 2 && Args[2] == TEXT("Melee");
+
+		const AFirstPersonCharacter* Defaults = GetDefault<AFirstPersonCharacter>();
+		const float Range = bMelee ? Defaults->MeleeRange : Defaults->HitscanRange;
+		const FCollisionShape Shape = bMelee ? FCollisionShape::MakeSphere(Defaults->MeleeRadius) : FCollisionShape::LineShape;
+		const EAsyncTraceType Type = bMelee ? EAsyncTraceType::Multi : EAsyncTraceType::Single;
+
+		TSharedRef<TArray<FVector>> Positions = MakeShared<TArray<FVector>>();
+		FRandomStream Random(13);
+		for (int32 i = 0; i < NumPlayers; i++) Positions->Add(FVector(Random.FRandRange(-5000.f, 5000.f), Random.FRandRange(-5000.f, 5000.f), 200.f));
+
+		// Everyone turns at a different rate, aiming slightly up or down
+		TSharedRef<float> Time = MakeShared<float>(0.f);
+		auto GetShot = [=](int32 Player, FVector& OutStart, FVector& OutEnd)
+		{
+			const FRotator Aim(FMath::Sin(*Time + Player) * 10.f, *Time * (30.f + Player) + Player * 37.f, 0.f);
+			OutStart = (*Positions)[Player];
+			OutEnd = OutStart + Aim.Vector() * Range;
+		};
+
+		TSharedRef<int64> Hits = MakeShared<int64>(0);
+		TSharedRef<int64> Results = MakeShared<int64>(0);
+		TWeakObjectPtr<UWorld> WeakWorld = World;
+		FCollisionQueryParams Params(SCENE_QUERY_STAT(TraceQueueBenchmark));
+
+		auto SyncFrame = [=](float DeltaSeconds)
+		{
+			UWorld* BenchWorld = WeakWorld.Get();
+			if (BenchWorld == nullptr) return;
+
+			*Time += DeltaSeconds;
+			for (int32 Player = 0; Player < NumPlayers; Player++)
+			{
+				FVector Start, End;
+				GetShot(Player, Start, End);
+				if (bMelee)
+				{
+					TArray<FHitResult> SweepHits;
+					BenchWorld->SweepMultiByChannel(SweepHits, Start, End, FQuat::Identity, ECC_Visibility, Shape, Params);
+					*Hits += SweepHits.Num();
+				}
+				else
+				{
+					FHitResult Hit;
+					if (BenchWorld->LineTraceSingleByChannel(Hit, Start, End, ECC_Visibility, Params)) (*Hits)++;
+				}
+				(*Results)++;
+			}
+		};
+
+		TWeakObjectPtr<UTraceQueueSubsystem> WeakQueue = Queue;
+		auto AsyncFrame = [=](float DeltaSeconds)
+		{
+			UTraceQueueSubsystem* BenchQueue = WeakQueue.Get();
+			if (BenchQueue == nullptr) return;
+
+			*Time += DeltaSeconds;
+			for (int32 Player = 0; Player < NumPlayers; Player++)
+			{
+				FVector Start, End;
+				GetShot(Player, Start, End);
+				BenchQueue->Sweep(BenchQueue, Type, Start, End, FQuat::Identity, Shape, ECC_Visibility, Params, [Hits, Results](const TArray<FHitResult>& TraceHits)
+				{
+					*Hits += TraceHits.Num();
+					(*Results)++;
+				});
+			}
+		};
+
+		auto Report = [=](const TCHAR* Name, const FirstPersonBenchmark::FFrameStats& Stats)
+		{
+			UE_LOG(LogFPBench, Display, TEXT("  %s: frame %.3f ms avg, %.3f ms max, %lld results, %lld hits"), Name, Stats.AverageMs(), Stats.MaxBusyMs, *Results, *Hits);
+			*Results = 0;
+			*Hits = 0;
+		};
+
+		UE_LOG(LogFPBench, Display, TEXT("%s traces: %d players, one each per frame over %d frames"), bMelee ? TEXT("Melee") : TEXT("Rifle"), NumPlayers, NumFrames);
+
+		FirstPersonBenchmark::RunFrames(NumFrames, SyncFrame, [=](const FirstPersonBenchmark::FFrameStats& SyncStats)
+		{
+			Report(TEXT("Synchronous"), SyncStats);
+
+			const int32 PreviousAsync = CVarTraceQueueAsync.GetValueOnGameThread();
+			CVarTraceQueueAsync->Set(1);
+			FirstPersonBenchmark::RunFrames(NumFrames, AsyncFrame, [=](const FirstPersonBenchmark::FFrameStats& AsyncStats)
+			{
+				Report(TEXT("Queued async"), AsyncStats);
+				CVarTraceQueueAsync->Set(PreviousAsync);
+			});
+		});
+	}));
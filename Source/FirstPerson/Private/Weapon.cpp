@@ -2,13 +2,22 @@
 
 
 #include "Weapon.h"
+#include "FirstPersonStats.h"
+#include "WeaponPickupSubsystem.h"
+#include "Net/UnrealNetwork.h"
+
+DECLARE_CYCLE_STAT(TEXT("Weapon Pickup"), STAT_FirstPerson_WeaponPickup, STATGROUP_FirstPerson);
+DECLARE_CYCLE_STAT(TEXT("Weapon Respawn"), STAT_FirstPerson_WeaponRespawn, STATGROUP_FirstPerson);
 
 // Sets default values
 AWeapon::AWeapon()
 {
- 	// Set this actor to call Tick() every frame.  You can turn this off to improve performance if you don't need it.
-	PrimaryActorTick.bCanEverTick = true;
+	// Pickups only change when taken or respawned
+	PrimaryActorTick.bCanEverTick = false;
 
+	// Replicated once when their availability changes, dormant otherwise
+	bReplicates = true;
+	NetDormancy = DORM_Initial;
 }
 
 // Called when the game starts or when spawned
@@ -16,33 +25,55 @@ void AWeapon::BeginPlay()
 {
 	Super::BeginPlay();
 
+	// Characters find pickups through UWeaponPickupSubsystem, not overlaps
+	TInlineComponentArray<UPrimitiveComponent*> Primitives(this);
+	for (UPrimitiveComponent* Primitive : Primitives) Primitive->SetGenerateOverlapEvents(false);
+
+	if (HasAuthority() && bAvailable) GetWorld()->GetSubsystem<UWeaponPickupSubsystem>()->AddPickup(this);
 }
 
 void AWeapon::EndPlay(const EEndPlayReason::Type EndPlayReason)
 {
-	Super::EndPlay(EndPlayReason);
+	if (UWeaponPickupSubsystem* Pickups = GetWorld()->GetSubsystem<UWeaponPickupSubsystem>()) Pickups->RemovePickup(this);
 
-	// clear ALL timers that belong to this (Actor) instance.
-	GetWorld()->GetTimerManager().ClearAllTimersForObject(this);
+	Super::EndPlay(EndPlayReason);
 }
 
-// Called every frame
-void AWeapon::Tick(float DeltaTime)
+void AWeapon::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
 {
-	Super::Tick(DeltaTime);
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
 
+	DOREPLIFETIME(AWeapon, bAvailable);
 }
 
 void AWeapon::OnWeaponPickup()
 {
-	FTimerHandle TimerHandle;
-	FTimerDelegate Delegate; // Delegate to bind function with parameters
-	Delegate.BindUFunction(this, "OnWeaponSpawn");
-	SetActorHiddenInGame(true);
-	GetWorld()->GetTimerManager().SetTimer(TimerHandle, Delegate, 30.0f, false);
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(WeaponPickup);
+
+	if (!HasAuthority() || !bAvailable) return;
+
+	FlushNetDormancy();
+	bAvailable = false;
+	OnRep_Available();
+
+	UWeaponPickupSubsystem* Pickups = GetWorld()->GetSubsystem<UWeaponPickupSubsystem>();
+	Pickups->RemovePickup(this);
+	Pickups->ScheduleRespawn(this, RespawnTime);
 }
 
 void AWeapon::OnWeaponSpawn()
 {
-	SetActorHiddenInGame(false);
-}
\ No newline at end of file
+	FIRSTPERSON_SCOPE_CYCLE_COUNTER(WeaponRespawn);
+
+	FlushNetDormancy();
+	bAvailable = true;
+	OnRep_Available();
+
+	GetWorld()->GetSubsystem<UWeaponPickupSubsystem>()->AddPickup(this);
+}
+
+void AWeapon::OnRep_Available()
+{
+	SetActorHiddenInGame(!bAvailable);
+	SetActorEnableCollision(bAvailable);
+}
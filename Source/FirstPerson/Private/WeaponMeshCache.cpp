@@ -0,0 +1,57 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "WeaponMeshCache.h"
+#include "Engine/AssetManager.h"
+#include "Engine/StaticMesh.h"
+
+void UWeaponMeshCache::Deinitialize()
+{
+	for (TPair<FSoftObjectPath, FPendingWeaponMesh>& Load : Pending)
+	{
+		if (Load.Value.Handle.IsValid()) Load.Value.Handle->CancelHandle();
+	}
+	Pending.Reset();
+	Cached.Reset();
+
+	Super::Deinitialize();
+}
+
+void UWeaponMeshCache::Request(const TSoftObjectPtr<UStaticMesh>& Mesh, FWeaponMeshLoaded OnLoaded)
+{
+	if (Mesh.IsNull()) return;
+
+	// Loaded already, by this cache or by whatever else references it
+	if (UStaticMesh* Loaded = Mesh.Get())
+	{
+		Cached.AddUnique(Loaded);
+		OnLoaded(Loaded);
+		return;
+	}
+
+	const FSoftObjectPath Path = Mesh.ToSoftObjectPath();
+	if (FPendingWeaponMesh* Load = Pending.Find(Path))
+	{
+		Load->Callbacks.Add(MoveTemp(OnLoaded));
+		return;
+	}
+
+	Pending.Add(Path).Callbacks.Add(MoveTemp(OnLoaded));
+	TSharedPtr<FStreamableHandle> Handle = UAssetManager::GetStreamableManager().RequestAsyncLoad(Path, FStreamableDelegate::CreateUObject(this, &UWeaponMeshCache::OnLoaded, Path));
+
+	// The delegate may have run already
+	if (FPendingWeaponMesh* Load = Pending.Find(Path)) Load->Handle = Handle;
+}
+
+void UWeaponMeshCache::OnLoaded(FSoftObjectPath Path)
+{
+	FPendingWeaponMesh Load;
+	if (!Pending.RemoveAndCopyValue(Path, Load)) return;
+
+	// A mesh that failed to load leaves the weapon invisible
+	UStaticMesh* Mesh = Cast<UStaticMesh>(Path.ResolveObject());
+	if (Mesh == nullptr) return;
+
+	Cached.AddUnique(Mesh);
+	for (FWeaponMeshLoaded& Callback : Load.Callbacks) Callback(Mesh);
+}
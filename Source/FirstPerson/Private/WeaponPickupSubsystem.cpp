@@ -0,0 +1,379 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "WeaponPickupSubsystem.h"
+#include "FirstPersonBenchmark.h"
+#include "FirstPersonCharacter.h"
+#include "Weapon.h"
+#include "Components/CapsuleComponent.h"
+#include "Components/SphereComponent.h"
+#include "Engine/World.h"
+#include "GameFramework/GameModeBase.h"
+#include "HAL/IConsoleManager.h"
+#include "Math/RandomStream.h"
+#include "TimerManager.h"
+
+static TAutoConsoleVariable<float> CVarPickupQueryRate(
+	TEXT("fp.Pickup.QueryRate"),
+	10.f,
+	TEXT("Times per second the server looks for pickups under each character. 0 disables pickups."));
+
+void UWeaponPickupSubsystem::Deinitialize()
+{
+	if (UWorld* World = GetWorld()) World->GetTimerManager().ClearTimer(TimerHandle);
+	Pending.Reset();
+	Cells.Reset();
+	Characters.Reset();
+
+	Super::Deinitialize();
+}
+
+ETickableTickType UWeaponPickupSubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool UWeaponPickupSubsystem::IsTickable() const
+{
+	return Characters.Num() > 0 && Cells.Num() > 0;
+}
+
+TStatId UWeaponPickupSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UWeaponPickupSubsystem, STATGROUP_Tickables);
+}
+
+void UWeaponPickupSubsystem::Tick(float DeltaTime)
+{
+	const float QueryRate = CVarPickupQueryRate.GetValueOnGameThread();
+	if (QueryRate <= 0.f) return;
+
+	TimeSinceQuery += DeltaTime;
+	if (TimeSinceQuery < 1.f / QueryRate) return;
+	TimeSinceQuery = 0.f;
+
+	QueryCharacters();
+}
+
+void UWeaponPickupSubsystem::QueryCharacters()
+{
+	for (int32 i = Characters.Num() - 1; i >= 0; i--)
+	{
+		AFirstPersonCharacter* Character = Characters[i].Get();
+		if (Character == nullptr)
+		{
+			Characters.RemoveAtSwap(i);
+			continue;
+		}
+
+		const UCapsuleComponent* Capsule = Character->GetCapsuleComponent();
+		AWeapon* Pickup = FindPickup(Character->GetActorLocation(), Capsule->GetScaledCapsuleRadius() + PickupRadius, Capsule->GetScaledCapsuleHalfHeight());
+		if (Pickup != nullptr) Character->PickUp(Pickup);
+	}
+}
+
+FIntPoint UWeaponPickupSubsystem::GetCell(const FVector& Location) const
+{
+	return FIntPoint(FMath::FloorToInt(Location.X / CellSize), FMath::FloorToInt(Location.Y / CellSize));
+}
+
+void UWeaponPickupSubsystem::AddPickup(AWeapon* Pickup)
+{
+	const FVector Location = Pickup->GetActorLocation();
+	TArray<FPickupCellEntry>& Cell = Cells.FindOrAdd(GetCell(Location));
+	if (!Cell.ContainsByPredicate([Pickup](const FPickupCellEntry& Entry) { return Entry.Pickup == Pickup; })) Cell.Add({ Pickup, Location });
+}
+
+void UWeaponPickupSubsystem::RemovePickup(AWeapon* Pickup)
+{
+	const FIntPoint Key = GetCell(Pickup->GetActorLocation());
+	if (TArray<FPickupCellEntry>* Cell = Cells.Find(Key))
+	{
+		Cell->RemoveAllSwap([Pickup](const FPickupCellEntry& Entry) { return Entry.Pickup == Pickup; });
+		if (Cell->Num() == 0) Cells.Remove(Key);
+	}
+}
+
+AWeapon* UWeaponPickupSubsystem::FindPickup(const FVector& Location, float Radius, float HalfHeight) const
+{
+	const FIntPoint Min = GetCell(Location - FVector(Radius, Radius, 0.f));
+	const FIntPoint Max = GetCell(Location + FVector(Radius, Radius, 0.f));
+	const float RadiusSquared = FMath::Square(Radius);
+
+	for (int32 Y = Min.Y; Y <= Max.Y; Y++)
+	{
+		for (int32 X = Min.X; X <= Max.X; X++)
+		{
+			const TArray<FPickupCellEntry>* Cell = Cells.Find(FIntPoint(X, Y));
+			if (Cell == nullptr) continue;
+
+			for (const FPickupCellEntry& Entry : *Cell)
+			{
+				if (FVector::DistSquared2D(Entry.Location, Location) <= RadiusSquared && FMath::Abs(Entry.Location.Z - Location.Z) <= HalfHeight) return Entry.Pickup;
+			}
+		}
+	}
+	return nullptr;
+}
+
+void UWeaponPickupSubsystem::RegisterCharacter(AFirstPersonCharacter* Character)
+{
+	Characters.AddUnique(Character);
+}
+
+void UWeaponPickupSubsystem::UnregisterCharacter(AFirstPersonCharacter* Character)
+{
+	Characters.RemoveSwap(Character);
+}
+
+void UWeaponPickupSubsystem::ScheduleRespawn(AWeapon* Pickup, float Delay)
+{
+	const double Time = GetWorld()->GetTimeSeconds() + Delay;
+	Pending.HeapPush({ Time, Pickup });
+
+	// Only an earlier respawn than the armed one moves the timer
+	if (!GetWorld()->GetTimerManager().IsTimerActive(TimerHandle) || Time < ArmedTime) ArmTimer();
+}
+
+void UWeaponPickupSubsystem::RespawnDue()
+{
+	const double Now = GetWorld()->GetTimeSeconds();
+	while (Pending.Num() > 0 && Pending.HeapTop().Time <= Now)
+	{
+		FPendingPickupRespawn Respawn;
+		Pending.HeapPop(Respawn, false);
+		if (AWeapon* Pickup = Respawn.Pickup.Get()) Pickup->OnWeaponSpawn();
+	}
+
+	ArmTimer();
+}
+
+void UWeaponPickupSubsystem::ArmTimer()
+{
+	FTimerManager& TimerManager = GetWorld()->GetTimerManager();
+	if (Pending.Num() == 0)
+	{
+		TimerManager.ClearTimer(TimerHandle);
+		return;
+	}
+
+	ArmedTime = Pending.HeapTop().Time;
+	const float Delay = FMath::Max(float(ArmedTime - GetWorld()->GetTimeSeconds()), KINDA_SMALL_NUMBER);
+	TimerManager.SetTimer(TimerHandle, this, &UWeaponPickupSubsystem::RespawnDue, Delay, false);
+}
+
+// Stand-in for the empty per-actor Tick pickups used to have
+struct FEmptyTickFunction : public FTickFunction
+{
+	virtual void ExecuteTick(float DeltaTime, ELevelTick TickType, ENamedThreads::Type CurrentThread, const FGraphEventRef& MyCompletionGraphEvent) override {}
+	virtual FString DiagnosticMessage() override { return TEXT("FEmptyTickFunction"); }
+};
+
+// Spawns pickups and takes some of them every frame, first the way pickups used to work (ticking,
+// net awake, a timer each) and then dormant with respawns scheduled by the subsystem
+static FAutoConsoleCommand WeaponPickupBenchmarkCommand(
+	TEXT("fp.Bench.WeaponPickups"),
+	TEXT("Compares the server frame cost of legacy and dormant weapon pickups. Usage: fp.Bench.WeaponPickups [Count=1000] [Frames=300] [TakenPerSecond=50]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		if (World == nullptr || World->IsNetMode(NM_Client)) return;
+
+		const int32 Count = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 1000, 1);
+		const int32 NumFrames = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 300;
+		const float TakenPerSecond = Args.Num() > 2 ? FCString::Atof(*Args[2]) : 50.f;
+
+		// Far below the map on a grid, respawning fast enough to cycle during the run
+		TSharedRef<TArray<TWeakObjectPtr<AWeapon>>> Pickups = MakeShared<TArray<TWeakObjectPtr<AWeapon>>>();
+		for (int32 i = 0; i < Count; i++)
+		{
+			const FVector Location(i % 100 * 200.f, i / 100 * 200.f, -100000.f);
+			AWeapon* Pickup = World->SpawnActor<AWeapon>(Location, FRotator::ZeroRotator);
+			if (Pickup == nullptr) continue;
+			Pickup->RespawnTime = 2.f;
+			Pickups->Add(Pickup);
+		}
+
+		TSharedRef<TArray<TUniquePtr<FEmptyTickFunction>>> TickFunctions = MakeShared<TArray<TUniquePtr<FEmptyTickFunction>>>();
+		TWeakObjectPtr<UWorld> WeakWorld = World;
+
+		auto RunMode = [=](bool bLegacy, TFunction<void(const FirstPersonBenchmark::FFrameStats&)> OnDone)
+		{
+			TSharedRef<float> TakesDue = MakeShared<float>(0.f);
+			FirstPersonBenchmark::RunFrames(NumFrames, [=](float DeltaSeconds)
+			{
+				UWorld* CurrentWorld = WeakWorld.Get();
+				if (CurrentWorld == nullptr || Pickups->Num() == 0) return;
+
+				for (*TakesDue += TakenPerSecond * DeltaSeconds; *TakesDue >= 1.f; *TakesDue -= 1.f)
+				{
+					AWeapon* Pickup = (*Pickups)[FMath::RandHelper(Pickups->Num())].Get();
+					if (Pickup == nullptr || Pickup->IsHidden()) continue;
+
+					if (bLegacy)
+					{
+						// What OnWeaponPickup used to do
+						FTimerHandle TimerHandle;
+						Pickup->SetActorHiddenInGame(true);
+						CurrentWorld->GetTimerManager().SetTimer(TimerHandle, FTimerDelegate::CreateWeakLambda(Pickup, [Pickup]() { Pickup->SetActorHiddenInGame(false); }), Pickup->RespawnTime, false);
+					}
+					else Pickup->OnWeaponPickup();
+				}
+			}, OnDone);
+		};
+
+		auto Report = [=](const TCHAR* Name, const FirstPersonBenchmark::FFrameStats& Stats)
+		{
+			UE_LOG(LogFPBench, Display, TEXT("  %s: frame %.3f ms avg, %.3f ms max"), Name, Stats.AverageMs(), Stats.MaxBusyMs);
+		};
+
+		// Legacy: an empty tick and an awake net channel per pickup
+		for (const TWeakObjectPtr<AWeapon>& Pickup : *Pickups)
+		{
+			Pickup->SetNetDormancy(DORM_Awake);
+			FEmptyTickFunction* TickFunction = TickFunctions->Add_GetRef(MakeUnique<FEmptyTickFunction>()).Get();
+			TickFunction->bCanEverTick = true;
+			TickFunction->RegisterTickFunction(World->PersistentLevel);
+		}
+
+		UE_LOG(LogFPBench, Display, TEXT("Weapon pickups: %d pickups, %.0f taken/s over %d frames"), Pickups->Num(), TakenPerSecond, NumFrames);
+		RunMode(true, [=](const FirstPersonBenchmark::FFrameStats& LegacyStats)
+		{
+			Report(TEXT("Ticking, awake, timer per pickup"), LegacyStats);
+
+			for (TUniquePtr<FEmptyTickFunction>& TickFunction : *TickFunctions) TickFunction->UnRegisterTickFunction();
+			TickFunctions->Reset();
+			for (const TWeakObjectPtr<AWeapon>& Pickup : *Pickups)
+			{
+				if (!Pickup.IsValid()) continue;
+				Pickup->GetWorldTimerManager().ClearAllTimersForObject(Pickup.Get());
+				Pickup->OnWeaponSpawn();
+				Pickup->SetNetDormancy(DORM_DormantAll);
+			}
+
+			RunMode(false, [=](const FirstPersonBenchmark::FFrameStats& DormantStats)
+			{
+				Report(TEXT("Dormant, subsystem respawns"), DormantStats);
+
+				for (const TWeakObjectPtr<AWeapon>& Pickup : *Pickups)
+				{
+					if (Pickup.IsValid()) Pickup->Destroy();
+				}
+			});
+		});
+	}));
+
+// Moves characters among pickups every frame, first finding pickups through overlap events of
+// their capsules and then through the grid at fp.Pickup.QueryRate
+static FAutoConsoleCommand PickupQueryBenchmarkCommand(
+	TEXT("fp.Bench.PickupQueries"),
+	TEXT("Compares capsule overlaps and grid queries for pickups. Usage: fp.Bench.PickupQueries [Characters=64] [Pickups=2000] [Frames=300]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateLambda([](const TArray<FString>& Args, UWorld* World)
+	{
+		const AGameModeBase* GameMode = World != nullptr ? World->GetAuthGameMode() : nullptr;
+		if (GameMode == nullptr) return;
+
+		const int32 NumCharacters = FMath::Max(Args.Num() > 0 ? FCString::Atoi(*Args[0]) : 64, 1);
+		const int32 NumPickups = FMath::Max(Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 2000, 1);
+		const int32 NumFrames = Args.Num() > 2 ? FCString::Atoi(*Args[2]) : 300;
+
+		// Far below the map, a square the size of a large level
+		const FVector Origin(0.f, 0.f, -100000.f);
+		const float Extent = 20000.f;
+		FRandomStream Random(7);
+
+		FActorSpawnParameters SpawnParams;
+		SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+
+		TSharedRef<TArray<TWeakObjectPtr<AActor>>> Spawned = MakeShared<TArray<TWeakObjectPtr<AActor>>>();
+		TSharedRef<TArray<TWeakObjectPtr<AFirstPersonCharacter>>> Characters = MakeShared<TArray<TWeakObjectPtr<AFirstPersonCharacter>>>();
+		TSharedRef<TArray<TWeakObjectPtr<USphereComponent>>> PickupSpheres = MakeShared<TArray<TWeakObjectPtr<USphereComponent>>>();
+
+		for (int32 i = 0; i < NumPickups; i++)
+		{
+			const FVector Location = Origin + FVector(Random.FRandRange(-Extent, Extent), Random.FRandRange(-Extent, Extent), 0.f);
+			AWeapon* Pickup = World->SpawnActor<AWeapon>(AWeapon::StaticClass(), Location, FRotator::ZeroRotator, SpawnParams);
+			if (Pickup == nullptr) continue;
+
+			// Blueprint pickups carry a mesh, give these something to overlap. Without a root
+			// the pickup was added to the grid at the origin.
+			UWeaponPickupSubsystem* Subsystem = World->GetSubsystem<UWeaponPickupSubsystem>();
+			Subsystem->RemovePickup(Pickup);
+			USphereComponent* Sphere = NewObject<USphereComponent>(Pickup);
+			Sphere->InitSphereRadius(50.f);
+			Sphere->SetCollisionProfileName(TEXT("OverlapAllDynamic"));
+			Sphere->SetGenerateOverlapEvents(false);
+			Pickup->SetRootComponent(Sphere);
+			Sphere->RegisterComponent();
+			Sphere->SetWorldLocation(Location);
+			Subsystem->AddPickup(Pickup);
+
+			Pickup->RespawnTime = 2.f;
+			Spawned->Add(Pickup);
+			PickupSpheres->Add(Sphere);
+		}
+
+		for (int32 i = 0; i < NumCharacters; i++)
+		{
+			const FVector Location = Origin + FVector(Random.FRandRange(-Extent, Extent), Random.FRandRange(-Extent, Extent), 0.f);
+			AFirstPersonCharacter* Character = World->SpawnActor<AFirstPersonCharacter>(GameMode->DefaultPawnClass, Location, FRotator::ZeroRotator, SpawnParams);
+			if (Character == nullptr) continue;
+			Spawned->Add(Character);
+			Characters->Add(Character);
+		}
+
+		// Every character runs in its own circle at sprint speed
+		TSharedRef<float> Time = MakeShared<float>(0.f);
+		auto MoveCharacters = [=](float DeltaSeconds)
+		{
+			*Time += DeltaSeconds;
+			for (int32 i = 0; i < Characters->Num(); i++)
+			{
+				AFirstPersonCharacter* Character = (*Characters)[i].Get();
+				if (Character == nullptr) continue;
+
+				const float Angle = *Time * 1.5f + i;
+				const FVector Step = FVector(FMath::Cos(Angle), FMath::Sin(Angle), 0.f) * 1500.f * DeltaSeconds;
+				Character->SetActorLocation(Character->GetActorLocation() + Step);
+			}
+		};
+
+		auto SetOverlaps = [=](bool bOverlaps)
+		{
+			for (const TWeakObjectPtr<AFirstPersonCharacter>& Character : *Characters)
+			{
+				if (Character.IsValid()) Character->GetCapsuleComponent()->SetGenerateOverlapEvents(bOverlaps);
+			}
+			for (const TWeakObjectPtr<USphereComponent>& Sphere : *PickupSpheres)
+			{
+				if (Sphere.IsValid()) Sphere->SetGenerateOverlapEvents(bOverlaps);
+			}
+		};
+
+		auto Report = [=](const TCHAR* Name, const FirstPersonBenchmark::FFrameStats& Stats)
+		{
+			UE_LOG(LogFPBench, Display, TEXT("  %s: frame %.3f ms avg, %.3f ms max"), Name, Stats.AverageMs(), Stats.MaxBusyMs);
+		};
+
+		const float PreviousQueryRate = CVarPickupQueryRate.GetValueOnGameThread();
+		UE_LOG(LogFPBench, Display, TEXT("Pickup detection: %d moving characters, %d pickups over %d frames"), Characters->Num(), PickupSpheres->Num(), NumFrames);
+
+		CVarPickupQueryRate->Set(0.f);
+		SetOverlaps(true);
+		FirstPersonBenchmark::RunFrames(NumFrames, MoveCharacters, [=](const FirstPersonBenchmark::FFrameStats& OverlapStats)
+		{
+			Report(TEXT("Capsule overlaps"), OverlapStats);
+
+			SetOverlaps(false);
+			CVarPickupQueryRate->Set(PreviousQueryRate > 0.f ? PreviousQueryRate : 10.f);
+			FirstPersonBenchmark::RunFrames(NumFrames, MoveCharacters, [=](const FirstPersonBenchmark::FFrameStats& GridStats)
+			{
+				Report(TEXT("Grid queries"), GridStats);
+
+				CVarPickupQueryRate->Set(PreviousQueryRate);
+				for (const TWeakObjectPtr<AActor>& Actor : *Spawned)
+				{
+					if (Actor.IsValid()) Actor->Destroy();
+				}
+			});
+		});
+	}));
@@ -0,0 +1,38 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Weapon.h"
+
+class AFirstPersonCharacter;
+
+// Views a character shows its gun in
+enum class EWeaponView : uint8
+{
+	FirstPerson,
+	ThirdPerson,
+	Num
+};
+
+/**
+ * Names of the components a character blueprint adds, which C++ only knows by name. Resolved from
+ * the first character spawned of each class and kept on the class default object, so later spawns
+ * find their components by name in the object hash instead of comparing every component's name.
+ */
+struct FIRSTPERSON_API FCharacterComponentLayout
+{
+	/** Body seen by other players, named by TP_MeshName */
+	FName Mesh3P;
+
+	/** Per gun static mesh components of older blueprints, NAME_None where the blueprint has none */
+	FName LegacyGuns[int32(EWeaponView::Num)][MAX_WEAPON_TYPE];
+
+	bool bResolved = false;
+
+	/** Layout of the character's class, resolved from the character if it is the first of its class */
+	static const FCharacterComponentLayout& Get(const AFirstPersonCharacter* Character);
+
+	/** Finds the layout's components among a spawned character's */
+	static FCharacterComponentLayout Resolve(const AFirstPersonCharacter* Character);
+};
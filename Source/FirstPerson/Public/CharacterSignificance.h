@@ -0,0 +1,72 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "CharacterSignificance.generated.h"
+
+class AFirstPersonCharacter;
+
+// How much a character matters to the players here, the significance manager's score
+enum class ECharacterSignificance : uint8
+{
+	Hidden,		// Behind every player and out of earshot
+	Low,		// In view, far away
+	Medium,		// In view, mid range
+	High,		// Close by, or controlled here
+	Num
+};
+
+// What a character spends at a significance level
+struct FCharacterSignificanceSettings
+{
+	// Actor and movement tick interval of characters simulated here, in seconds
+	float TickInterval;
+
+	// Frames the third person animation skips between updates
+	int32 AnimFrameSkip;
+
+	// Scale of the class's NetUpdateFrequency, on the server
+	float NetUpdateScale;
+
+	// Body and gun shadows
+	bool bCastShadows;
+};
+
+/**
+ * Scores characters with the engine's significance manager from every local player's view point,
+ * or every player's on the server, by distance and whether they are in view. Characters adjust
+ * their tick interval, animation update rate, shadows and NetUpdateFrequency to their level.
+ */
+UCLASS()
+class FIRSTPERSON_API UCharacterSignificanceSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+	void RegisterCharacter(AFirstPersonCharacter* Character);
+	void UnregisterCharacter(AFirstPersonCharacter* Character);
+
+	static const FCharacterSignificanceSettings& GetSettings(ECharacterSignificance Level);
+
+	/** Level of a character seen from one view point */
+	static ECharacterSignificance Evaluate(const AFirstPersonCharacter* Character, const FTransform& Viewpoint);
+
+private:
+	int32 NumCharacters = 0;
+
+	// Scratch space of Tick, kept between ticks to avoid allocations
+	TArray<FTransform> Viewpoints;
+};
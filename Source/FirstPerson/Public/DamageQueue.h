@@ -0,0 +1,70 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "DamageQueue.generated.h"
+
+class AFirstPersonCharacter;
+
+// One hit, queued until the end of the tick
+struct FQueuedDamageEvent
+{
+	TWeakObjectPtr<AFirstPersonCharacter> Victim;
+	TWeakObjectPtr<AFirstPersonCharacter> Instigator;
+	int32 Damage;
+};
+
+// Damage of one victim over a tick, the last instigator gets the kill
+struct FCoalescedDamage
+{
+	AFirstPersonCharacter* Victim;
+	AFirstPersonCharacter* Instigator;
+	int32 Damage;
+};
+
+/**
+ * Server side damage. Hitscan, melee and projectile hits are queued during the tick and
+ * applied together when the queue ticks: hits on the same victim are added up, so its health
+ * changes and replicates once per tick whatever the number of pellets or rounds that hit it,
+ * then deaths are resolved.
+ */
+UCLASS()
+class FIRSTPERSON_API UDamageQueueSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+	/** Queues a hit on Victim at Location, on the server, and records it in the match's telemetry */
+	void AddDamage(AFirstPersonCharacter* Victim, AFirstPersonCharacter* Instigator, int32 Damage, const FVector& Location, uint8 Weapon);
+
+	/** Applies every queued hit now */
+	void Flush();
+
+	/** True when projectile hits deal the damage of shots instead of their lag compensated hitscan */
+	static bool ProjectilesDealDamage();
+
+	// Totals since the last reset, for fp.Damage.Stats
+	int64 NumEvents = 0;
+	int64 NumHealthChanges = 0;
+	int64 NumDeaths = 0;
+
+private:
+	TArray<FQueuedDamageEvent> Events;
+
+	// Scratch space of Flush, kept between ticks to avoid allocations
+	TArray<FCoalescedDamage> Coalesced;
+	TMap<AFirstPersonCharacter*, int32> CoalescedIndex;
+};
@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FireShot.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "FireRelay.generated.h"
+
+class AFirstPersonCharacter;
+class UNetConnection;
+
+/**
+ * Server side delivery of fire events to remote clients, replacing the reliable Multi_OnFire.
+ *
+ * Shots are queued during the tick and relayed when the subsystem ticks. Each connection only
+ * gets the shots of shooters replicated to it, and of those only the ones it can hear, within
+ * fp.FireRelay.AudibleDistance of its view point, or see, in front of it, with or without a
+ * character. They are sent in one unreliable Client_ReceiveShots on the connection's
+ * AFirstPersonPlayerController, grouped by shooter. A lost shot only loses its cosmetic
+ * projectiles, the shooter's own client gets a reliable confirmation.
+ */
+UCLASS()
+class FIRSTPERSON_API UFireRelaySubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+	/** Queues a shot of Shooter for the remote clients, on the server */
+	void QueueShot(AFirstPersonCharacter* Shooter, const FFireShot& Shot);
+
+	/** Sends the queued shots to the connections that can see or hear them */
+	void Flush();
+
+	/** True when shots go through the relay instead of Multi_OnFire */
+	static bool IsEnabled();
+
+	// Totals since the last reset, for fp.FireRelay.Stats
+	int64 NumShots = 0;
+	int64 NumDelivered = 0;
+	int64 NumCulled = 0;
+	int64 NumRPCs = 0;
+
+private:
+	// True if the player of Connection, looking from ViewLocation, can see or hear Shooter's shots
+	bool IsAudibleOrVisible(UNetConnection* Connection, const AFirstPersonCharacter* Shooter, const FVector& ViewLocation, const FVector& ViewDirection, float CosViewAngle) const;
+
+	// Shots of the tick, one entry per shooter in the order they first fired
+	UPROPERTY()
+	TArray<FRelayedShots> Queued;
+
+	TMap<AFirstPersonCharacter*, int32> QueuedIndex;
+
+	// Scratch space of Flush, kept between ticks to avoid allocations
+	UPROPERTY()
+	TArray<FRelayedShots> Batch;
+};
@@ -0,0 +1,111 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Weapon.h"
+#include "FireShot.generated.h"
+
+class AFirstPersonCharacter;
+
+/**
+ * One pull of the trigger, sent once whatever the number of pellets the weapon fires.
+ *
+ * Pellet directions are not sent: the server and every client expand them from the aim and the
+ * seed, so a shotgun shot costs as many bits as a revolver shot.
+ */
+USTRUCT()
+struct FIRSTPERSON_API FFireShot
+{
+	GENERATED_BODY()
+
+	// Muzzle location, sent with a precision of 0.1
+	FVector Location = FVector::ZeroVector;
+
+	// Pitch and yaw quantized to 16 bits each by AFirstPersonCharacter::PackAim
+	uint32 PackedAim = 0;
+
+	// Spread seed, the shooter's shot sequence number
+	uint16 Seed = 0;
+
+	// Server time the shooter saw when it fired
+	float Timestamp = 0.f;
+
+	TEnumAsByte<EWeaponType> Weapon = Revolver;
+
+	FRotator GetRotation() const;
+
+	/** Sets Location and PackedAim, rounded to what NetSerialize sends so the shooter expands the same pellets as everyone else */
+	void SetMuzzle(const FVector& InLocation, const FRotator& InRotation);
+
+	/** Unit directions of NumPellets pellets spread in a cone of SpreadDegrees half angle, the same wherever the shot is expanded */
+	void GetPelletDirections(int32 NumPellets, float SpreadDegrees, TArray<FVector>& OutDirections) const;
+
+	bool NetSerialize(FArchive& Ar, class UPackageMap* Map, bool& bOutSuccess);
+};
+
+template<>
+struct TStructOpsTypeTraits<FFireShot> : public TStructOpsTypeTraitsBase2<FFireShot>
+{
+	enum
+	{
+		WithNetSerializer = true,
+	};
+};
+
+/** Shots of one shooter relayed to a client in one update by UFireRelaySubsystem */
+USTRUCT()
+struct FIRSTPERSON_API FRelayedShots
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	AFirstPersonCharacter* Shooter = nullptr;
+
+	UPROPERTY()
+	TArray<FFireShot> Shots;
+};
+
+// Stages of a shot's way from the trigger to its effects, each timed where it ends
+enum class EFireLatencyStage : uint8
+{
+	// Start of the frame the trigger was read in to OnFire, on the shooter's machine
+	Input,
+	// OnFire to Server_OnFire, on the server
+	ToServer,
+	// OnFire to the shot's projectiles appearing on a remote client
+	ToRemote,
+	// Start of the frame the trigger was read in to the render thread finishing the first frame with the
+	// shot's projectiles, on the shooter's client. Through the server's confirmation when not predicted
+	ShooterEffect,
+	// OnFire to the server's confirmation of the shot, on the shooter's client
+	Confirm,
+	// Projectile spawn to reaching a character, wherever the projectile flies
+	Flight,
+	Num
+};
+
+/**
+ * Histograms of the latency of each stage of shots, as recorded on this machine. Stages that cross
+ * the network are timed against the shot's Timestamp, the server time the shooter saw when it fired.
+ * A client's view of the server's clock lags by about half its ping, which is added back to both ends.
+ */
+struct FIRSTPERSON_API FFireLatencyStats
+{
+	static void Record(EFireLatencyStage Stage, double Seconds);
+
+	/**
+	 * Records the time from StartTime, in FPlatformTime seconds, to the render thread finishing the current
+	 * frame. The GPU's work and the present come after, the sample is recorded a frame or two later.
+	 */
+	static void RecordOnScreen(EFireLatencyStage Stage, double StartTime);
+	static void Reset();
+
+	static int64 GetNumSamples(EFireLatencyStage Stage);
+
+	/** Latency under which Percentile percent of the stage's samples are, in seconds, to the histogram's precision */
+	static double GetPercentile(EFireLatencyStage Stage, float Percentile);
+
+	/** Logs the number of samples, p50, p95, p99 and maximum of every stage with samples */
+	static void Dump(FOutputDevice& Ar);
+};
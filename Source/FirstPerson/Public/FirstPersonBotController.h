@@ -0,0 +1,67 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "AIController.h"
+#include "Math/RandomStream.h"
+#include "FirstPersonBotController.generated.h"
+
+class AFirstPersonCharacter;
+
+/**
+ * Decisions of a load test bot. Plays by calling the same input handlers a player triggers,
+ * picking a new random intent every few seconds: moving, sprinting, crouching, looking around,
+ * switching weapons, firing and reloading.
+ */
+struct FFirstPersonBotBrain
+{
+	/** Seeds the random choices of the bot, so runs are repeatable */
+	void SetSeed(int32 Seed) { Random.Initialize(Seed); }
+
+	/** Plays one frame of Character, looking around through Controller */
+	void Tick(AController* Controller, AFirstPersonCharacter* Character, float DeltaSeconds);
+
+	/** Time between shots while firing, in seconds */
+	float FireInterval = 0.15f;
+
+private:
+	// Picks what to do until the next decision
+	void Decide(AFirstPersonCharacter* Character);
+
+	FRandomStream Random;
+
+	float DecisionTimeLeft = 0.f;
+	float FireTimeLeft = 0.f;
+
+	float Forward = 0.f;
+	float Right = 0.f;
+	FRotator LookRate = FRotator::ZeroRotator;
+	bool bSprinting = false;
+	bool bCrouching = false;
+	bool bFiring = false;
+};
+
+/**
+ * Server-side load test bot, driven by an FFirstPersonBotBrain.
+ */
+UCLASS()
+class FIRSTPERSON_API AFirstPersonBotController : public AAIController
+{
+	GENERATED_BODY()
+
+public:
+	AFirstPersonBotController();
+
+	virtual void Tick(float DeltaSeconds) override;
+
+	/** Seeds the random choices of the bot, so runs are repeatable */
+	void SetSeed(int32 Seed) { Brain.SetSeed(Seed); }
+
+	/** Time between shots while firing, in seconds */
+	UPROPERTY(EditAnywhere, Category = Bot)
+	float FireInterval = 0.15f;
+
+private:
+	FFirstPersonBotBrain Brain;
+};
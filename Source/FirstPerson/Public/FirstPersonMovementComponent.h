@@ -0,0 +1,69 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "GameFramework/CharacterMovementComponent.h"
+#include "FirstPersonMovementComponent.generated.h"
+
+/**
+ * Character movement with sprinting. The sprint input travels in the compressed flags of each
+ * saved move, next to the engine's crouch flag, so both are predicted by the owning client and
+ * replayed when the server corrects it, without RPCs of their own.
+ */
+UCLASS()
+class FIRSTPERSON_API UFirstPersonMovementComponent : public UCharacterMovementComponent
+{
+	GENERATED_BODY()
+
+public:
+	UFirstPersonMovementComponent();
+
+	virtual float GetMaxSpeed() const override;
+	virtual void UpdateFromCompressedFlags(uint8 Flags) override;
+	virtual FNetworkPredictionData_Client* GetPredictionData_Client() const override;
+	virtual void SendClientAdjustment() override;
+
+	void SetSprinting(bool bSprinting) { bWantsToSprint = bSprinting; }
+	bool IsSprinting() const;
+
+	/** Ground speed while sprinting, MaxWalkSpeed is used otherwise */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement: Walking")
+	float MaxSprintSpeed = 1500.f;
+
+	/** Sprint input of the current move */
+	uint8 bWantsToSprint : 1;
+
+	/** Number of position corrections sent to clients by this server */
+	static int64 GetNumCorrectionsSent() { return NumCorrectionsSent; }
+	static void ResetNumCorrectionsSent() { NumCorrectionsSent = 0; }
+
+private:
+	static int64 NumCorrectionsSent;
+};
+
+class FSavedMove_FirstPerson : public FSavedMove_Character
+{
+public:
+	typedef FSavedMove_Character Super;
+
+	FSavedMove_FirstPerson() : bWantsToSprint(false) {}
+
+	virtual void Clear() override;
+	virtual void SetMoveFor(ACharacter* Character, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData) override;
+	virtual void PrepMoveFor(ACharacter* Character) override;
+	virtual bool CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* InCharacter, float MaxDelta) const override;
+	virtual uint8 GetCompressedFlags() const override;
+
+	uint8 bWantsToSprint : 1;
+};
+
+class FNetworkPredictionData_Client_FirstPerson : public FNetworkPredictionData_Client_Character
+{
+public:
+	typedef FNetworkPredictionData_Client_Character Super;
+
+	FNetworkPredictionData_Client_FirstPerson(const UCharacterMovementComponent& ClientMovement) : Super(ClientMovement) {}
+
+	virtual FSavedMovePtr AllocateNewMove() override;
+};
@@ -0,0 +1,24 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FireShot.h"
+#include "GameFramework/PlayerController.h"
+#include "FirstPersonPlayerController.generated.h"
+
+/**
+ * Player controller of the game. Receives the shots UFireRelaySubsystem relays, so players
+ * without a character, dead or spectating, still see and hear the gunfire around their view.
+ */
+UCLASS()
+class FIRSTPERSON_API AFirstPersonPlayerController : public APlayerController
+{
+	GENERATED_BODY()
+
+public:
+	/** Shots of the characters this client can see or hear */
+	UFUNCTION(Client, Unreliable)
+	void Client_ReceiveShots(const TArray<FRelayedShots>& Batches);
+	void Client_ReceiveShots_Implementation(const TArray<FRelayedShots>& Batches);
+};
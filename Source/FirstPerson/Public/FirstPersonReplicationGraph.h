@@ -0,0 +1,84 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "ReplicationGraph.h"
+#include "FirstPersonReplicationGraph.generated.h"
+
+class UReplicationGraphNode_ActorList;
+class UReplicationGraphNode_AlwaysRelevant_ForConnection;
+class UReplicationGraphNode_GridSpatialization2D;
+
+// How the actors of a class are routed to the graph's nodes
+enum class EFirstPersonClassRepPolicy : uint8
+{
+	NotRouted,
+	RelevantAllConnections,
+	RelevantToOwner,
+	Spatialize_Dynamic,
+	Spatialize_Dormancy,
+};
+
+/**
+ * Replication graph of the game, used instead of the net driver's per actor relevancy checks
+ * when fp.Net.ReplicationGraph is set as the game net driver is created.
+ *
+ * Characters and projectiles are in a 2D spatial grid, so a connection only considers the actors
+ * in the cells around its viewer. Weapon pickups are in the grid as dormant actors and cost nothing
+ * until they wake up. Game state and player states go to every connection from one list, and
+ * actors only relevant to their owner go to their owner's connection list, with its controller
+ * and view target.
+ */
+UCLASS(Transient, Config = Engine)
+class FIRSTPERSON_API UFirstPersonReplicationGraph : public UReplicationGraph
+{
+	GENERATED_BODY()
+
+public:
+	virtual void InitGlobalActorClassSettings() override;
+	virtual void InitGlobalGraphNodes() override;
+	virtual void InitConnectionGraphNodes(UNetReplicationGraphConnection* RepGraphConnection) override;
+	virtual void RouteAddNetworkActorToNodes(const FNewReplicatedActorInfo& ActorInfo, FGlobalActorReplicationInfo& GlobalInfo) override;
+	virtual void RouteRemoveNetworkActorToNodes(const FNewReplicatedActorInfo& ActorInfo) override;
+	virtual int32 ServerReplicateActors(float DeltaSeconds) override;
+	virtual void RemoveClientConnection(UNetConnection* NetConnection) override;
+
+	/** Changes how often an actor is considered for replication, as a change of its NetUpdateFrequency would without the graph */
+	void SetUpdateFrequency(AActor* Actor, float Frequency);
+
+	/** True when the game net driver should be created with this graph */
+	static bool IsEnabled();
+
+	/** Size of the grid's cells */
+	UPROPERTY(Config)
+	float CellSize = 10000.f;
+
+	/** Lowest corner of the grid, the map is expected to fit from there */
+	UPROPERTY(Config)
+	FVector2D SpatialBias = FVector2D(-150000.f, -150000.f);
+
+private:
+	EFirstPersonClassRepPolicy GetPolicy(const AActor* ActorCDO) const;
+
+	// The policy InitGlobalActorClassSettings found for Class, or the one of its defaults for a class it didn't see
+	EFirstPersonClassRepPolicy GetClassRepPolicy(UClass* Class);
+
+	// Adds an actor only relevant to its owner to its owner's connection list, returns false if it has no connection yet
+	bool AddToOwnerConnection(AActor* Actor);
+
+	UPROPERTY()
+	UReplicationGraphNode_GridSpatialization2D* GridNode;
+
+	UPROPERTY()
+	UReplicationGraphNode_ActorList* AlwaysRelevantNode;
+
+	UPROPERTY()
+	TMap<UNetConnection*, UReplicationGraphNode_AlwaysRelevant_ForConnection*> ConnectionNodes;
+
+	// Owner only actors spawned before their owner had a connection, routed when it gets one
+	UPROPERTY()
+	TArray<AActor*> ActorsWithoutNetConnection;
+
+	TClassMap<EFirstPersonClassRepPolicy> ClassRepPolicies;
+};
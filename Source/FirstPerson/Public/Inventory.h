@@ -0,0 +1,145 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/NetSerialization.h"
+#include "Weapon.h"
+#include "Inventory.generated.h"
+
+USTRUCT()
+struct FGun
+{
+	GENERATED_BODY()
+
+	// Total amount of ammo that can be in the weapon
+	//UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
+	int maxClipAmmo = 0;
+
+	// Total amount of ammo in the weapon
+	//UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
+	int clipAmmo = 0;
+
+	// Time it takes to reload the weapon
+	//UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
+	int reloadTime = 0;
+
+	// Weapon damage
+	//UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
+	int damage = 0;
+
+	bool active = false;
+
+	void Initialize(EWeaponType type)
+	{
+		switch (type)
+		{
+			case Revolver:
+			{
+				clipAmmo = 6;
+				maxClipAmmo = 6;
+				reloadTime = 7;
+				damage = 25;
+				active = true;
+				break;
+			}
+			case Melee: // Melee/Knife
+			{
+				clipAmmo = 0;
+				maxClipAmmo = 0;
+				reloadTime = 0;
+				damage = 35;
+				active = true;
+				break;
+			}
+		}
+	}
+};
+
+/**
+ * Weapons and ammo of a character, owned by the server and replicated to the owning client.
+ *
+ * Replication is a per-connection delta: a dirty mask followed by only the fields that changed
+ * since the state the connection last received, each packed into the bits its range needs.
+ * The owned weapons, equipped and cached weapon share one byte.
+ */
+USTRUCT()
+struct FIRSTPERSON_API FFirstPersonInventory
+{
+	GENERATED_BODY()
+
+	FFirstPersonInventory();
+
+	// Largest values replication has bits for, AWeapon's properties are clamped to them
+	static constexpr int32 MaxClipAmmoLimit = 63;
+	static constexpr int32 MaxTotalAmmoLimit = 511;
+	static constexpr int32 MaxReloadTimeLimit = 31;
+	static constexpr int32 MaxDamageLimit = 255;
+
+	/** True if every field of Gun fits in the bits replication has for it */
+	static bool IsReplicable(const FGun& Gun);
+
+	//Weapons that the player is carring
+	FGun Weapons[MAX_WEAPON_TYPE];
+
+	// Total amount of ammo being carried foreach weapon type
+	int TotalAmmo[MAX_WEAPON_TYPE] = { 0, 20, 10, 30 };
+
+	// Total amount of ammo that can be carried foreach weapon type, not replicated
+	int MaxTotalAmmo[MAX_WEAPON_TYPE] = { 0, 200, 100, 300 };
+
+	// Weapon the player is using, and the one to switch back to
+	TEnumAsByte<EWeaponType> Equipped = Revolver;
+	TEnumAsByte<EWeaponType> Cached = Melee;
+
+	bool Owns(EWeaponType Type) const { return Weapons[Type].active; }
+
+	/** Makes an owned weapon the equipped one, returns false if nothing changed */
+	bool Equip(EWeaponType Type);
+
+	/** Takes one round from the clip of the equipped gun, returns false if there is none */
+	bool ConsumeClipAmmo();
+
+	/** Refills the clip of the equipped gun from the carried ammo */
+	void Reload();
+
+	/** Takes a picked up weapon, or the ammo of its clip if it is owned already. Returns true if the weapon is new. Gun must be replicable */
+	bool AddWeapon(EWeaponType Type, const FGun& Gun);
+
+	/** Writes the fields that differ from Old, or all of them without Old */
+	void WriteDelta(FArchive& Ar, const FFirstPersonInventory* Old) const;
+
+	/** Reads what WriteDelta wrote */
+	void ReadDelta(FArchive& Ar);
+
+	/**
+	 * Reads a delta the server wrote against the state it last sent, applies it to that state and
+	 * replaces this copy with the result, dropping whatever the owner predicted on top of it
+	 */
+	void ReceiveDelta(FArchive& Ar);
+
+	/** Drops the owner's predictions, back to the state last received from the server */
+	void RestoreServerState();
+
+	bool NetDeltaSerialize(FNetDeltaSerializeInfo& DeltaParms);
+
+	bool operator==(const FFirstPersonInventory& Other) const;
+	bool operator!=(const FFirstPersonInventory& Other) const { return !(*this == Other); }
+
+private:
+	// Last state received from the server, not compared. Copies share it, it is replaced rather than changed
+	TSharedPtr<FFirstPersonInventory> ServerState;
+
+	// Owned weapons in the low bits, then equipped and cached weapon
+	uint8 GetStateByte() const;
+	void SetStateByte(uint8 State);
+};
+
+template<>
+struct TStructOpsTypeTraits<FFirstPersonInventory> : public TStructOpsTypeTraitsBase2<FFirstPersonInventory>
+{
+	enum
+	{
+		WithNetDeltaSerializer = true,
+	};
+};
@@ -0,0 +1,110 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "LagCompensation.generated.h"
+
+class AFirstPersonCharacter;
+
+// Fixed-size history of character capsules, one row of slots per recorded frame.
+// Positions are stored as separate float arrays so a rewind walks contiguous memory,
+// and everything is allocated once in Init.
+class FIRSTPERSON_API FPoseHistory
+{
+public:
+	void Init(int32 InMaxSlots, int32 InMaxFrames);
+
+	// Reserves a slot for a character, INDEX_NONE if full
+	int32 AddSlot();
+	void RemoveSlot(int32 Slot);
+
+	// Starts recording a new frame, overwriting the oldest one
+	void BeginFrame(float Time);
+
+	// Records a capsule in the current frame
+	void SetPose(int32 Slot, const FVector& Location, float Radius, float HalfHeight);
+
+	// Traces a segment against the capsules interpolated at Time.
+	// Returns the slot hit first or INDEX_NONE.
+	int32 Trace(float Time, const FVector& Start, const FVector& End, int32 IgnoreSlot, FVector& OutHitLocation) const;
+
+	// Traces segments sharing a start, finding the frames and interpolating the capsules once for all of them.
+	// OutSlots gets the slot each segment hit first or INDEX_NONE.
+	void TraceMulti(float Time, const FVector& Start, TArrayView<const FVector> Ends, int32 IgnoreSlot, TArray<int32>& OutSlots, TArray<FVector>& OutHitLocations) const;
+
+	int32 GetMaxSlots() const { return MaxSlots; }
+	float GetOldestTime() const;
+
+private:
+	// Finds the two recorded frames around Time and the blend between them
+	bool FindFrames(float Time, int32& OutOlder, int32& OutNewer, float& OutAlpha) const;
+
+	int32 MaxSlots = 0;
+	int32 MaxFrames = 0;
+	int32 NumFrames = 0;
+	int32 Head = INDEX_NONE;
+
+	TArray<float> FrameTimes;
+	TArray<bool> SlotUsed;
+
+	// MaxFrames * MaxSlots, indexed by Frame * MaxSlots + Slot
+	TArray<float> PosX;
+	TArray<float> PosY;
+	TArray<float> PosZ;
+	TArray<float> Radius;
+	TArray<float> HalfHeight;
+	TArray<uint8> Valid;
+};
+
+/**
+ * Records the capsule of every character on the server each tick, and resolves
+ * shots against where the shooter saw them.
+ */
+UCLASS()
+class FIRSTPERSON_API ULagCompensationSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+	void RegisterCharacter(AFirstPersonCharacter* Character);
+	void UnregisterCharacter(AFirstPersonCharacter* Character);
+
+	/** Traces a shot of Shooter against the characters rewound to the time its client fired */
+	AFirstPersonCharacter* RewindTrace(AFirstPersonCharacter* Shooter, const FVector& Start, const FVector& End, FVector& OutHitLocation) const;
+
+	/** Traces the pellets of a shot against the characters rewound once to ShotTime. OutVictims gets the character each direction hit or nullptr */
+	void RewindTraceMulti(AFirstPersonCharacter* Shooter, float ShotTime, const FVector& Start, TArrayView<const FVector> Directions, float Range,
+		TArray<AFirstPersonCharacter*>& OutVictims, TArray<FVector>& OutHitLocations) const;
+
+	/** Longest time a shot is rewound, fp.LagCompensation.MaxRewind */
+	static float GetMaxRewind();
+
+	/** Estimated server time at which Shooter's client saw the world when it fired */
+	float GetShooterTime(const AFirstPersonCharacter* Shooter) const;
+
+	/** Server time to rewind a shot to, the shooter's timestamp limited to fp.LagCompensation.MaxRewind */
+	float GetShooterTime(const AFirstPersonCharacter* Shooter, float Timestamp) const;
+
+	// Number of characters and frames kept in the history
+	static const int32 MaxCharacters = 128;
+	static const int32 MaxFrames = 64;
+
+private:
+	FPoseHistory History;
+
+	TArray<TWeakObjectPtr<AFirstPersonCharacter>> Characters;
+};
@@ -0,0 +1,109 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "FirstPersonBotController.h"
+#include "LoadTest.generated.h"
+
+/**
+ * Headless load test of the game mode, enabled from the server command line:
+ *   -FPBots=64                    number of bot characters to spawn, 0 only reports
+ *   -FPLoadTestCSV=LoadTest.csv   report file, relative to the project's Saved folder
+ *   -FPLoadTestInterval=1         seconds between report rows
+ *   -FPLoadTestDuration=300       seconds before the server exits, 0 runs forever
+ *   -FPLoadTestNet=0:0:0,150:50:5 network conditions played in turn, as PktLag:PktLagVariance:PktLoss
+ *   -FPLoadTestStageTime=60       seconds of each network condition
+ *
+ * Remote clients started with -FPClientBot are played by a bot as well, so their movement goes
+ * through client prediction. Each condition of -FPLoadTestNet is simulated by the server on the
+ * packets it sends and receives, so the clients need no settings of their own, and the server
+ * logs the movement corrections it sent under it when it ends. The run lasts one stage time per
+ * condition unless -FPLoadTestDuration says otherwise. The engine's -PktLag, -PktLagVariance and
+ * -PktLoss apply for the whole run instead. The report's PktLag and PktLoss columns are the
+ * server's settings of the row. Client bots log the percentiles of their fire latency stages when
+ * they exit, the server at the end of the map: run them with fp.Projectile.Predicted 0 and 1 to
+ * compare waiting for the server against predicted projectiles under the same lag.
+ *
+ * NetTickMs is the server's time replicating actors and sending packets. Running 16, 64 and 128
+ * client bots against a server started with and without -dpcvars=fp.Net.ReplicationGraph=0
+ * compares UFirstPersonReplicationGraph against the net driver's own relevancy checks.
+ */
+UCLASS()
+class FIRSTPERSON_API ULoadTestSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+private:
+	void SpawnBots();
+	void WriteRow();
+
+	// Simulates the network condition of NetStages[Index] on the server's connections
+	void StartNetStage(int32 Index);
+
+	// Logs the movement corrections sent under the current network condition
+	void EndNetStage();
+
+	// Time the net driver's TickFlush, measured from before it to after it
+	void OnTickFlush(float DeltaSeconds);
+	void OnPostTickFlush();
+
+	// Plays the local player's character on a client started with -FPClientBot
+	void TickClientBot(float DeltaTime);
+
+	int32 NumBots = 0;
+	float Interval = 1.f;
+	float Duration = 0.f;
+	FString CSVPath;
+
+	bool bStarted = false;
+	bool bClientBot = false;
+	FFirstPersonBotBrain ClientBrain;
+	float ElapsedTime = 0.f;
+	float TimeSinceRow = 0.f;
+
+	// Busy game thread time of the frames since the last row
+	int32 Frames = 0;
+	double BusyMs = 0.0;
+	double MaxBusyMs = 0.0;
+
+	// Net driver tick time since the last row
+	FDelegateHandle TickFlushHandle;
+	FDelegateHandle PostTickFlushHandle;
+	double NetTickStart = 0.0;
+	int32 NetTicks = 0;
+	double NetTickMs = 0.0;
+	double MaxNetTickMs = 0.0;
+
+	// FFirstPersonNetStats RPC and movement correction totals at the last row
+	int64 LastRPCCalls = 0;
+	int64 LastCorrections = 0;
+
+	// Network conditions of -FPLoadTestNet, in milliseconds and percent
+	struct FNetStage
+	{
+		int32 Lag = 0;
+		int32 LagVariance = 0;
+		int32 Loss = 0;
+	};
+	TArray<FNetStage> NetStages;
+	int32 NetStage = INDEX_NONE;
+	float StageTime = 60.f;
+	float StageStartTime = 0.f;
+	int64 StageStartCorrections = 0;
+};
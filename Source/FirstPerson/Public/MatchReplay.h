@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "MatchReplay.generated.h"
+
+/**
+ * Records the matches of a server into replays of the demo net driver, enabled from the command line
+ * or the console:
+ *   -FPRecordReplay[=Name]      record each map from when it begins play, named <Map>_<Date> by default
+ *   fp.Replay.Record [Name]     start recording the current map
+ *   fp.Replay.Stop              stop recording, the size is reported once the file stops growing
+ *
+ * Replays are written as one streamed file per match in Saved/Demos, with a checkpoint every
+ * demo.CheckpointUploadDelayInSeconds (DefaultEngine.ini), so seeking loads the checkpoint before the
+ * time and only reads the stream from there. Characters are recorded through their replicated
+ * properties, already quantized: movement, ReplicatedAim for LookRotation, the movement component's
+ * crouch state for isCrouched and EquippedGun. Shots are recorded as one unreliable Replay_OnFire per
+ * shot that only the replay gets, instead of the game's Multi_OnFire or relayed batches.
+ *
+ * Play them back with demoplay <Name>. fp.Replay.Seek <Seconds> and fp.Bench.ReplaySeek [Seeks=10]
+ * report how long seeking takes during playback.
+ */
+UCLASS()
+class FIRSTPERSON_API UMatchReplaySubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+	/** Starts recording the world into a replay, on the server. An empty name is <Map>_<Date> */
+	bool StartRecording(const FString& Name);
+
+	/** Stops the recording and reports the replay's size per player-minute */
+	void StopRecording();
+
+	bool IsRecording() const { return !ReplayName.IsEmpty(); }
+
+	/** True when shots of characters in World should be sent to its replay */
+	static bool IsRecordingShots(const UWorld* World);
+
+private:
+	/**
+	 * Stops the recording. The size is reported once the streamer is done writing the file, or right away
+	 * with what is written so far when the world is going away and nothing may tick until it is done.
+	 */
+	void FinishRecording(bool bReportNow);
+
+	// Name of the replay being recorded, empty when not recording
+	FString ReplayName;
+
+	// Players times seconds they were recorded for
+	double PlayerSeconds = 0.0;
+	double RecordedSeconds = 0.0;
+};
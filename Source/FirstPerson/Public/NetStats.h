@@ -0,0 +1,147 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/Class.h"
+#include "UObject/CoreNet.h"
+
+class AActor;
+class UNetConnection;
+struct FNetDeltaSerializeInfo;
+
+// Traffic of one RPC or replicated property on one connection
+struct FNetStatsEntry
+{
+	int64 Calls = 0;
+
+	// Serialized parameters or property value, bunch and property headers not included
+	int64 Bits = 0;
+
+	// Highest number of unacknowledged reliable bunches on the actor channel when it was sent
+	int32 MaxReliableBuffer = 0;
+};
+
+/**
+ * Counts the RPCs and replicated properties of gameplay actors per connection.
+ *
+ * The server records the server RPCs it receives and the multicasts and property updates it
+ * sends, clients record the server RPCs they send. Results are available through the
+ * fp.NetStats console command, the FirstPersonNet stat group, the CSV profiler and a periodic
+ * CSV file (fp.NetStats.CsvInterval).
+ *
+ * Off unless fp.NetStats.Enable is set, and always off in shipping builds: measuring serializes
+ * every parameter and property value a second time.
+ */
+class FIRSTPERSON_API FFirstPersonNetStats
+{
+public:
+	static FFirstPersonNetStats& Get();
+
+	static bool IsEnabled();
+
+	/** Sets fp.NetStats.Enable, for the tools that report the totals */
+	static void SetEnabled(bool bEnabled);
+
+	/** Starts and stops appending to the CSV file, called by the module */
+	static void StartupModule();
+	static void ShutdownModule();
+
+	/** Records an RPC of Actor travelling on its owner's connection */
+	template<typename... TParams>
+	static void RecordRPC(AActor* Actor, FName Name, const TParams&... Params)
+	{
+		if (IsEnabled()) Get().RecordRPCBits(Actor, Name, MeasureBits(Params...));
+	}
+
+	/** Records an RPC of Actor whose parameters the caller measured, for parameters MeasureBits can't serialize */
+	static void RecordRPCSize(AActor* Actor, FName Name, int64 Bits)
+	{
+		if (IsEnabled()) Get().RecordRPCBits(Actor, Name, Bits);
+	}
+
+	/** Records a multicast RPC of Actor going to every connection it is replicated to */
+	template<typename... TParams>
+	static void RecordMulticast(AActor* Actor, FName Name, const TParams&... Params)
+	{
+		if (IsEnabled()) Get().RecordMulticastBits(Actor, Name, MeasureBits(Params...));
+	}
+
+	/** Records an update of the replicated property Name of Actor going to every connection it is replicated to */
+	static void RecordProperty(AActor* Actor, FName Name, bool bSkipOwner)
+	{
+		if (IsEnabled()) Get().RecordPropertyBits(Actor, Name, MeasurePropertyBits(Actor, Name), bSkipOwner);
+	}
+
+	/** Records the Bits a custom delta property wrote in NetDeltaSerialize, on the connection it is written for */
+	static void RecordDeltaProperty(const FNetDeltaSerializeInfo& DeltaParms, FName Name, int64 Bits)
+	{
+		if (IsEnabled()) Get().RecordDeltaPropertyBits(DeltaParms, Name, Bits);
+	}
+
+	/** Size of RPC parameters as they are serialized on the wire */
+	template<typename... TParams>
+	static int64 MeasureBits(const TParams&... Params)
+	{
+		FNetBitWriter Writer(nullptr, 1024);
+		int32 Unused[] = { 0, (SerializeParam(Writer, Params), 0)... };
+		(void)Unused;
+		return Writer.GetNumBits();
+	}
+
+	/** Size of the value of Actor's property Name as the property serializes it on the wire, 0 if it has none */
+	static int64 MeasurePropertyBits(const AActor* Actor, FName Name);
+
+	void Dump(FOutputDevice& Ar) const;
+	void Reset();
+
+	/** Total number of RPCs recorded since the last reset, a multicast counts once */
+	int64 GetTotalRPCCalls() const { return TotalRPCCalls; }
+
+private:
+	FFirstPersonNetStats();
+
+	void RecordRPCBits(AActor* Actor, FName Name, int64 Bits);
+	void RecordMulticastBits(AActor* Actor, FName Name, int64 Bits);
+	void RecordPropertyBits(AActor* Actor, FName Name, int64 Bits, bool bSkipOwner);
+	void RecordDeltaPropertyBits(const FNetDeltaSerializeInfo& DeltaParms, FName Name, int64 Bits);
+	// Adds a call to a connection's entry, returns false without a connection
+	bool Record(AActor* Actor, UNetConnection* Connection, FName Name, int64 Bits, bool bRPC);
+
+	void CountRPCCall();
+
+	// Appends the current totals to the CSV file, called every fp.NetStats.CsvInterval seconds
+	bool WriteCSV(float DeltaTime);
+
+	static void SerializeParam(FNetBitWriter& Writer, const FRotator& Value);
+	static void SerializeParam(FNetBitWriter& Writer, bool Value);
+	template<typename T>
+	static typename TEnableIf<!TStructOpsTypeTraits<T>::WithNetSerializer>::Type SerializeParam(FNetBitWriter& Writer, const T& Value)
+	{
+		Writer << const_cast<T&>(Value);
+	}
+
+	// Structs with their own NetSerialize go through it
+	template<typename T>
+	static typename TEnableIf<TStructOpsTypeTraits<T>::WithNetSerializer>::Type SerializeParam(FNetBitWriter& Writer, const T& Value)
+	{
+		bool bSuccess = true;
+		const_cast<T&>(Value).NetSerialize(Writer, nullptr, bSuccess);
+	}
+
+	// Entries of a connection per RPC or property name
+	struct FConnectionStats
+	{
+		// Remote address, kept for the connections closed since
+		FString Address;
+		TMap<FName, FNetStatsEntry> Entries;
+	};
+
+	TMap<TWeakObjectPtr<UNetConnection>, FConnectionStats> Connections;
+
+	int64 TotalRPCCalls = 0;
+	float TimeSinceCSV = 0.f;
+	FDelegateHandle CSVTickerHandle;
+	double StartTime = 0.0;
+	FString CSVPath;
+};
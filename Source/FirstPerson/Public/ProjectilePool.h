@@ -0,0 +1,96 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "ProjectilePool.generated.h"
+
+class AFirstPersonProjectile;
+
+// What to do when a pool has no free projectile left
+UENUM()
+enum class EProjectilePoolOverflow : uint8
+{
+	Grow,			// Spawn a new projectile and keep it in the pool
+	RecycleOldest,	// Reuse the projectile that was fired first
+	Drop			// Don't fire
+};
+
+// Free and in-flight projectiles of one class
+USTRUCT()
+struct FProjectilePool
+{
+	GENERATED_BODY()
+
+	UPROPERTY()
+	TArray<AFirstPersonProjectile*> Free;
+
+	// Every projectile of the pool, free or in flight
+	UPROPERTY()
+	TArray<AFirstPersonProjectile*> All;
+
+	// Projectiles in flight, linked through their PoolPrev and PoolNext in firing order
+	AFirstPersonProjectile* Oldest = nullptr;
+	AFirstPersonProjectile* Newest = nullptr;
+
+	void AddNewest(AFirstPersonProjectile* Projectile);
+	void Remove(AFirstPersonProjectile* Projectile);
+};
+
+struct FProjectilePoolStats
+{
+	// Projectiles taken from the free list
+	int32 Hits = 0;
+
+	// Projectiles that had to be spawned, recycled or dropped
+	int32 Misses = 0;
+
+	int32 Active = 0;
+	int32 Peak = 0;
+};
+
+/**
+ * Keeps projectiles alive and hidden between shots, instead of spawning and destroying an actor per shot.
+ */
+UCLASS(config=Game)
+class FIRSTPERSON_API UProjectilePoolSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	/** Fires a projectile from the pool of World, or spawns a new actor when fp.ProjectilePool.Enable is 0 */
+	static AFirstPersonProjectile* SpawnProjectile(UWorld* World, TSubclassOf<AFirstPersonProjectile> Class, const FVector& Location, const FRotator& Rotation);
+
+	/**
+	 * Fires a projectile of Class from the pool, returns nullptr if it was dropped. A projectile taken back
+	 * by RecycleOldest gets a new PoolGeneration, holders of the previous one must let go of it.
+	 */
+	AFirstPersonProjectile* Acquire(TSubclassOf<AFirstPersonProjectile> Class, const FVector& Location, const FRotator& Rotation);
+
+	/** Returns a fired projectile to its pool */
+	void Release(AFirstPersonProjectile* Projectile);
+
+	/** Spawns projectiles of Class until its pool holds PoolSize of them */
+	void Prewarm(TSubclassOf<AFirstPersonProjectile> Class);
+
+	const FProjectilePoolStats& GetStats() const { return Stats; }
+	void ResetStats();
+
+	/** Number of projectiles of each class spawned up front */
+	UPROPERTY(config)
+	int32 PoolSize = 64;
+
+	UPROPERTY(config)
+	EProjectilePoolOverflow OverflowPolicy = EProjectilePoolOverflow::Grow;
+
+private:
+	AFirstPersonProjectile* SpawnPooled(TSubclassOf<AFirstPersonProjectile> Class);
+
+	UPROPERTY()
+	TMap<UClass*, FProjectilePool> Pools;
+
+	FProjectilePoolStats Stats;
+};
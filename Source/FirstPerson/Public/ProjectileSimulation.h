@@ -0,0 +1,119 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "Weapon.h"
+#include "ProjectileSimulation.generated.h"
+
+class AFirstPersonCharacter;
+class AFirstPersonProjectile;
+
+DECLARE_MULTICAST_DELEGATE_TwoParams(FOnSimulatedProjectileHit, const FHitResult& /*Hit*/, const FVector& /*Velocity*/);
+
+// Movement settings read once from the defaults of a projectile class
+struct FProjectileClassParams
+{
+	TSubclassOf<AFirstPersonProjectile> Class;
+	float Speed = 0.f;
+	float GravityZ = 0.f;
+	float Radius = 0.f;
+	float LifeSpan = 0.f;
+	float Bounciness = 0.f;
+	float Friction = 0.f;
+	bool bShouldBounce = false;
+	ECollisionChannel Channel = ECC_WorldDynamic;
+	FCollisionResponseParams ResponseParams;
+};
+
+/**
+ * Simulates all projectiles of the world together. State is kept in flat arrays that are
+ * integrated in one pass and swept in a batch, optionally across worker threads.
+ * Projectile actors are only used as visuals that follow the simulation on clients.
+ */
+UCLASS()
+class FIRSTPERSON_API UProjectileSimulationSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+	/**
+	 * Fires a projectile, simulated here when fp.Projectile.BatchedSimulation is set or as a pooled actor otherwise.
+	 * Damage is queued in UDamageQueueSubsystem when it hits a character other than Instigator, as a hit of Weapon.
+	 * The projectile starts FastForward seconds into its flight, and can be found again by Instigator and ShotId.
+	 */
+	static void Fire(UWorld* World, TSubclassOf<AFirstPersonProjectile> Class, const FVector& Location, const FRotator& Rotation,
+		AFirstPersonCharacter* Instigator = nullptr, int32 Damage = 0, EWeaponType Weapon = Melee, uint16 ShotId = 0, float FastForward = 0.f);
+
+	/** True when projectiles are simulated here */
+	static bool IsBatched();
+
+	/** Adds a projectile to the simulation, returns its index */
+	int32 Add(TSubclassOf<AFirstPersonProjectile> Class, const FVector& Location, const FRotator& Rotation, bool bWithVisual,
+		AFirstPersonCharacter* Instigator = nullptr, int32 Damage = 0, EWeaponType Weapon = Melee, uint16 ShotId = 0, float FastForward = 0.f);
+
+	/** Removes every projectile of a shot, returns how many there were */
+	int32 RemoveShot(const AFirstPersonCharacter* Instigator, uint16 ShotId);
+
+	/** Removes every projectile */
+	void Reset();
+
+	int32 Num() const { return PosX.Num(); }
+
+	/** Broadcast on the game thread for every projectile hit */
+	FOnSimulatedProjectileHit OnProjectileHit;
+
+private:
+	int32 FindOrAddClassParams(TSubclassOf<AFirstPersonProjectile> Class);
+
+	// Moves a projectile to the end of its sweep, or handles its hit. Returns false if it stopped.
+	bool Resolve(int32 Index);
+
+	void RemoveAtSwap(int32 Index);
+
+	// Visual of a projectile, nullptr once the pool recycled it for another shot
+	AFirstPersonProjectile* GetVisual(int32 Index) const;
+
+	TArray<FProjectileClassParams> ClassParams;
+
+	// One entry per projectile
+	TArray<float> PosX;
+	TArray<float> PosY;
+	TArray<float> PosZ;
+	TArray<float> VelX;
+	TArray<float> VelY;
+	TArray<float> VelZ;
+	TArray<float> GravityZ;
+	TArray<float> LifeLeft;
+	TArray<int32> ClassIndex;
+	TArray<TWeakObjectPtr<AFirstPersonProjectile>> Visuals;
+	TArray<uint32> VisualGenerations;
+	TArray<TWeakObjectPtr<AFirstPersonCharacter>> Instigators;
+	TArray<int32> Damage;
+	TArray<TEnumAsByte<EWeaponType>> Weapons;
+	TArray<uint16> ShotIds;
+
+	// Extra seconds simulated on the next tick, to catch up with a shot fired in the past
+	TArray<float> FastForwardTime;
+
+	// Scratch space of the sweeps, kept between ticks to avoid allocations
+	TArray<FVector> SweepEnd;
+	TArray<FHitResult> SweepHits;
+	TArray<uint8> SweepBlocked;
+
+	// Object id of each projectile's instigator, ignored by its sweep, 0 without one
+	TArray<uint32> SweepIgnored;
+};
@@ -0,0 +1,120 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Telemetry.generated.h"
+
+// Gameplay events recorded in telemetry files, values are stored in the files
+enum class ETelemetryEvent : uint8
+{
+	Shot = 0,
+	Hit = 1,
+	Pickup = 2,
+	Reload = 3,
+	WeaponSwitch = 4,
+	Death = 5,
+	Num
+};
+
+/**
+ * One event of a telemetry file. Records are 32 bytes, naturally aligned and stored as they are in
+ * memory (little endian), so a mapped file can be read as an array of them after the header.
+ */
+struct FTelemetryRecord
+{
+	// Seconds since the file was started
+	float Time;
+
+	// Player id of the character's player state, or the actor's object id without one
+	uint32 Subject;
+
+	// Victim of a hit, killer of a death, 0 otherwise
+	uint32 Other;
+
+	float X;
+	float Y;
+	float Z;
+
+	// Damage of a hit, rounds in the clip after a reload
+	int16 Value;
+
+	// Spread seed of a shot
+	uint16 Seed;
+
+	uint8 Type;
+	uint8 Weapon;
+	uint8 Padding[2];
+};
+static_assert(sizeof(FTelemetryRecord) == 32, "Telemetry records are stored as they are in memory");
+
+/** Start of a telemetry file, followed by the records */
+struct FTelemetryFileHeader
+{
+	static const uint32 FileMagic = 0x4D545046; // "FPTM"
+	static const uint16 FileVersion = 1;
+
+	uint32 Magic = FileMagic;
+	uint16 Version = FileVersion;
+	uint16 RecordSize = sizeof(FTelemetryRecord);
+
+	// Written when the file is closed, 0 while it is being written: readers count the records from the file size then
+	uint64 NumRecords = 0;
+
+	// Events lost to full buffers
+	uint64 NumDropped = 0;
+
+	// UTC time the file was started, in FDateTime ticks
+	int64 StartTicks = 0;
+
+	// Name of the map, null terminated
+	ANSICHAR Map[64] = {};
+};
+static_assert(sizeof(FTelemetryFileHeader) % sizeof(FTelemetryRecord) == 0, "Records stay aligned after the header");
+
+/**
+ * Binary gameplay telemetry. Record writes a fixed size record into a lock-free ring buffer of the
+ * calling thread and returns, a background thread appends the buffers to the file. Events are dropped
+ * and counted when a buffer is full, the calling thread never waits.
+ */
+class FIRSTPERSON_API FGameplayTelemetry
+{
+public:
+	/** Starts writing events to a new file, stopping the previous one. Returns false if the file can't be created */
+	static bool Start(const FString& Path, const FString& MapName);
+
+	/** Writes the events recorded so far, then closes the file. Called on the game thread */
+	static void Stop();
+
+	static bool IsRecording();
+
+	static void Record(ETelemetryEvent Type, uint32 Subject, uint32 Other, const FVector& Location, uint8 Weapon = 0, int16 Value = 0, uint16 Seed = 0);
+
+	/** Waits until every recorded event is written to the file */
+	static void Flush();
+
+	static uint64 GetNumDropped();
+
+	/** Id of a character in records, stable across its respawns when it has a player state */
+	static uint32 GetSubjectId(const AActor* Actor);
+};
+
+/**
+ * Records the gameplay events of each match on the server into Saved/Telemetry/<Map>_<Date>.fptm, when
+ * started with -FPTelemetry or with fp.Telemetry.Enabled set as the map loads. The TelemetryToCSV
+ * commandlet converts the files to CSV.
+ */
+UCLASS()
+class FIRSTPERSON_API UTelemetrySubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+	virtual void Deinitialize() override;
+
+private:
+	bool bStarted = false;
+};
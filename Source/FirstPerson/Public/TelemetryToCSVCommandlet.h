@@ -0,0 +1,22 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "TelemetryToCSVCommandlet.generated.h"
+
+/**
+ * Converts a telemetry file written by UTelemetrySubsystem to CSV, one row per event:
+ *   UE4Editor-Cmd FirstPerson.uproject -run=TelemetryToCSV -In=Saved/Telemetry/Map.fptm [-Out=Map.csv]
+ * The output defaults to the input with a .csv extension. Files of a crashed server, whose header was
+ * never completed, are read up to their last whole record.
+ */
+UCLASS()
+class FIRSTPERSON_API UTelemetryToCSVCommandlet : public UCommandlet
+{
+	GENERATED_BODY()
+
+public:
+	virtual int32 Main(const FString& Params) override;
+};
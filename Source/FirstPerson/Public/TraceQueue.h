@@ -0,0 +1,89 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CollisionQueryParams.h"
+#include "CollisionShape.h"
+#include "Engine/EngineTypes.h"
+#include "Engine/World.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "TraceQueue.generated.h"
+
+typedef TFunction<void(const TArray<FHitResult>& Hits)> FTraceQueueCallback;
+
+// Trace submitted during the frame, a line when Shape is a line
+struct FQueuedTrace
+{
+	FVector Start;
+	FVector End;
+	FQuat Rotation;
+	FCollisionShape Shape;
+	ECollisionChannel Channel;
+	FCollisionQueryParams Params;
+	EAsyncTraceType Type;
+	TWeakObjectPtr<const UObject> Owner;
+	FTraceQueueCallback Callback;
+};
+
+// Trace handed to the engine, waiting for its result
+struct FPendingTrace
+{
+	TWeakObjectPtr<const UObject> Owner;
+	FTraceQueueCallback Callback;
+};
+
+/**
+ * Queue for gameplay traces that can wait a frame.
+ *
+ * Traces submitted during the frame are handed to the engine's async trace interface in one
+ * batch when the queue ticks, at most fp.TraceQueue.MaxPerFrame of them, and run on worker
+ * threads while the frame finishes. Their callbacks are called at the start of the next frame,
+ * unless their owner is gone by then. With fp.TraceQueue.Async 0 traces run synchronously
+ * and call back right away.
+ */
+UCLASS()
+class FIRSTPERSON_API UTraceQueueSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Initialize(FSubsystemCollectionBase& Collection) override;
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+	/** Queues a line trace, Callback gets the blocking hit or all hits up to it when Type is Multi */
+	void LineTrace(const UObject* Owner, EAsyncTraceType Type, const FVector& Start, const FVector& End, ECollisionChannel Channel,
+		const FCollisionQueryParams& Params, FTraceQueueCallback Callback);
+
+	/** Queues a shape sweep */
+	void Sweep(const UObject* Owner, EAsyncTraceType Type, const FVector& Start, const FVector& End, const FQuat& Rotation, const FCollisionShape& Shape,
+		ECollisionChannel Channel, const FCollisionQueryParams& Params, FTraceQueueCallback Callback);
+
+	int32 NumQueued() const { return Queued.Num(); }
+	int32 NumPending() const { return Pending.Num(); }
+
+private:
+	void Submit(FQueuedTrace&& Trace);
+
+	// Runs a trace on the game thread and calls back
+	void RunNow(const FQueuedTrace& Trace);
+
+	void OnTraceDone(const FTraceHandle& Handle, FTraceDatum& Datum);
+
+	TArray<FQueuedTrace> Queued;
+
+	// Traces the engine is running, by the user data they were submitted with
+	TMap<uint32, FPendingTrace> Pending;
+	uint32 NextUserData = 0;
+
+	FTraceDelegate TraceDelegate;
+};
@@ -17,6 +17,10 @@ enum EWeaponType
 	MAX_WEAPON_TYPE
 };
 
+/**
+ * Weapon pickup. Doesn't tick and stays net dormant until it is taken or respawns. Characters
+ * find it and its respawn is scheduled through UWeaponPickupSubsystem.
+ */
 UCLASS()
 class FIRSTPERSON_API AWeapon : public AActor
 {
@@ -34,35 +38,50 @@ public:
 	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
 	TEnumAsByte<EWeaponType> weaponType;
 
+	// The limits are FFirstPersonInventory's replicated ranges
+
 	// Total amount of ammo that can be in the weapon
-	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
+	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon, meta = (ClampMin = "0", ClampMax = "63", UIMin = "0", UIMax = "63"))
 	int maxClipAmmo;
 
 	// Total amount of ammo in the weapon
-	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
+	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon, meta = (ClampMin = "0", ClampMax = "63", UIMin = "0", UIMax = "63"))
 	int clipAmmo;
 
 	// Time it takes to reload the weapon
-	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
+	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon, meta = (ClampMin = "0", ClampMax = "31", UIMin = "0", UIMax = "31"))
 	int reloadTime;
 
 	// Weapon damage
-	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
+	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon, meta = (ClampMin = "0", ClampMax = "255", UIMin = "0", UIMax = "255"))
 	int damage;
 
+	// Time before a taken pickup is available again, in seconds
+	UPROPERTY(EditAnyWhere, BlueprintReadWrite, Category = Weapon)
+	float RespawnTime = 30.f;
+
 protected:
 	// Called when the game starts or when spawned
 	virtual void BeginPlay() override;
 
 	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 
+	// Whether the pickup can be taken, hidden and without collision otherwise
+	UPROPERTY(ReplicatedUsing = OnRep_Available)
+	bool bAvailable = true;
+
+	UFUNCTION()
+	void OnRep_Available();
+
 public:	
-	// Called every frame
-	virtual void Tick(float DeltaTime) override;
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
+	bool IsAvailable() const { return bAvailable; }
 
+	/** Takes the pickup on the server and schedules its respawn */
 	void OnWeaponPickup();
 
-	UFUNCTION()
+	/** Makes the pickup available again, called by UWeaponPickupSubsystem */
 	void OnWeaponSpawn();
 
 };
@@ -0,0 +1,68 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/StreamableManager.h"
+#include "Subsystems/GameInstanceSubsystem.h"
+#include "WeaponMeshCache.generated.h"
+
+class UStaticMesh;
+class USceneComponent;
+
+/** Mesh and placement of one weapon in one view */
+USTRUCT()
+struct FIRSTPERSON_API FWeaponMeshSlot
+{
+	GENERATED_BODY()
+
+	/** Mesh shown while the weapon is equipped, loaded the first time any character equips it */
+	UPROPERTY(EditDefaultsOnly, Category = Mesh)
+	TSoftObjectPtr<UStaticMesh> Mesh;
+
+	/** Placement relative to the parent's socket */
+	UPROPERTY(EditDefaultsOnly, Category = Mesh)
+	FTransform RelativeTransform;
+
+	UPROPERTY(EditDefaultsOnly, Category = Mesh)
+	FName Socket;
+
+	/** Component the mesh is attached to, the body of the view when not set */
+	UPROPERTY(Transient)
+	USceneComponent* Parent = nullptr;
+};
+
+typedef TFunction<void(UStaticMesh* Mesh)> FWeaponMeshLoaded;
+
+// Load in flight and the callers waiting for it
+struct FPendingWeaponMesh
+{
+	TSharedPtr<FStreamableHandle> Handle;
+	TArray<FWeaponMeshLoaded> Callbacks;
+};
+
+/**
+ * Weapon meshes shared by every character. Each mesh is loaded asynchronously the first time it is
+ * requested and kept loaded for the rest of the game, so later requests are answered on the spot.
+ */
+UCLASS()
+class FIRSTPERSON_API UWeaponMeshCache : public UGameInstanceSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	/** Calls OnLoaded with the mesh once it is loaded, right away if it is already */
+	void Request(const TSoftObjectPtr<UStaticMesh>& Mesh, FWeaponMeshLoaded OnLoaded);
+
+	int32 NumCached() const { return Cached.Num(); }
+
+private:
+	void OnLoaded(FSoftObjectPath Path);
+
+	UPROPERTY()
+	TArray<UStaticMesh*> Cached;
+
+	TMap<FSoftObjectPath, FPendingWeaponMesh> Pending;
+};
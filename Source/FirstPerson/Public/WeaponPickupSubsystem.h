@@ -0,0 +1,100 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Engine/EngineTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "WeaponPickupSubsystem.generated.h"
+
+class AFirstPersonCharacter;
+class AWeapon;
+
+struct FPendingPickupRespawn
+{
+	double Time;
+	TWeakObjectPtr<AWeapon> Pickup;
+
+	bool operator<(const FPendingPickupRespawn& Other) const { return Time < Other.Time; }
+};
+
+// Available pickup in a grid cell, pickups don't move
+struct FPickupCellEntry
+{
+	AWeapon* Pickup;
+	FVector Location;
+};
+
+/**
+ * Server side weapon pickups.
+ *
+ * Available pickups are kept in a uniform grid, only updated when one is taken or respawns.
+ * Registered characters query it at a fixed rate (fp.Pickup.QueryRate) instead of relying on
+ * overlap events of their capsule.
+ *
+ * Pending respawns are kept in a min-heap on their due time, with a single timer armed for
+ * the earliest one.
+ */
+UCLASS(config=Game)
+class FIRSTPERSON_API UWeaponPickupSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+	/** Makes Pickup available again after Delay seconds */
+	void ScheduleRespawn(AWeapon* Pickup, float Delay);
+
+	int32 NumPendingRespawns() const { return Pending.Num(); }
+
+	/** Adds an available pickup to the grid */
+	void AddPickup(AWeapon* Pickup);
+
+	/** Removes a pickup from the grid, when taken or gone */
+	void RemovePickup(AWeapon* Pickup);
+
+	/** Returns an available pickup within Radius horizontally and HalfHeight vertically of Location */
+	AWeapon* FindPickup(const FVector& Location, float Radius, float HalfHeight) const;
+
+	/** Characters that pick up weapons they walk over */
+	void RegisterCharacter(AFirstPersonCharacter* Character);
+	void UnregisterCharacter(AFirstPersonCharacter* Character);
+
+	/** Edge length of the grid cells, about the distance characters travel between queries */
+	UPROPERTY(config)
+	float CellSize = 500.f;
+
+	/** Reach of a character beyond its capsule radius */
+	UPROPERTY(config)
+	float PickupRadius = 50.f;
+
+private:
+	// Respawns every pickup that is due, then arms the timer for the next one
+	void RespawnDue();
+	void ArmTimer();
+
+	// Lets every registered character take the pickup it stands on
+	void QueryCharacters();
+
+	FIntPoint GetCell(const FVector& Location) const;
+
+	TArray<FPendingPickupRespawn> Pending;
+
+	FTimerHandle TimerHandle;
+	double ArmedTime = 0.0;
+
+	TMap<FIntPoint, TArray<FPickupCellEntry>> Cells;
+
+	TArray<TWeakObjectPtr<AFirstPersonCharacter>> Characters;
+	float TimeSinceQuery = 0.f;
+};
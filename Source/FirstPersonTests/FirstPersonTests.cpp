@@ -0,0 +1,9 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#include "FirstPersonTests.h"
+#include "Modules/ModuleManager.h"
+
+DEFINE_LOG_CATEGORY(LogFPTests);
+
+// Automation tests and the perf suite of the game module, left out of shipping builds
+IMPLEMENT_MODULE(FDefaultModuleImpl, FirstPersonTests);
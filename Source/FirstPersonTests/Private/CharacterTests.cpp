@@ -0,0 +1,253 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FirstPersonCharacter.h"
+#include "FirstPersonTestAccess.h"
+#include "Weapon.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+#include "GameFramework/PlayerStart.h"
+#include "Misc/AutomationTest.h"
+#include "Tests/AutomationCommon.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+// In a game or on a server, the characters need a game world that has begun play
+static const int32 CharacterTestFlags = EAutomationTestFlags::ClientContext | EAutomationTestFlags::ServerContext | EAutomationTestFlags::ProductFilter;
+
+static const TCHAR* CharacterTestMap = TEXT("/Game/FirstPerson/Maps/FirstPersonExampleMap");
+
+// Actors of a test, shared by its latent commands
+struct FCharacterTestState
+{
+	TWeakObjectPtr<AFirstPersonCharacter> Character;
+	TArray<TWeakObjectPtr<AActor>> Spawned;
+	float StartHealth = 0.f;
+
+	UWorld* GetWorld() const { return AutomationCommon::GetAnyGameWorld(); }
+
+	AFirstPersonCharacter* Spawn(const FVector& Offset)
+	{
+		UWorld* World = GetWorld();
+		if (World == nullptr) return nullptr;
+
+		// In front of the map's player start, where there is floor
+		FVector Location = FVector::ZeroVector;
+		for (TActorIterator<APlayerStart> It(World); It; ++It)
+		{
+			Location = It->GetActorLocation();
+			break;
+		}
+
+		AFirstPersonCharacter* Character = FFirstPersonTestAccess::SpawnCharacter(World, Location + Offset);
+		if (Character != nullptr) Spawned.Add(Character);
+		return Character;
+	}
+
+	void DestroySpawned()
+	{
+		for (const TWeakObjectPtr<AActor>& Actor : Spawned)
+		{
+			if (Actor.IsValid()) Actor->Destroy();
+		}
+		Spawned.Reset();
+	}
+};
+
+// Opens the map, then spawns the character the test plays once the world settled
+static TSharedRef<FCharacterTestState> StartCharacterTest(FAutomationTestBase* Test)
+{
+	TSharedRef<FCharacterTestState> State = MakeShared<FCharacterTestState>();
+	AutomationOpenMap(CharacterTestMap);
+	ADD_LATENT_AUTOMATION_COMMAND(FEngineWaitLatentCommand(0.5f));
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([Test, State]()
+	{
+		State->Character = State->Spawn(FVector(0.f, 0.f, 50.f));
+		if (!State->Character.IsValid()) Test->AddError(TEXT("The game mode has no character class to spawn"));
+		return true;
+	}));
+	return State;
+}
+
+// Waits until Condition is true, or fails the test with What after Timeout seconds
+static void WaitUntil(FAutomationTestBase* Test, TSharedRef<FCharacterTestState> State, const FString& What, float Timeout, TFunction<bool()> Condition)
+{
+	const TSharedRef<double> GiveUpTime = MakeShared<double>(0.0);
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([Test, State, What, Timeout, Condition, GiveUpTime]()
+	{
+		if (!State->Character.IsValid()) return true;
+		if (*GiveUpTime == 0.0) *GiveUpTime = FPlatformTime::Seconds() + Timeout;
+
+		if (Condition()) return true;
+		if (FPlatformTime::Seconds() < *GiveUpTime) return false;
+
+		Test->AddError(FString::Printf(TEXT("%s after %.1f s"), *What, Timeout));
+		return true;
+	}));
+}
+
+static void EndCharacterTest(TSharedRef<FCharacterTestState> State)
+{
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([State]()
+	{
+		State->DestroySpawned();
+		return true;
+	}));
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCharacterFireTest, "FirstPerson.Character.Fire", CharacterTestFlags)
+
+bool FCharacterFireTest::RunTest(const FString& Parameters)
+{
+	TSharedRef<FCharacterTestState> State = StartCharacterTest(this);
+
+	// A victim in the line of fire, shooters without a controller aim along +X
+	TSharedRef<TWeakObjectPtr<AFirstPersonCharacter>> Victim = MakeShared<TWeakObjectPtr<AFirstPersonCharacter>>();
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([State, Victim]()
+	{
+		*Victim = State->Spawn(FVector(400.f, 0.f, 50.f));
+		if (Victim->IsValid()) State->StartHealth = FFirstPersonTestAccess::GetHealth(Victim->Get());
+		return true;
+	}));
+
+	// Lag compensation has the victim's poses by then
+	ADD_LATENT_AUTOMATION_COMMAND(FEngineWaitLatentCommand(0.5f));
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, State, Victim]()
+	{
+		AFirstPersonCharacter* Character = State->Character.Get();
+		if (Character == nullptr) return true;
+
+		TestNotNull(TEXT("Victim"), Victim->Get());
+		TestNotNull(TEXT("The character's projectile class"), Character->ProjectileClass.Get());
+		TestTrue(TEXT("The revolver is equipped"), Character->Inventory.Equipped == Revolver);
+
+		const int32 ClipAmmo = Character->Inventory.Weapons[Revolver].clipAmmo;
+		FFirstPersonTestAccess::Fire(Character);
+		TestEqual(TEXT("A shot takes one round from the clip"), Character->Inventory.Weapons[Revolver].clipAmmo, ClipAmmo - 1);
+		return true;
+	}));
+
+	// Resolved by the trace queue or the projectile's flight, then applied by the damage queue
+	WaitUntil(this, State, TEXT("The victim was not damaged"), 2.f, [Victim, State]()
+	{
+		return Victim->IsValid() && FFirstPersonTestAccess::GetHealth(Victim->Get()) < State->StartHealth;
+	});
+
+	EndCharacterTest(State);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCharacterReloadTest, "FirstPerson.Character.Reload", CharacterTestFlags)
+
+bool FCharacterReloadTest::RunTest(const FString& Parameters)
+{
+	TSharedRef<FCharacterTestState> State = StartCharacterTest(this);
+
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, State]()
+	{
+		AFirstPersonCharacter* Character = State->Character.Get();
+		if (Character == nullptr) return true;
+
+		// Two shots, then a reload
+		FFirstPersonTestAccess::Fire(Character);
+		FFirstPersonTestAccess::Fire(Character);
+		const FGun& Gun = Character->Inventory.Weapons[Revolver];
+		const int32 TotalAmmo = Character->Inventory.TotalAmmo[Revolver];
+		const int32 Missing = Gun.maxClipAmmo - Gun.clipAmmo;
+		TestTrue(TEXT("The shots emptied part of the clip"), Missing > 0);
+
+		FFirstPersonTestAccess::Reload(Character);
+		TestEqual(TEXT("Reloading fills the clip"), Gun.clipAmmo, Gun.maxClipAmmo);
+		TestEqual(TEXT("Reloading takes the rounds from the carried ammo"), Character->Inventory.TotalAmmo[Revolver], TotalAmmo - Missing);
+
+		// Firing works with the reloaded clip
+		FFirstPersonTestAccess::Fire(Character);
+		TestEqual(TEXT("The reloaded clip fires"), Gun.clipAmmo, Gun.maxClipAmmo - 1);
+		return true;
+	}));
+
+	EndCharacterTest(State);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCharacterPickupTest, "FirstPerson.Character.Pickup", CharacterTestFlags)
+
+bool FCharacterPickupTest::RunTest(const FString& Parameters)
+{
+	TSharedRef<FCharacterTestState> State = StartCharacterTest(this);
+
+	// A shotgun at the character's feet, found by UWeaponPickupSubsystem as a player walking over it would be
+	TSharedRef<TWeakObjectPtr<AWeapon>> Pickup = MakeShared<TWeakObjectPtr<AWeapon>>();
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, State, Pickup]()
+	{
+		AFirstPersonCharacter* Character = State->Character.Get();
+		if (Character == nullptr) return true;
+
+		TestFalse(TEXT("The shotgun is not owned at first"), Character->Inventory.Owns(Shotgun));
+
+		AWeapon* Weapon = State->GetWorld()->SpawnActorDeferred<AWeapon>(AWeapon::StaticClass(), Character->GetActorTransform());
+		if (Weapon == nullptr)
+		{
+			AddError(TEXT("The pickup could not be spawned"));
+			return true;
+		}
+		Weapon->weaponType = Shotgun;
+		Weapon->clipAmmo = Weapon->maxClipAmmo = 8;
+		Weapon->damage = 40;
+		Weapon->FinishSpawning(Character->GetActorTransform());
+		State->Spawned.Add(Weapon);
+		*Pickup = Weapon;
+		return true;
+	}));
+
+	WaitUntil(this, State, TEXT("The shotgun was not picked up"), 2.f, [State]()
+	{
+		return State->Character->Inventory.Owns(Shotgun);
+	});
+
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, State, Pickup]()
+	{
+		AFirstPersonCharacter* Character = State->Character.Get();
+		if (Character == nullptr || !Character->Inventory.Owns(Shotgun)) return true;
+
+		TestTrue(TEXT("A new weapon is equipped when picked up"), Character->Inventory.Equipped == Shotgun && Character->EquippedGun == Shotgun);
+		TestEqual(TEXT("A new weapon comes with the pickup's clip"), Character->Inventory.Weapons[Shotgun].clipAmmo, 8);
+		TestTrue(TEXT("A taken pickup is not available"), Pickup->IsValid() && !Pickup->Get()->IsAvailable());
+		return true;
+	}));
+
+	EndCharacterTest(State);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCharacterWeaponSwitchTest, "FirstPerson.Character.WeaponSwitch", CharacterTestFlags)
+
+bool FCharacterWeaponSwitchTest::RunTest(const FString& Parameters)
+{
+	TSharedRef<FCharacterTestState> State = StartCharacterTest(this);
+
+	ADD_LATENT_AUTOMATION_COMMAND(FFunctionLatentCommand([this, State]()
+	{
+		AFirstPersonCharacter* Character = State->Character.Get();
+		if (Character == nullptr) return true;
+
+		FFirstPersonTestAccess::EquipWeapon(Character, Rifle);
+		TestTrue(TEXT("A weapon that is not owned is not equipped"), Character->Inventory.Equipped == Revolver && Character->EquippedGun == Revolver);
+
+		FFirstPersonTestAccess::EquipWeapon(Character, Melee);
+		TestTrue(TEXT("The knife is equipped"), Character->Inventory.Equipped == Melee && Character->EquippedGun == Melee);
+
+		const int32 ClipAmmo = Character->Inventory.Weapons[Revolver].clipAmmo;
+		FFirstPersonTestAccess::Fire(Character);
+		TestEqual(TEXT("The knife doesn't take the revolver's rounds"), Character->Inventory.Weapons[Revolver].clipAmmo, ClipAmmo);
+
+		FFirstPersonTestAccess::EquipWeapon(Character, Character->Inventory.Cached);
+		TestTrue(TEXT("Switching back equips the revolver"), Character->Inventory.Equipped == Revolver && Character->EquippedGun == Revolver);
+		return true;
+	}));
+
+	EndCharacterTest(State);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,16 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "FirstPersonTestAccess.h"
+#include "Engine/World.h"
+#include "GameFramework/GameModeBase.h"
+
+AFirstPersonCharacter* FFirstPersonTestAccess::SpawnCharacter(UWorld* World, const FVector& Location, const FRotator& Rotation)
+{
+	const AGameModeBase* GameMode = World->GetAuthGameMode();
+	if (GameMode == nullptr || GameMode->DefaultPawnClass == nullptr) return nullptr;
+
+	FActorSpawnParameters SpawnParams;
+	SpawnParams.SpawnCollisionHandlingOverride = ESpawnActorCollisionHandlingMethod::AlwaysSpawn;
+	return World->SpawnActor<AFirstPersonCharacter>(GameMode->DefaultPawnClass, Location, Rotation, SpawnParams);
+}
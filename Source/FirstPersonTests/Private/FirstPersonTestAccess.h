@@ -0,0 +1,21 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "FirstPersonCharacter.h"
+
+class UWorld;
+
+// The character's input handlers and state, for the automation tests and the perf suite
+struct FFirstPersonTestAccess
+{
+	static void Fire(AFirstPersonCharacter* Character) { Character->OnFire(); }
+	static void Reload(AFirstPersonCharacter* Character) { Character->OnReload(); }
+	static void EquipWeapon(AFirstPersonCharacter* Character, EWeaponType Type) { Character->OnEquipWeapon(Type); }
+
+	static float GetHealth(const AFirstPersonCharacter* Character) { return Character->health; }
+
+	/** Spawns a character of the game mode's default pawn class, without a controller */
+	static AFirstPersonCharacter* SpawnCharacter(UWorld* World, const FVector& Location, const FRotator& Rotation = FRotator::ZeroRotator);
+};
@@ -0,0 +1,151 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "Inventory.h"
+#include "Misc/AutomationTest.h"
+#include "UObject/CoreNet.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+static const int32 InventoryTestFlags = EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::ProductFilter;
+
+// A pickup's gun, as PickUp passes it to the inventory
+static FGun MakeGun(int32 ClipAmmo, int32 Damage)
+{
+	FGun Gun;
+	Gun.clipAmmo = Gun.maxClipAmmo = ClipAmmo;
+	Gun.reloadTime = 3;
+	Gun.damage = Damage;
+	return Gun;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInventoryFireTest, "FirstPerson.Inventory.Fire", InventoryTestFlags)
+
+bool FInventoryFireTest::RunTest(const FString& Parameters)
+{
+	FFirstPersonInventory Inventory;
+	const int32 ClipAmmo = Inventory.Weapons[Revolver].clipAmmo;
+
+	TestTrue(TEXT("A loaded revolver fires"), Inventory.ConsumeClipAmmo());
+	TestEqual(TEXT("A shot takes one round from the clip"), Inventory.Weapons[Revolver].clipAmmo, ClipAmmo - 1);
+	TestEqual(TEXT("A shot leaves the carried ammo"), Inventory.TotalAmmo[Revolver], FFirstPersonInventory().TotalAmmo[Revolver]);
+
+	Inventory.Weapons[Revolver].clipAmmo = 0;
+	TestFalse(TEXT("An empty clip doesn't fire"), Inventory.ConsumeClipAmmo());
+	TestEqual(TEXT("An empty clip stays empty"), Inventory.Weapons[Revolver].clipAmmo, 0);
+
+	Inventory.Equip(Melee);
+	TestFalse(TEXT("The knife takes no rounds"), Inventory.ConsumeClipAmmo());
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInventoryReloadTest, "FirstPerson.Inventory.Reload", InventoryTestFlags)
+
+bool FInventoryReloadTest::RunTest(const FString& Parameters)
+{
+	FFirstPersonInventory Inventory;
+	FGun& Gun = Inventory.Weapons[Revolver];
+
+	Gun.clipAmmo = 0;
+	Inventory.TotalAmmo[Revolver] = 20;
+	Inventory.Reload();
+	TestEqual(TEXT("Reloading fills the clip"), Gun.clipAmmo, Gun.maxClipAmmo);
+	TestEqual(TEXT("Reloading takes the rounds from the carried ammo"), Inventory.TotalAmmo[Revolver], 20 - Gun.maxClipAmmo);
+
+	Inventory.Reload();
+	TestEqual(TEXT("A full clip takes no rounds"), Inventory.TotalAmmo[Revolver], 20 - Gun.maxClipAmmo);
+
+	Gun.clipAmmo = 0;
+	Inventory.TotalAmmo[Revolver] = 2;
+	Inventory.Reload();
+	TestEqual(TEXT("Reloading loads what is left"), Gun.clipAmmo, 2);
+	TestEqual(TEXT("Reloading what is left empties the carried ammo"), Inventory.TotalAmmo[Revolver], 0);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInventoryPickupTest, "FirstPerson.Inventory.Pickup", InventoryTestFlags)
+
+bool FInventoryPickupTest::RunTest(const FString& Parameters)
+{
+	FFirstPersonInventory Inventory;
+	TestFalse(TEXT("The shotgun is not owned at first"), Inventory.Owns(Shotgun));
+
+	TestTrue(TEXT("A new weapon is added"), Inventory.AddWeapon(Shotgun, MakeGun(8, 40)));
+	TestTrue(TEXT("A picked up weapon is owned"), Inventory.Owns(Shotgun));
+	TestEqual(TEXT("A new weapon comes with the pickup's clip"), Inventory.Weapons[Shotgun].clipAmmo, 8);
+	TestEqual(TEXT("A new weapon comes with the pickup's damage"), Inventory.Weapons[Shotgun].damage, 40);
+
+	const int32 TotalAmmo = Inventory.TotalAmmo[Shotgun];
+	TestFalse(TEXT("An owned weapon is not added again"), Inventory.AddWeapon(Shotgun, MakeGun(8, 99)));
+	TestEqual(TEXT("An owned weapon's pickup adds its clip to the carried ammo"), Inventory.TotalAmmo[Shotgun], TotalAmmo + 8);
+	TestEqual(TEXT("An owned weapon's pickup leaves its stats"), Inventory.Weapons[Shotgun].damage, 40);
+
+	Inventory.TotalAmmo[Shotgun] = Inventory.MaxTotalAmmo[Shotgun] - 1;
+	Inventory.AddWeapon(Shotgun, MakeGun(8, 40));
+	TestEqual(TEXT("Carried ammo is capped"), Inventory.TotalAmmo[Shotgun], Inventory.MaxTotalAmmo[Shotgun]);
+
+	TestTrue(TEXT("A gun within the replicated ranges is replicable"), FFirstPersonInventory::IsReplicable(MakeGun(FFirstPersonInventory::MaxClipAmmoLimit, FFirstPersonInventory::MaxDamageLimit)));
+	TestFalse(TEXT("A clip larger than replication carries is not replicable"), FFirstPersonInventory::IsReplicable(MakeGun(FFirstPersonInventory::MaxClipAmmoLimit + 1, 40)));
+	TestFalse(TEXT("Damage larger than replication carries is not replicable"), FFirstPersonInventory::IsReplicable(MakeGun(8, FFirstPersonInventory::MaxDamageLimit + 1)));
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInventoryWeaponSwitchTest, "FirstPerson.Inventory.WeaponSwitch", InventoryTestFlags)
+
+bool FInventoryWeaponSwitchTest::RunTest(const FString& Parameters)
+{
+	FFirstPersonInventory Inventory;
+	TestFalse(TEXT("A weapon that is not owned can't be equipped"), Inventory.Equip(Rifle));
+	TestTrue(TEXT("The revolver stays equipped"), Inventory.Equipped == Revolver);
+	TestFalse(TEXT("The equipped weapon is not equipped again"), Inventory.Equip(Revolver));
+
+	Inventory.AddWeapon(Rifle, MakeGun(30, 20));
+	TestTrue(TEXT("An owned weapon is equipped"), Inventory.Equip(Rifle));
+	TestTrue(TEXT("The rifle is equipped"), Inventory.Equipped == Rifle);
+	TestTrue(TEXT("The revolver is the one to switch back to"), Inventory.Cached == Revolver);
+
+	TestTrue(TEXT("Switching back"), Inventory.Equip(Inventory.Cached));
+	TestTrue(TEXT("The revolver is equipped again"), Inventory.Equipped == Revolver);
+	TestTrue(TEXT("The rifle is the one to switch back to"), Inventory.Cached == Rifle);
+	return true;
+}
+
+// Sends the server's changes since Acked to the client, as NetDeltaSerialize does
+static void ReplicateInventory(const FFirstPersonInventory& Server, FFirstPersonInventory& Acked, FFirstPersonInventory& Client, bool bFull)
+{
+	FNetBitWriter Writer(nullptr, 256);
+	Server.WriteDelta(Writer, bFull ? nullptr : &Acked);
+	FNetBitReader Reader(nullptr, Writer.GetData(), Writer.GetNumBits());
+	Client.ReceiveDelta(Reader);
+	Acked = Server;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FInventoryReplicationTest, "FirstPerson.Inventory.Replication", InventoryTestFlags)
+
+bool FInventoryReplicationTest::RunTest(const FString& Parameters)
+{
+	FFirstPersonInventory Server, Acked, Client;
+	ReplicateInventory(Server, Acked, Client, true);
+	TestTrue(TEXT("The first replication is whole"), Client == Server);
+
+	// A shot the server accepted, then one it rejected
+	Client.ConsumeClipAmmo();
+	Server.ConsumeClipAmmo();
+	ReplicateInventory(Server, Acked, Client, false);
+	TestTrue(TEXT("A confirmed prediction matches the server"), Client == Server);
+
+	Client.ConsumeClipAmmo();
+	TestTrue(TEXT("The prediction is ahead of the server"), Client != Server);
+	Client.RestoreServerState();
+	TestTrue(TEXT("A rejected prediction is dropped"), Client == Server);
+
+	// A rejected shot followed by a change of the server's: the delta replaces the prediction
+	Client.ConsumeClipAmmo();
+	Server.AddWeapon(Shotgun, MakeGun(8, 40));
+	ReplicateInventory(Server, Acked, Client, false);
+	TestTrue(TEXT("A delta overwrites a rejected prediction"), Client == Server);
+	TestTrue(TEXT("The picked up weapon is replicated"), Client.Owns(Shotgun));
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,248 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+
+#include "PerfSuite.h"
+#include "FirstPersonTests.h"
+#include "FirstPersonBotController.h"
+#include "FirstPersonCharacter.h"
+#include "FirstPersonTestAccess.h"
+#include "Weapon.h"
+#include "Engine/World.h"
+#include "Misc/CommandLine.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+// Adds the time of one call to a case
+static void TimeCall(FPerfSuiteResult& Result, TFunctionRef<void()> Call)
+{
+	const uint64 Start = FPlatformTime::Cycles64();
+	Call();
+	const double Us = FPlatformTime::ToMilliseconds64(FPlatformTime::Cycles64() - Start) * 1000.0;
+
+	Result.Iterations++;
+	Result.TotalUs += Us;
+	Result.MaxUs = FMath::Max(Result.MaxUs, Us);
+}
+
+bool UPerfSuiteSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	return FParse::Param(FCommandLine::Get(), TEXT("FPPerfSuite"));
+}
+
+void UPerfSuiteSubsystem::OnWorldBeginPlay(UWorld& InWorld)
+{
+	Super::OnWorldBeginPlay(InWorld);
+
+	// Cases call the server side of every path
+	if (!InWorld.IsGameWorld() || !InWorld.IsServer()) return;
+
+	FParse::Value(FCommandLine::Get(), TEXT("FPPerfSuiteIterations="), Iterations);
+	FParse::Value(FCommandLine::Get(), TEXT("FPPerfSuiteBots="), NumBots);
+	if (!FParse::Value(FCommandLine::Get(), TEXT("FPPerfSuiteCSV="), CSVPath)) CSVPath = TEXT("PerfSuite.csv");
+	CSVPath = FPaths::Combine(FPaths::ProjectSavedDir(), CSVPath);
+	Iterations = FMath::Max(Iterations, 1);
+
+	SpawnBots();
+	bStarted = true;
+
+	UE_LOG(LogFPTests, Display, TEXT("Perf suite: %d iterations per case, %d bots, writing %s"), Iterations, NumBots, *CSVPath);
+}
+
+ETickableTickType UPerfSuiteSubsystem::GetTickableTickType() const
+{
+	return IsTemplate() ? ETickableTickType::Never : ETickableTickType::Conditional;
+}
+
+bool UPerfSuiteSubsystem::IsTickable() const
+{
+	return bStarted;
+}
+
+TStatId UPerfSuiteSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UPerfSuiteSubsystem, STATGROUP_Tickables);
+}
+
+void UPerfSuiteSubsystem::Tick(float DeltaTime)
+{
+	// Pools, caches and the bots' fights are warm by then
+	if (++Frames < WarmUpFrames) return;
+
+	bStarted = false;
+	RunCases();
+}
+
+AFirstPersonCharacter* UPerfSuiteSubsystem::SpawnCharacter(int32 Index, bool bPossess) const
+{
+	const FVector Location(500.f + (Index / 16) * 300.f, (Index % 16 - 7.5f) * 300.f, 200.f);
+	AFirstPersonCharacter* Character = FFirstPersonTestAccess::SpawnCharacter(GetWorld(), Location);
+	if (Character == nullptr || !bPossess) return Character;
+
+	AFirstPersonBotController* Bot = GetWorld()->SpawnActor<AFirstPersonBotController>();
+	Bot->SetSeed(Index);
+	Bot->Possess(Character);
+	return Character;
+}
+
+void UPerfSuiteSubsystem::SpawnBots()
+{
+	for (int32 i = 0; i < NumBots; i++) SpawnCharacter(i, true);
+}
+
+void UPerfSuiteSubsystem::RunCases()
+{
+	TArray<FPerfSuiteResult> Results;
+
+	// One character for all gameplay cases, played by nobody but the suite
+	AFirstPersonCharacter* Character = SpawnCharacter(NumBots, false);
+	if (Character != nullptr)
+	{
+		// Reload and fire need the starting gun, the pickups then equip new ones
+		Results.Add(TimeFire(Character));
+		Results.Add(TimeReload(Character));
+		Results.Add(TimePickup(Character));
+		Results.Add(TimeEquip(Character));
+		Character->Destroy();
+	}
+	Results.Add(TimeSpawn());
+
+	bool bPassed = Character != nullptr;
+	if (Character == nullptr) UE_LOG(LogFPTests, Error, TEXT("Perf suite: the game mode has no character class to spawn"));
+
+	for (const FPerfSuiteResult& Result : Results)
+	{
+		bPassed &= Result.Passed();
+		UE_LOG(LogFPTests, Display, TEXT("  %s: %.2f us avg, %.2f us max, threshold %.0f us, %d failed calls: %s"),
+			*Result.Name, Result.AverageUs(), Result.MaxUs, Result.ThresholdUs, Result.Failures, Result.Passed() ? TEXT("passed") : TEXT("FAILED"));
+	}
+	WriteReport(Results);
+
+	UE_LOG(LogFPTests, Display, TEXT("Perf suite %s"), bPassed ? TEXT("passed") : TEXT("failed"));
+	FPlatformMisc::RequestExitWithStatus(false, bPassed ? 0 : 1);
+}
+
+FPerfSuiteResult UPerfSuiteSubsystem::TimeFire(AFirstPersonCharacter* Character) const
+{
+	FPerfSuiteResult Result;
+	Result.Name = TEXT("Fire");
+	Result.ThresholdUs = FireThresholdUs;
+
+	// Without projectiles OnFire returns right away
+	if (Character->ProjectileClass == nullptr || Character->Inventory.Equipped == Melee) Result.Failures++;
+
+	for (int32 i = 0; i < Iterations && Result.Failures == 0; i++)
+	{
+		FGun& Gun = Character->Inventory.Weapons[Character->Inventory.Equipped];
+		Gun.clipAmmo = FMath::Max(Gun.maxClipAmmo, 1);
+		const int32 ClipAmmo = Gun.clipAmmo;
+
+		TimeCall(Result, [Character]() { FFirstPersonTestAccess::Fire(Character); });
+		if (Gun.clipAmmo != ClipAmmo - 1) Result.Failures++;
+	}
+	return Result;
+}
+
+FPerfSuiteResult UPerfSuiteSubsystem::TimeReload(AFirstPersonCharacter* Character) const
+{
+	FPerfSuiteResult Result;
+	Result.Name = TEXT("Reload");
+	Result.ThresholdUs = ReloadThresholdUs;
+
+	FFirstPersonInventory& Inventory = Character->Inventory;
+	for (int32 i = 0; i < Iterations; i++)
+	{
+		FGun& Gun = Inventory.Weapons[Inventory.Equipped];
+		Gun.clipAmmo = 0;
+		Inventory.TotalAmmo[Inventory.Equipped] = Inventory.MaxTotalAmmo[Inventory.Equipped];
+
+		TimeCall(Result, [Character]() { FFirstPersonTestAccess::Reload(Character); });
+		if (Gun.clipAmmo != Gun.maxClipAmmo || Gun.maxClipAmmo == 0) Result.Failures++;
+	}
+	return Result;
+}
+
+FPerfSuiteResult UPerfSuiteSubsystem::TimePickup(AFirstPersonCharacter* Character) const
+{
+	FPerfSuiteResult Result;
+	Result.Name = TEXT("Pickup");
+	Result.ThresholdUs = PickupThresholdUs;
+
+	// High above the map, where no character walks over it
+	AWeapon* Pickup = GetWorld()->SpawnActor<AWeapon>(FVector(0.f, 0.f, 100000.f), FRotator::ZeroRotator);
+	if (Pickup == nullptr)
+	{
+		Result.Failures++;
+		return Result;
+	}
+	Pickup->maxClipAmmo = Pickup->clipAmmo = 10;
+	Pickup->damage = 10;
+
+	for (int32 i = 0; i < Iterations; i++)
+	{
+		// New weapons first, then ammo for owned ones
+		const EWeaponType Type = i % 2 == 0 ? Shotgun : Rifle;
+		Pickup->weaponType = Type;
+		if (!Pickup->IsAvailable()) Pickup->OnWeaponSpawn();
+
+		TimeCall(Result, [Character, Pickup]() { Character->PickUp(Pickup); });
+		if (Pickup->IsAvailable() || !Character->Inventory.Owns(Type)) Result.Failures++;
+	}
+
+	Pickup->Destroy();
+	return Result;
+}
+
+FPerfSuiteResult UPerfSuiteSubsystem::TimeEquip(AFirstPersonCharacter* Character) const
+{
+	FPerfSuiteResult Result;
+	Result.Name = TEXT("Equip");
+	Result.ThresholdUs = EquipThresholdUs;
+
+	// Switches between every owned weapon in turn
+	TArray<EWeaponType> Owned;
+	for (int32 Type = 0; Type < MAX_WEAPON_TYPE; Type++)
+	{
+		if (Character->Inventory.Owns(EWeaponType(Type))) Owned.Add(EWeaponType(Type));
+	}
+	if (Owned.Num() < 2) Result.Failures++;
+
+	for (int32 i = 0; i < Iterations && Result.Failures == 0; i++)
+	{
+		const EWeaponType Type = Owned[(Owned.IndexOfByKey(Character->Inventory.Equipped.GetValue()) + 1) % Owned.Num()];
+
+		TimeCall(Result, [Character, Type]() { FFirstPersonTestAccess::EquipWeapon(Character, Type); });
+		if (Character->Inventory.Equipped != Type || Character->EquippedGun != Type) Result.Failures++;
+	}
+	return Result;
+}
+
+FPerfSuiteResult UPerfSuiteSubsystem::TimeSpawn() const
+{
+	FPerfSuiteResult Result;
+	Result.Name = TEXT("Spawn");
+	Result.ThresholdUs = SpawnThresholdUs;
+
+	// Spawning includes BeginPlay, and registering with every subsystem, while the bots play
+	TArray<AFirstPersonCharacter*> Characters;
+	for (int32 i = 0; i < Iterations; i++)
+	{
+		AFirstPersonCharacter* Character = nullptr;
+		TimeCall(Result, [this, i, &Character]() { Character = SpawnCharacter(NumBots + 1 + i, false); });
+		if (Character == nullptr || !Character->HasActorBegunPlay()) Result.Failures++;
+		if (Character != nullptr) Characters.Add(Character);
+	}
+
+	for (AFirstPersonCharacter* Character : Characters) Character->Destroy();
+	return Result;
+}
+
+void UPerfSuiteSubsystem::WriteReport(const TArray<FPerfSuiteResult>& Results) const
+{
+	FString Report = TEXT("Case,Iterations,AvgUs,MaxUs,ThresholdUs,FailedCalls,Passed\n");
+	for (const FPerfSuiteResult& Result : Results)
+	{
+		Report += FString::Printf(TEXT("%s,%d,%.3f,%.3f,%.1f,%d,%d\n"),
+			*Result.Name, Result.Iterations, Result.AverageUs(), Result.MaxUs, Result.ThresholdUs, Result.Failures, Result.Passed() ? 1 : 0);
+	}
+	FFileHelper::SaveStringToFile(Report, *CSVPath);
+}
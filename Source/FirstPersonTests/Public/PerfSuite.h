@@ -0,0 +1,101 @@
+// Fill out your copyright notice in the Description page of Project Settings.
+
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Subsystems/WorldSubsystem.h"
+#include "Tickable.h"
+#include "PerfSuite.generated.h"
+
+class AFirstPersonCharacter;
+
+// Timings of one case of the suite
+struct FPerfSuiteResult
+{
+	FString Name;
+	int32 Iterations = 0;
+	double TotalUs = 0.0;
+	double MaxUs = 0.0;
+	float ThresholdUs = 0.f;
+
+	// Times the timed path did not do its work, a broken path must not pass as a fast one
+	int32 Failures = 0;
+
+	double AverageUs() const { return Iterations > 0 ? TotalUs / Iterations : 0.0; }
+	bool Passed() const { return Iterations > 0 && Failures == 0 && (ThresholdUs <= 0.f || AverageUs() <= ThresholdUs); }
+};
+
+/**
+ * Headless performance suite of the character's gameplay paths, enabled from the command line of a
+ * server or a standalone game:
+ *   -FPPerfSuite                      run the suite once the map has begun play, then exit
+ *   -FPPerfSuiteCSV=PerfSuite.csv     report file, relative to the project's Saved folder
+ *   -FPPerfSuiteIterations=200        calls timed per case
+ *   -FPPerfSuiteBots=32               bot characters playing around while cases are timed
+ *
+ * Times OnFire down to the projectiles' spawn, OnReload, PickUp, OnEquipWeapon and spawning a
+ * character, each on a character of the game mode's default pawn class. A case fails when its
+ * average is over its threshold in the [/Script/FirstPersonTests.PerfSuiteSubsystem] section of
+ * DefaultGame.ini, or when a call did not do what it should. The process exits with code 1 if any
+ * case failed, so a nightly job can run e.g.
+ *   UE4Editor FirstPerson.uproject FirstPersonExampleMap -server -nullrhi -unattended -FPPerfSuite
+ */
+UCLASS(Config = Game)
+class FIRSTPERSONTESTS_API UPerfSuiteSubsystem : public UWorldSubsystem, public FTickableGameObject
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void OnWorldBeginPlay(UWorld& InWorld) override;
+
+	// FTickableGameObject interface
+	virtual void Tick(float DeltaTime) override;
+	virtual ETickableTickType GetTickableTickType() const override;
+	virtual bool IsTickable() const override;
+	virtual TStatId GetStatId() const override;
+	virtual UWorld* GetTickableGameObjectWorld() const override { return GetWorld(); }
+	// End of FTickableGameObject interface
+
+	/** Highest average time of each case, in microseconds, 0 only checks the case works */
+	UPROPERTY(Config)
+	float FireThresholdUs = 500.f;
+
+	UPROPERTY(Config)
+	float ReloadThresholdUs = 20.f;
+
+	UPROPERTY(Config)
+	float PickupThresholdUs = 100.f;
+
+	UPROPERTY(Config)
+	float EquipThresholdUs = 100.f;
+
+	UPROPERTY(Config)
+	float SpawnThresholdUs = 2000.f;
+
+	/** Frames the bots play before the cases are timed */
+	UPROPERTY(Config)
+	int32 WarmUpFrames = 120;
+
+private:
+	void SpawnBots();
+	void RunCases();
+	void WriteReport(const TArray<FPerfSuiteResult>& Results) const;
+
+	// Each case times Iterations calls on the character
+	FPerfSuiteResult TimeFire(AFirstPersonCharacter* Character) const;
+	FPerfSuiteResult TimeReload(AFirstPersonCharacter* Character) const;
+	FPerfSuiteResult TimePickup(AFirstPersonCharacter* Character) const;
+	FPerfSuiteResult TimeEquip(AFirstPersonCharacter* Character) const;
+	FPerfSuiteResult TimeSpawn() const;
+
+	// Spawns a character of the default pawn class in front of the others, possessed by a bot if asked
+	AFirstPersonCharacter* SpawnCharacter(int32 Index, bool bPossess) const;
+
+	FString CSVPath;
+	int32 Iterations = 200;
+	int32 NumBots = 32;
+
+	bool bStarted = false;
+	int32 Frames = 0;
+};